@@ -0,0 +1,196 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "base/WorkerPool.h"
+
+#include <glog/logging.h>
+
+#include <unistd.h>
+
+namespace encfs {
+
+// upper limit on the size of the default pool.
+static const int MaxDefaultThreads = 16;
+
+WorkerPool::WorkerPool(int threadCount) : shutdown(false) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_init(&wakeup, 0);
+
+  for (int i = 0; i < threadCount; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, threadMain, this) != 0) {
+      LOG(WARNING) << "unable to create worker thread";
+      break;
+    }
+    threads.push_back(thread);
+  }
+  VLOG(1) << "started " << threads.size() << " worker threads";
+#else
+  (void)threadCount;
+#endif
+}
+
+WorkerPool::~WorkerPool() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  {
+    Lock _lock(mutex);
+    shutdown = true;
+    pthread_cond_broadcast(&wakeup);
+  }
+
+  for (size_t i = 0; i < threads.size(); ++i) pthread_join(threads[i], 0);
+
+  pthread_cond_destroy(&wakeup);
+#endif
+}
+
+shared_ptr<WorkerPool> WorkerPool::Default() {
+  static Mutex defaultMutex;
+  static shared_ptr<WorkerPool> defaultPool;
+
+  Lock _lock(defaultMutex);
+  if (!defaultPool) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    if (cpus > MaxDefaultThreads) cpus = MaxDefaultThreads;
+
+    defaultPool.reset(new WorkerPool((int)cpus));
+  }
+
+  return defaultPool;
+}
+
+int WorkerPool::threadCount() const {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  return threads.size();
+#else
+  return 0;
+#endif
+}
+
+void WorkerPool::submit(const Task &task) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  // the thread list doesn't change after construction.
+  if (!threads.empty()) {
+    Lock _lock(mutex);
+    queue.push_back(task);
+    pthread_cond_signal(&wakeup);
+    return;
+  }
+#endif
+
+  task();
+}
+
+void *WorkerPool::threadMain(void *arg) {
+  static_cast<WorkerPool *>(arg)->workLoop();
+  return 0;
+}
+
+void WorkerPool::workLoop() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  Lock _lock(mutex);
+
+  while (true) {
+    while (queue.empty() && !shutdown)
+      pthread_cond_wait(&wakeup, &mutex._mutex);
+
+    if (queue.empty()) break;
+
+    Task task = queue.front();
+    queue.pop_front();
+
+    mutex.unlock();
+    task();
+    mutex.lock();
+  }
+#endif
+}
+
+namespace {
+
+// Shared between the caller of parallelFor and the helper tasks, which may
+// still be queued after the caller returns.
+struct ParallelState {
+  Mutex mutex;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_t finished;
+#endif
+  std::function<void(int)> fn;
+  int count;
+  int next;
+  int done;
+
+  ParallelState(const std::function<void(int)> &fn_, int count_)
+      : fn(fn_), count(count_), next(0), done(0) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+    pthread_cond_init(&finished, 0);
+#endif
+  }
+
+  ~ParallelState() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+    pthread_cond_destroy(&finished);
+#endif
+  }
+
+  // Runs items until there are none left.
+  void work() {
+    while (true) {
+      int item;
+      {
+        Lock _lock(mutex);
+        if (next >= count) return;
+        item = next++;
+      }
+
+      fn(item);
+
+      Lock _lock(mutex);
+      if (++done == count) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+        pthread_cond_broadcast(&finished);
+#endif
+      }
+    }
+  }
+};
+
+}  // namespace
+
+void WorkerPool::parallelFor(int count, const std::function<void(int)> &fn) {
+  if (count <= 0) return;
+
+  shared_ptr<ParallelState> state(new ParallelState(fn, count));
+
+  int helpers = count - 1;
+  if (helpers > threadCount()) helpers = threadCount();
+  for (int i = 0; i < helpers; ++i) submit([state]() { state->work(); });
+
+  state->work();
+
+#ifdef CMAKE_USE_PTHREADS_INIT
+  Lock _lock(state->mutex);
+  while (state->done < state->count)
+    pthread_cond_wait(&state->finished, &state->mutex._mutex);
+#endif
+}
+
+}  // namespace encfs
@@ -0,0 +1,84 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WorkerPool_incl_
+#define _WorkerPool_incl_
+
+#include "base/config.h"
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Fixed size pool of worker threads.
+
+    Tasks submitted to the pool run in FIFO order on whichever thread becomes
+    free first.  If thread support is not available, tasks run immediately on
+    the calling thread.
+
+    Threads do not survive fork(), so the pool must not be created before
+    the filesystem daemonizes.  Default() creates the shared pool on first
+    use for this reason.
+*/
+class WorkerPool {
+ public:
+  typedef std::function<void()> Task;
+
+  explicit WorkerPool(int threads);
+
+  // Waits for queued tasks to finish before returning.
+  ~WorkerPool();
+
+  // Process wide pool, sized to the number of processors.
+  static shared_ptr<WorkerPool> Default();
+
+  int threadCount() const;
+
+  void submit(const Task &task);
+
+  // Runs fn(0) .. fn(count - 1) on the pool, and returns once all calls have
+  // finished.  The calling thread takes part, so this is safe to call from
+  // within a pool task.
+  void parallelFor(int count, const std::function<void(int)> &fn);
+
+ private:
+  static void *threadMain(void *arg);
+  void workLoop();
+
+  mutable Mutex mutex;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_t wakeup;
+  std::vector<pthread_t> threads;
+#endif
+  std::deque<Task> queue;
+  bool shutdown;
+
+  WorkerPool(const WorkerPool &);
+  WorkerPool &operator=(const WorkerPool &);
+};
+
+}  // namespace encfs
+
+#endif
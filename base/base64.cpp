@@ -20,9 +20,12 @@
 
 #include "base/base64.h"
 
-#include <ctype.h>
 #include <glog/logging.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace encfs {
 
 // change between two powers of two, stored as the low bits of the bytes in the
@@ -58,52 +61,72 @@ void changeBase2(byte *src, int srcLen, int src2Pow, byte *dst, int dstLen,
     Same as changeBase2, except the output is written over the input data.  The
     output is assumed to be large enough to accept the data.
 
-    Uses the stack to store output values.  Recurse every time a new value is
-    to be written, then write the value at the tail end of the recursion.
+    When the data shrinks, output values never catch up with the input which is
+    still to be read, so it is converted front to back.  When the data grows,
+    output value k depends only on input values up to k, so it is converted
+    back to front instead.
+
+    The output matches what the original (recursive) version wrote, including
+    the partial value it always writes once the input runs out.
 */
-static void changeBase2Inline(byte *src, int srcLen, int src2Pow, int dst2Pow,
-                              bool outputPartialLastByte, unsigned long work,
-                              int workBits, byte *outLoc) {
+void changeBase2Inline(byte *src, int srcLen, int src2Pow, int dst2Pow,
+                       bool outputPartialLastByte) {
+  if (srcLen <= 0) return;
+
   const int mask = (1 << dst2Pow) - 1;
-  if (!outLoc) outLoc = src;
 
-  // copy the new bits onto the high bits of the stream.
-  // The bits that fall off the low end are the output bits.
-  while (srcLen && workBits < dst2Pow) {
-    work |= ((unsigned long)(*src++)) << workBits;
-    workBits += src2Pow;
-    --srcLen;
-  }
+  if (dst2Pow >= src2Pow) {
+    unsigned long work = 0;
+    int workBits = 0;
+    const byte *in = src;
+    const byte *end = src + srcLen;
+    byte *out = src;
+
+    while (in != end) {
+      while (in != end && workBits < dst2Pow) {
+        work |= ((unsigned long)(*in++)) << workBits;
+        workBits += src2Pow;
+      }
+
+      *out++ = work & mask;
+      work >>= dst2Pow;
+      workBits -= dst2Pow;
+    }
 
-  // we have at least one value that can be output
-  byte outVal = work & mask;
-  work >>= dst2Pow;
-  workBits -= dst2Pow;
-
-  if (srcLen) {
-    // more input left, so recurse
-    changeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte,
-                      work, workBits, outLoc + 1);
-    *outLoc = outVal;
-  } else {
-    // no input left, we can write remaining values directly
-    *outLoc++ = outVal;
-
-    // we could have a partial value left in the work buffer..
     if (outputPartialLastByte) {
       while (workBits > 0) {
-        *outLoc++ = work & mask;
+        *out++ = work & mask;
         work >>= dst2Pow;
         workBits -= dst2Pow;
       }
     }
+    return;
   }
-}
 
-void changeBase2Inline(byte *src, int srcLen, int src2Pow, int dst2Pow,
-                       bool outputPartialLastByte) {
-  changeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte, 0, 0,
-                    0);
+  // One value is written each time more input is needed, and the last of
+  // those is written once the final input value has been read.
+  const int totalBits = srcLen * src2Pow;
+  int outLen = ((srcLen - 1) * src2Pow) / dst2Pow + 1;
+  if (outputPartialLastByte) outLen = (totalBits + dst2Pow - 1) / dst2Pow;
+
+  for (int k = outLen - 1; k >= 0; --k) {
+    // Input values are or'ed into the bit stream as they are, so take
+    // account of any bits set above src2Pow, as the stream version does.
+    const int pos = k * dst2Pow;
+    int first = (pos > 7) ? (pos - 7 + src2Pow - 1) / src2Pow : 0;
+    int last = (pos + dst2Pow - 1) / src2Pow;
+    if (last >= srcLen) last = srcLen - 1;
+
+    unsigned int value = 0;
+    for (int j = first; j <= last; ++j) {
+      int shift = j * src2Pow - pos;
+      if (shift >= 0)
+        value |= (unsigned int)src[j] << shift;
+      else
+        value |= (unsigned int)src[j] >> -shift;
+    }
+    src[k] = value & mask;
+  }
 }
 
 // character set for ascii b64:
@@ -113,63 +136,175 @@ void changeBase2Inline(byte *src, int srcLen, int src2Pow, int dst2Pow,
 // '.' included in the encrypted names, so that it can be reserved for files
 // with special meaning.
 static const char B642AsciiTable[] = ",-0123456789";
-void B64ToAscii(byte *in, int length) {
-  for (int offset = 0; offset < length; ++offset) {
-    int ch = in[offset];
-    if (ch > 11) {
-      if (ch > 37)
-        ch += 'a' - 38;
-      else
-        ch += 'A' - 12;
-    } else
-      ch = B642AsciiTable[ch];
-
-    in[offset] = ch;
-  }
-}
 
 static const byte Ascii2B64Table[] =
     "                                            01  23456789:;       ";
 //  0123456789 123456789 123456789 123456789 123456789 123456789 1234
 //  0         1         2         3         4         5         6
-void AsciiToB64(byte *buf, int length) {
-  while (length--) {
-    byte ch = *buf;
-    if (ch >= 'A') {
+
+namespace {
+
+// Translation tables for every byte value.  Out of range input maps to the
+// same (meaningless) value as the arithmetic versions always produced, so
+// that invalid names are rejected in the same way.
+struct CodecTables {
+  byte b64ToAscii[256];
+  byte asciiToB64[256];
+  byte b32ToAscii[256];
+  byte asciiToB32[256];
+
+  CodecTables() {
+    for (int ch = 0; ch < 256; ++ch) {
+      if (ch > 37)
+        b64ToAscii[ch] = ch + 'a' - 38;
+      else if (ch > 11)
+        b64ToAscii[ch] = ch + 'A' - 12;
+      else
+        b64ToAscii[ch] = B642AsciiTable[ch];
+
       if (ch >= 'a')
-        ch += 38 - 'a';
+        asciiToB64[ch] = ch + 38 - 'a';
+      else if (ch >= 'A')
+        asciiToB64[ch] = ch + 12 - 'A';
+      else
+        asciiToB64[ch] = Ascii2B64Table[ch] - '0';
+
+      if (ch < 26)
+        b32ToAscii[ch] = ch + 'A';
       else
-        ch += 12 - 'A';
-    } else
-      ch = Ascii2B64Table[ch] - '0';
+        b32ToAscii[ch] = ch + '2' - 26;
 
-    *buf++ = ch;
+      // base32 names are case insensitive.
+      int upper = (ch >= 'a' && ch <= 'z') ? ch - 'a' + 'A' : ch;
+      if (upper >= 'A')
+        asciiToB32[ch] = upper - 'A';
+      else
+        asciiToB32[ch] = upper + 26 - '2';
+    }
   }
+};
+
+const CodecTables &codecTables() {
+  static const CodecTables tables;
+  return tables;
+}
+
+inline void translate(const byte *table, byte *buf, int length) {
+  for (int i = 0; i < length; ++i) buf[i] = table[buf[i]];
+}
+
+#ifdef __SSE2__
+const int VecSize = sizeof(__m128i);
+
+inline __m128i ifGreater(__m128i v, char limit, char add) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(limit)),
+                       _mm_set1_epi8(add));
+}
+
+inline __m128i inRange(__m128i v, char lo, char hi) {
+  return _mm_andnot_si128(
+      _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(lo)),
+                   _mm_cmpgt_epi8(v, _mm_set1_epi8(hi))),
+      _mm_set1_epi8(-1));
+}
+
+// Non-zero if any byte is above max (unsigned).
+inline int anyAbove(__m128i v, unsigned char max) {
+  __m128i limit = _mm_set1_epi8((char)max);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit)) !=
+         0xffff;
 }
+#endif
 
-void B32ToAscii(byte *buf, int len) {
-  for (int offset = 0; offset < len; ++offset) {
-    int ch = buf[offset];
-    if (ch >= 0 && ch < 26)
-      ch += 'A';
-    else
-      ch += '2' - 26;
+}  // namespace
 
-    buf[offset] = ch;
+// The vector versions handle 16 values at a time, as long as they are all
+// in range, and leave anything else to the tables.
+void B64ToAscii(byte *in, int length) {
+  const CodecTables &tables = codecTables();
+  int offset = 0;
+#ifdef __SSE2__
+  for (; offset + VecSize <= length; offset += VecSize) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + offset));
+    if (anyAbove(v, 63)) {
+      translate(tables.b64ToAscii, in + offset, VecSize);
+      continue;
+    }
+
+    __m128i add = _mm_set1_epi8(',');
+    add = _mm_add_epi8(add, ifGreater(v, 1, '0' - 2 - ','));
+    add = _mm_add_epi8(add, ifGreater(v, 11, 'A' - 12 - ('0' - 2)));
+    add = _mm_add_epi8(add, ifGreater(v, 37, 'a' - 38 - ('A' - 12)));
+    _mm_storeu_si128((__m128i *)(in + offset), _mm_add_epi8(v, add));
+  }
+#endif
+  translate(tables.b64ToAscii, in + offset, length - offset);
+}
+
+void AsciiToB64(byte *buf, int length) {
+  const CodecTables &tables = codecTables();
+  int offset = 0;
+#ifdef __SSE2__
+  for (; offset + VecSize <= length; offset += VecSize) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + offset));
+    __m128i valid = _mm_or_si128(
+        _mm_or_si128(inRange(v, ',', '-'), inRange(v, '0', '9')),
+        _mm_or_si128(inRange(v, 'A', 'Z'), inRange(v, 'a', 'z')));
+    if (_mm_movemask_epi8(valid) != 0xffff) {
+      translate(tables.asciiToB64, buf + offset, VecSize);
+      continue;
+    }
+
+    __m128i sub = _mm_set1_epi8(',');
+    sub = _mm_add_epi8(sub, ifGreater(v, '0' - 1, '0' - 2 - ','));
+    sub = _mm_add_epi8(sub, ifGreater(v, 'A' - 1, 'A' - 12 - ('0' - 2)));
+    sub = _mm_add_epi8(sub, ifGreater(v, 'a' - 1, 'a' - 38 - ('A' - 12)));
+    _mm_storeu_si128((__m128i *)(buf + offset), _mm_sub_epi8(v, sub));
+  }
+#endif
+  translate(tables.asciiToB64, buf + offset, length - offset);
+}
+
+void B32ToAscii(byte *buf, int length) {
+  const CodecTables &tables = codecTables();
+  int offset = 0;
+#ifdef __SSE2__
+  for (; offset + VecSize <= length; offset += VecSize) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + offset));
+    if (anyAbove(v, 31)) {
+      translate(tables.b32ToAscii, buf + offset, VecSize);
+      continue;
+    }
+
+    __m128i add = _mm_set1_epi8('A');
+    add = _mm_add_epi8(add, ifGreater(v, 25, '2' - 26 - 'A'));
+    _mm_storeu_si128((__m128i *)(buf + offset), _mm_add_epi8(v, add));
   }
+#endif
+  translate(tables.b32ToAscii, buf + offset, length - offset);
 }
 
 void AsciiToB32(byte *buf, int length) {
-  while (length--) {
-    byte ch = *buf;
-    int lch = toupper(ch);
-    if (lch >= 'A')
-      lch -= 'A';
-    else
-      lch += 26 - '2';
-
-    *buf++ = (byte)lch;
+  const CodecTables &tables = codecTables();
+  int offset = 0;
+#ifdef __SSE2__
+  for (; offset + VecSize <= length; offset += VecSize) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + offset));
+    __m128i valid =
+        _mm_or_si128(inRange(v, '2', '7'),
+                     _mm_or_si128(inRange(v, 'A', 'Z'), inRange(v, 'a', 'z')));
+    if (_mm_movemask_epi8(valid) != 0xffff) {
+      translate(tables.asciiToB32, buf + offset, VecSize);
+      continue;
+    }
+
+    __m128i sub = _mm_set1_epi8('2' - 26);
+    sub = _mm_add_epi8(sub, ifGreater(v, 'A' - 1, 'A' - ('2' - 26)));
+    sub = _mm_add_epi8(sub, ifGreater(v, 'a' - 1, 'a' - 'A'));
+    _mm_storeu_si128((__m128i *)(buf + offset), _mm_sub_epi8(v, sub));
   }
+#endif
+  translate(tables.asciiToB32, buf + offset, length - offset);
 }
 
 #define WHITESPACE 64
@@ -23,6 +23,7 @@
 #cmakedefine HAVE_EVP_AES_XTS
 
 #cmakedefine HAVE_LCHMOD
+#cmakedefine HAVE_SYNCFS
 
 /* TODO: add other thread library support. */
 #cmakedefine CMAKE_USE_PTHREADS_INIT
@@ -0,0 +1,158 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "base/sha256.h"
+
+#include <cstring>
+
+namespace encfs {
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t InitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                         0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                         0x1f83d9ab, 0x5be0cd19};
+
+static inline uint32_t ror(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t getBE32(const byte *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void putBE32(byte *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+SHA256::SHA256() { reset(); }
+
+void SHA256::reset() {
+  memcpy(h, InitialState, sizeof(h));
+  bufLen = 0;
+  total = 0;
+}
+
+uint64_t SHA256::length() const { return total; }
+
+void SHA256::transform(const byte *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) w[i] = getBE32(block + i * 4);
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+  uint32_t e = h[4], f = h[5], g = h[6], hh = h[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t S1 = ror(e, 6) ^ ror(e, 11) ^ ror(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = hh + S1 + ch + K[i] + w[i];
+    uint32_t S0 = ror(a, 2) ^ ror(a, 13) ^ ror(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = S0 + maj;
+
+    hh = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+  h[5] += f;
+  h[6] += g;
+  h[7] += hh;
+}
+
+void SHA256::update(const byte *data, size_t len) {
+  total += len;
+
+  if (bufLen > 0) {
+    size_t n = BlockSize - bufLen;
+    if (n > len) n = len;
+    memcpy(buf + bufLen, data, n);
+    bufLen += n;
+    data += n;
+    len -= n;
+    if (bufLen < BlockSize) return;
+    transform(buf);
+    bufLen = 0;
+  }
+
+  for (; len >= (size_t)BlockSize; data += BlockSize, len -= BlockSize)
+    transform(data);
+
+  if (len > 0) {
+    memcpy(buf, data, len);
+    bufLen = len;
+  }
+}
+
+void SHA256::final(byte *digest) {
+  uint64_t bits = total * 8;
+
+  byte pad[BlockSize * 2];
+  memset(pad, 0, sizeof(pad));
+  pad[0] = 0x80;
+  int padLen = (bufLen < 56) ? 56 - bufLen : 120 - bufLen;
+  for (int i = 0; i < 8; ++i) pad[padLen + i] = bits >> (56 - i * 8);
+  update(pad, padLen + 8);
+
+  for (int i = 0; i < 8; ++i) putBE32(digest + i * 4, h[i]);
+}
+
+bool SHA256::saveState(byte *out) const {
+  if (bufLen != 0) return false;
+  for (int i = 0; i < 8; ++i) putBE32(out + i * 4, h[i]);
+  return true;
+}
+
+void SHA256::restoreState(const byte *in, uint64_t length) {
+  for (int i = 0; i < 8; ++i) h[i] = getBE32(in + i * 4);
+  bufLen = 0;
+  total = length;
+}
+
+}  // namespace encfs
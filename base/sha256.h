@@ -0,0 +1,71 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _sha256_incl_
+#define _sha256_incl_
+
+#include "base/types.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace encfs {
+
+/*
+    Plain SHA-256 (FIPS 180-4), for digests which have to match other tools
+    rather than be keyed to the volume.
+
+    The running state can be saved and restored whenever the data added so
+    far is a multiple of BlockSize bytes, so that a long hash can be resumed
+    part way through.
+*/
+class SHA256 {
+ public:
+  static const int BlockSize = 64;
+  static const int DigestSize = 32;
+  static const int StateSize = 32;
+
+  SHA256();
+
+  void update(const byte *data, size_t len);
+
+  // Writes DigestSize bytes.  The object must be reset before reuse.
+  void final(byte *digest);
+  void reset();
+
+  // number of bytes added so far.
+  uint64_t length() const;
+
+  // StateSize bytes.  Only valid at a multiple of BlockSize bytes.
+  bool saveState(byte *out) const;
+  void restoreState(const byte *in, uint64_t length);
+
+ private:
+  void transform(const byte *block);
+
+  uint32_t h[8];
+  byte buf[BlockSize];
+  int bufLen;
+  uint64_t total;
+};
+
+}  // namespace encfs
+
+#endif
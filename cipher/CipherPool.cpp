@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cipher/CipherPool.h"
+
+#include "base/Error.h"
+#include "base/WorkerPool.h"
+#include "cipher/CipherV1.h"
+
+namespace encfs {
+
+#ifdef CMAKE_USE_PTHREADS_INIT
+struct CipherPool::ThreadCipher {
+  CipherPool *pool;
+  shared_ptr<CipherV1> cipher;
+};
+
+void CipherPool::ReleaseThreadCipher(void *arg) {
+  ThreadCipher *tc = (ThreadCipher *)arg;
+  CipherPool *pool = tc->pool;
+  {
+    Lock _lock(pool->mutex);
+    pool->threadCiphers.erase(tc);
+  }
+  pool->release(tc->cipher);
+  delete tc;
+}
+#endif
+
+CipherPool::CipherPool(const shared_ptr<CipherV1> &prototype_)
+    : prototype(prototype_) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  int res = pthread_key_create(&threadKey, ReleaseThreadCipher);
+  rAssert(res == 0);
+#endif
+}
+
+// Threads which are still running never call the key's destructor once the
+// key is gone, so their instances are freed here.
+CipherPool::~CipherPool() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_key_delete(threadKey);
+
+  Lock _lock(mutex);
+  std::set<ThreadCipher *>::const_iterator it;
+  for (it = threadCiphers.begin(); it != threadCiphers.end(); ++it)
+    delete *it;
+  threadCiphers.clear();
+#endif
+}
+
+shared_ptr<CipherV1> CipherPool::acquire() {
+  {
+    Lock _lock(mutex);
+    if (!idle.empty()) {
+      shared_ptr<CipherV1> result = idle.back();
+      idle.pop_back();
+      return result;
+    }
+  }
+
+  shared_ptr<CipherV1> result = prototype->clone();
+  rAssert(result.get() != NULL);
+  return result;
+}
+
+void CipherPool::release(const shared_ptr<CipherV1> &cipher) {
+  Lock _lock(mutex);
+  idle.push_back(cipher);
+}
+
+CipherV1 *CipherPool::local() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  ThreadCipher *tc = (ThreadCipher *)pthread_getspecific(threadKey);
+  if (!tc) {
+    tc = new ThreadCipher;
+    tc->pool = this;
+    tc->cipher = acquire();
+    {
+      Lock _lock(mutex);
+      threadCiphers.insert(tc);
+    }
+    pthread_setspecific(threadKey, tc);
+  }
+  return tc->cipher.get();
+#else
+  if (!single) single = acquire();
+  return single.get();
+#endif
+}
+
+void CipherPool::batchMAC_64(MACRequest *requests, int count) {
+  if (count <= 0) return;
+
+  shared_ptr<WorkerPool> pool = WorkerPool::Default();
+  int ranges = pool->threadCount() + 1;
+  if (ranges > count) ranges = count;
+  int perRange = (count + ranges - 1) / ranges;
+
+  pool->parallelFor(ranges, [&](int range) {
+    CipherV1 *cipher = local();
+    int end = (range + 1) * perRange;
+    if (end > count) end = count;
+    for (int i = range * perRange; i < end; ++i)
+      requests[i].mac = cipher->MAC_64(requests[i].data, requests[i].dataLen);
+  });
+}
+
+}  // namespace encfs
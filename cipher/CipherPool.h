@@ -0,0 +1,93 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CipherPool_incl_
+#define _CipherPool_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+#include "base/types.h"
+
+#include <inttypes.h>
+#include <set>
+#include <vector>
+
+namespace encfs {
+
+class CipherV1;
+
+/*
+    Hands out cipher instances for exclusive use, so that several threads
+    can encode at the same time.  Instances are cloned from the prototype on
+    demand and kept for reuse once released.
+
+    Threads which encode over and over, such as the FUSE workers, can keep
+    an instance of their own with local(), instead of taking one from the
+    pool for each request.
+*/
+class CipherPool {
+ public:
+  explicit CipherPool(const shared_ptr<CipherV1> &prototype);
+  ~CipherPool();
+
+  // Returns an instance which only the caller uses until it is released.
+  shared_ptr<CipherV1> acquire();
+  void release(const shared_ptr<CipherV1> &cipher);
+
+  // Returns the calling thread's own instance, which is acquired on first
+  // use and released when the thread exits.  Without thread support there is
+  // only the one instance.
+  CipherV1 *local();
+
+  struct MACRequest {
+    const byte *data;
+    int dataLen;
+    uint64_t mac;  // set by batchMAC_64
+  };
+
+  // Computes MAC_64 of each request, as a batch.  None of the backends
+  // offer multi-buffer hashing, so the requests are spread over the worker
+  // pool, using one cipher instance per thread.  The results are the same
+  // as calling MAC_64 on each in turn.
+  void batchMAC_64(MACRequest *requests, int count);
+
+ private:
+  shared_ptr<CipherV1> prototype;
+
+  Mutex mutex;
+  std::vector<shared_ptr<CipherV1> > idle;
+
+#ifdef CMAKE_USE_PTHREADS_INIT
+  struct ThreadCipher;
+  static void ReleaseThreadCipher(void *arg);
+
+  pthread_key_t threadKey;
+  std::set<ThreadCipher *> threadCiphers;  // held by live threads
+#else
+  shared_ptr<CipherV1> single;
+#endif
+
+  CipherPool(const CipherPool &);
+  CipherPool &operator=(const CipherPool &);
+};
+
+}  // namespace encfs
+
+#endif
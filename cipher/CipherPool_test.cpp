@@ -0,0 +1,103 @@
+
+#include <pthread.h>
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "base/shared_ptr.h"
+#include "cipher/CipherPool.h"
+#include "cipher/CipherV1.h"
+#include "cipher/testing.h"
+
+using namespace encfs;
+
+namespace {
+
+class CipherPoolTest : public testing::Test {
+ protected:
+  virtual void SetUp() { CipherV1::init(false); }
+};
+
+TEST_F(CipherPoolTest, CloneMatches) {
+  for (auto alg : CipherV1::GetAlgorithmList()) {
+    auto cipher = CipherV1::New(alg.iface);
+    ASSERT_FALSE(!cipher);
+    cipher->setKey(cipher->newRandomKey());
+
+    CipherPool pool(cipher);
+    shared_ptr<CipherV1> a = pool.acquire();
+    shared_ptr<CipherV1> b = pool.acquire();
+    ASSERT_FALSE(!a);
+    ASSERT_TRUE(a != b);
+
+    std::vector<byte> orig(1024);
+    cipher->pseudoRandomize(&orig[0], orig.size());
+    std::vector<byte> x(orig), y(orig);
+
+    ASSERT_TRUE(cipher->blockEncode(&x[0], x.size(), 42));
+    ASSERT_TRUE(a->blockEncode(&y[0], y.size(), 42));
+    ASSERT_TRUE(x == y);
+
+    ASSERT_TRUE(b->streamEncode(&y[0], 100, 7));
+    ASSERT_TRUE(cipher->streamDecode(&y[0], 100, 7));
+    ASSERT_TRUE(x == y);
+
+    EXPECT_EQ(cipher->MAC_64(&orig[0], orig.size()),
+              b->MAC_64(&orig[0], orig.size()));
+
+    // released instances are reused.
+    pool.release(a);
+    EXPECT_TRUE(pool.acquire() == a);
+  }
+}
+
+TEST_F(CipherPoolTest, BatchMAC) {
+  auto cipher = CipherV1::New("AES", 256);
+  ASSERT_FALSE(!cipher);
+  cipher->setKey(cipher->newRandomKey());
+
+  CipherPool pool(cipher);
+
+  std::vector<byte> data(64 * 100);
+  cipher->pseudoRandomize(&data[0], data.size());
+
+  std::vector<CipherPool::MACRequest> requests(100);
+  for (int i = 0; i < 100; ++i) {
+    requests[i].data = &data[i * 64];
+    requests[i].dataLen = 1 + (i % 64);
+    requests[i].mac = 0;
+  }
+
+  pool.batchMAC_64(&requests[0], requests.size());
+
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(cipher->MAC_64(requests[i].data, requests[i].dataLen),
+              requests[i].mac) << "request " << i;
+}
+
+void *localCipher(void *arg) {
+  return ((CipherPool *)arg)->local();
+}
+
+TEST_F(CipherPoolTest, ThreadLocal) {
+  auto cipher = CipherV1::New("AES", 128);
+  ASSERT_FALSE(!cipher);
+  cipher->setKey(cipher->newRandomKey());
+
+  CipherPool pool(cipher);
+  CipherV1 *mine = pool.local();
+  ASSERT_TRUE(mine != NULL);
+  EXPECT_TRUE(mine != cipher.get());
+  EXPECT_EQ(mine, pool.local());
+
+  // another thread gets its own, which is released when it exits.
+  pthread_t thread;
+  void *theirs = NULL;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, localCipher, &pool));
+  ASSERT_EQ(0, pthread_join(thread, &theirs));
+  EXPECT_TRUE(theirs != mine);
+  EXPECT_EQ(theirs, pool.acquire().get());
+}
+
+}  // namespace
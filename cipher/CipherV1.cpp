@@ -299,6 +299,10 @@ CipherV1::~CipherV1() {}
 
 Interface CipherV1::interface() const { return realIface; }
 
+bool CipherV1::isNull() const {
+  return implements(NullCipherInterface, realIface);
+}
+
 /*
    Create a key from the password.
    Use SHA to distribute entropy from the password into the key.
@@ -375,6 +379,7 @@ bool CipherV1::setKey(const CipherKey &keyIv) {
 
   if (_blockCipher->setKey(key) && _streamCipher->setKey(key) &&
       _hmac->setKey(key)) {
+    _key = keyIv;
     _keySet = true;
     return true;
   }
@@ -382,6 +387,18 @@ bool CipherV1::setKey(const CipherKey &keyIv) {
   return false;
 }
 
+shared_ptr<CipherV1> CipherV1::clone() const {
+  shared_ptr<CipherV1> result(new CipherV1());
+  if (!result->initCiphers(iface, realIface, _keySize * 8)) {
+    result.reset();
+  } else if (_keySet && !result->setKey(_key)) {
+    LOG(ERROR) << "unable to set key on cloned cipher";
+    result.reset();
+  }
+
+  return result;
+}
+
 uint64_t CipherV1::MAC_64(const byte *data, int len,
                           uint64_t *chainedIV) const {
   rAssert(len > 0);
@@ -651,4 +668,16 @@ bool CipherV1::blockDecode(byte *buf, int size, uint64_t iv64) const {
   return _blockCipher->decrypt(ivec.data(), buf, buf, size);
 }
 
+void CipherV1::blockIVec(byte *ivec, uint64_t iv64) const {
+  setIVec(ivec, iv64);
+}
+
+bool CipherV1::blockDecodeFrom(const byte *ivec, byte *buf, int size) const {
+  rAssert(_keySet);
+  rAssert(size > 0);
+  rAssert(size % _ivLength == 0);
+
+  return _blockCipher->decrypt(ivec, buf, buf, size);
+}
+
 }  // namespace encfs
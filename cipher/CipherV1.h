@@ -88,6 +88,7 @@ class CipherV1 {
   unsigned int _ivLength;
 
   shared_ptr<SecureMem> _iv;
+  CipherKey _key;  // key + iv, as passed to setKey
   bool _keySet;
 
  public:
@@ -142,6 +143,7 @@ class CipherV1 {
   std::string encodeAsString(const CipherKey &key) const;
 
   // meta-data about the cypher
+  bool isNull() const;  // pass-through cipher
   int keySize() const;
   int encodedKeySize() const;
   int cipherBlockSize() const;
@@ -151,6 +153,11 @@ class CipherV1 {
   // Sets the key used for encoding / decoding, and MAC operations.
   bool setKey(const CipherKey &key);
 
+  // Returns a new instance using the same algorithm and key.  Encoding
+  // operations on a single instance are not thread safe, so each thread
+  // doing bulk encoding in parallel needs its own instance.
+  shared_ptr<CipherV1> clone() const;
+
   uint64_t MAC_64(const byte *src, int len, uint64_t *augment = NULL) const;
 
   static unsigned int reduceMac32(uint64_t mac64);
@@ -171,6 +178,16 @@ class CipherV1 {
   bool blockEncode(byte *buf, int size, uint64_t iv64) const;
   bool blockDecode(byte *buf, int size, uint64_t iv64) const;
 
+  /*
+     Block encoding is chained (CBC), so any cipher block can be decoded
+     given only the encoded cipher block before it.  blockDecodeFrom decodes
+     size bytes from within an encoded block in-place, where ivec is the
+     preceding encoded cipher block, or blockIVec(iv64) at the start of the
+     block.  size must be a multiple of cipherBlockSize().
+   */
+  void blockIVec(byte *ivec, uint64_t iv64) const;
+  bool blockDecodeFrom(const byte *ivec, byte *buf, int size) const;
+
  private:
   void setIVec(byte *out, uint64_t seed) const;
 };
@@ -39,8 +39,10 @@
 #define VALGRIND_MAKE_MEM_UNDEFINED(a, b)
 #endif
 
+#include <cerrno>
 #include <map>
 #include <list>
+#include <vector>
 
 #ifdef WITH_OPENSSL
 #include <openssl/crypto.h>
@@ -60,8 +62,12 @@ static byte *allocBlock(int size) {
   return block;
 }
 
-static void freeBlock(byte *block, int size) {
+static void cleanseBlock(byte *block, int size) {
   OPENSSL_cleanse(block, size);
+}
+
+static void freeBlock(byte *block, int size) {
+  cleanseBlock(block, size);
   OPENSSL_free(block);
 }
 
@@ -73,7 +79,7 @@ static byte *allocBlock(int size) {
 }
 
 unsigned char cleanse_ctr = 0;
-static void freeBlock(byte *data, int len) {
+static void cleanseBlock(byte *data, int len) {
   byte *p = data;
   size_t loop = len, ctr = cleanse_ctr;
   while (loop--) {
@@ -84,18 +90,155 @@ static void freeBlock(byte *data, int len) {
   p = (byte *)memchr(data, (unsigned char)ctr, len);
   if (p) ctr += (63 + (size_t)p);
   cleanse_ctr = (unsigned char)ctr;
+}
+
+static void freeBlock(byte *data, int len) {
+  cleanseBlock(data, len);
   delete[] data;
 }
 
 #endif
 
+/*
+    MemBlock storage comes from 2MB slabs, so that a large number of block
+    buffers doesn't need a TLB entry per 4KB page.  Slabs are taken from the
+    huge page pool if one is configured (MAP_HUGETLB), otherwise they are
+    marked as candidates for transparent huge pages.
+
+    Slabs are shared by all slot sizes: a size whose free list is empty
+    takes the next RunSize bytes of the current slab and carves them into
+    slots, so a few small allocations only commit a single slab.  Free slots
+    are kept on a per-size free list.  Slots are wiped before they go back on
+    the list, and slabs are never returned to the system.  Requests larger
+    then MaxSlotShift are allocated directly.
+*/
+static const size_t SlabSize = 2 * 1024 * 1024;
+static const size_t RunSize = 64 * 1024;
+static const int MinSlotShift = 6;
+static const int MaxSlotShift = 16;
+
+struct SlotList {
+  pthread_mutex_t mutex;
+  std::vector<byte *> free;
+};
+
+static SlotList slotLists[MaxSlotShift + 1];
+static pthread_once_t slotListsOnce = PTHREAD_ONCE_INIT;
+
+// unused part of the current slab.
+static pthread_mutex_t slabMutex = PTHREAD_MUTEX_INITIALIZER;
+static byte *slabNext = NULL;
+static size_t slabLeft = 0;
+
+static void initSlotLists() {
+  for (int i = MinSlotShift; i <= MaxSlotShift; ++i)
+    pthread_mutex_init(&slotLists[i].mutex, 0);
+}
+
+static int slotShift(int size) {
+  int shift = MinSlotShift;
+  while ((1 << shift) < size) ++shift;
+  return shift;
+}
+
+static byte *allocSlab() {
+  void *slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  slab = mmap(0, SlabSize, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+#endif
+  if (slab == MAP_FAILED) {
+    slab = mmap(0, SlabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
+                -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (slab != MAP_FAILED) madvise(slab, SlabSize, MADV_HUGEPAGE);
+#endif
+  }
+
+  if (slab == MAP_FAILED) {
+    LOG(ERROR) << "unable to allocate memory slab: " << strerror(errno);
+    return NULL;
+  }
+
+  VLOG(1) << "allocated memory slab at " << slab;
+  return (byte *)slab;
+}
+
+// Takes the next RunSize bytes from the current slab, starting a new slab
+// when it is used up.
+static byte *allocRun() {
+  pthread_mutex_lock(&slabMutex);
+  if (slabLeft < RunSize) {
+    byte *slab = allocSlab();
+    if (slab) {
+      VALGRIND_MAKE_MEM_NOACCESS(slab, SlabSize);
+      slabNext = slab;
+      slabLeft = SlabSize;
+    }
+  }
+
+  byte *run = NULL;
+  if (slabLeft >= RunSize) {
+    run = slabNext;
+    slabNext += RunSize;
+    slabLeft -= RunSize;
+  }
+  pthread_mutex_unlock(&slabMutex);
+  return run;
+}
+
+static byte *allocSlot(int shift) {
+  pthread_once(&slotListsOnce, initSlotLists);
+  SlotList &list = slotLists[shift];
+
+  pthread_mutex_lock(&list.mutex);
+  if (list.free.empty()) {
+    byte *run = allocRun();
+    size_t slotSize = (size_t)1 << shift;
+    // hand out slots from the start of the run first.
+    for (size_t offset = RunSize; run && offset >= slotSize;) {
+      offset -= slotSize;
+      list.free.push_back(run + offset);
+    }
+  }
+
+  byte *slot = NULL;
+  if (!list.free.empty()) {
+    slot = list.free.back();
+    list.free.pop_back();
+  }
+  pthread_mutex_unlock(&list.mutex);
+
+  if (slot) VALGRIND_MAKE_MEM_UNDEFINED(slot, (size_t)1 << shift);
+  return slot;
+}
+
+static void freeSlot(byte *slot, int shift) {
+  cleanseBlock(slot, 1 << shift);
+  VALGRIND_MAKE_MEM_NOACCESS(slot, (size_t)1 << shift);
+
+  SlotList &list = slotLists[shift];
+  pthread_mutex_lock(&list.mutex);
+  list.free.push_back(slot);
+  pthread_mutex_unlock(&list.mutex);
+}
+
 void MemBlock::allocate(int size) {
   rAssert(size > 0);
-  this->data = allocBlock(size);
+  this->data = (size <= (1 << MaxSlotShift)) ? allocSlot(slotShift(size))
+                                             : allocBlock(size);
+  rAssert(this->data != NULL);
   this->size = size;
 }
 
-MemBlock::~MemBlock() { freeBlock(data, size); }
+MemBlock::~MemBlock() {
+  if (!data) return;
+
+  if (size <= (1 << MaxSlotShift))
+    freeSlot(data, slotShift(size));
+  else
+    freeBlock(data, size);
+}
 
 #ifdef WITH_BOTAN
 SecureMem::SecureMem(int len)
@@ -0,0 +1,54 @@
+
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "base/shared_ptr.h"
+#include "cipher/MemoryPool.h"
+
+using namespace encfs;
+
+namespace {
+
+TEST(MemoryPoolTest, DistinctBlocks) {
+  const int sizes[] = {1, 16, 64, 100, 512, 4096, 65536, 100000};
+  for (int size : sizes) {
+    std::vector<shared_ptr<MemBlock> > blocks;
+    std::set<byte *> seen;
+    for (int i = 0; i < 64; ++i) {
+      shared_ptr<MemBlock> mb(new MemBlock);
+      mb->allocate(size);
+      ASSERT_TRUE(mb->data != NULL);
+      ASSERT_EQ(size, mb->size);
+      memset(mb->data, i, size);
+      EXPECT_TRUE(seen.insert(mb->data).second);
+      blocks.push_back(mb);
+    }
+
+    // no block overwrote another.
+    for (int i = 0; i < 64; ++i)
+      for (int j = 0; j < size; ++j)
+        ASSERT_EQ(i, blocks[i]->data[j]) << size;
+  }
+}
+
+TEST(MemoryPoolTest, WipedOnFree) {
+  const char secret[] = "this is a secret block of data!";
+  byte *ptr;
+  {
+    MemBlock mb;
+    mb.allocate(sizeof(secret));
+    memcpy(mb.data, secret, sizeof(secret));
+    ptr = mb.data;
+  }
+
+  // the slot is reused, but the old contents are gone.
+  MemBlock mb;
+  mb.allocate(sizeof(secret));
+  ASSERT_EQ(ptr, mb.data);
+  EXPECT_NE(0, memcmp(mb.data, secret, sizeof(secret)));
+}
+
+}  // namespace
@@ -326,7 +326,8 @@ REGISTER_CLASS(AesCfbStreamCipher, StreamCipher);
 #endif
 
 #if defined(HAVE_EVP_AES_XTS)
-static Range AesXtsKeyRange(128, 256, 128);
+// XTS keys are two AES keys, so they are twice the AES key size.
+static Range AesXtsKeyRange(256, 512, 256);
 class AesXtsBlockCipher : public OpenSSLCipher {
  public:
   AesXtsBlockCipher() {}
@@ -339,9 +340,9 @@ class AesXtsBlockCipher : public OpenSSLCipher {
 
   static const EVP_CIPHER *getCipher(int keyLength) {
     switch (keyLength * 8) {
-      case 128:
-        return EVP_aes_128_xts();
       case 256:
+        return EVP_aes_128_xts();
+      case 512:
         return EVP_aes_256_xts();
       default:
         return NULL;
@@ -91,6 +91,16 @@ struct EncFS_Args {
     if (opts->useStdin) ss << "(useStdin) ";
     if (opts->annotate) ss << "(annotate) ";
     if (opts->reverseEncryption) ss << "(reverseEncryption) ";
+    if (opts->sharedVolume) ss << "(sharedVolume) ";
+    if (opts->nfsBacking) ss << "(nfsBacking) ";
+    if (opts->mmapBacking) ss << "(mmapBacking) ";
+    if (opts->dedupBacking) ss << "(dedupBacking) ";
+    if (!opts->blockIndexDir.empty())
+      ss << "(blockIndex " << opts->blockIndexDir << ") ";
+    if (!opts->digestCacheDir.empty())
+      ss << "(digestCache " << opts->digestCacheDir << ") ";
+    if (opts->groupCommitWindow >= 0)
+      ss << "(groupCommit " << opts->groupCommitWindow << ") ";
     if (opts->mountOnDemand) ss << "(mountOnDemand) ";
     if (opts->delayMount) ss << "(delayMount) ";
     for (int i = 0; i < fuseArgc; ++i) ss << fuseArgv[i] << ' ';
@@ -147,6 +157,23 @@ static void usage(const char *name) {
             "act as a typical multi-user filesystem\n"
             "\t\t\t(encfs must be run as root)\n") << _("  --reverse\t\t"
                                                         "reverse encryption\n")
+       << _("  --shared\t\t"
+            "coordinate caching with other hosts mounting\n"
+            "\t\t\tthe same raw directory (eg. over NFS)\n")
+       << _("  --nfs\t\t\t"
+            "tune for a raw directory on a network filesystem\n")
+       << _("  --mmap\t\t\t"
+            "read raw files through memory mappings\n")
+       << _("  --dedup\t\t"
+            "share identical raw blocks on the host filesystem\n"
+            "\t\t\t(volumes without per-file IVs only)\n")
+       << _("  --block-index=dir\t"
+            "keep per-block change indexes in dir\n"
+            "\t\t\t(reverse mode only)\n")
+       << _("  --digest-cache=dir\t"
+            "keep plaintext digests in dir\n")
+       << _("  --group-commit[=usec]\t"
+            "batch fsync calls which arrive within usec\n")
 
       // xgroup(usage)
        << _("  --extpass=program\tUse external program for password prompt\n"
@@ -195,6 +222,11 @@ static bool processArgs(int argc, char *argv[],
   out->opts->useStdin = false;
   out->opts->annotate = false;
   out->opts->reverseEncryption = false;
+  out->opts->sharedVolume = false;
+  out->opts->nfsBacking = false;
+  out->opts->mmapBacking = false;
+  out->opts->dedupBacking = false;
+  out->opts->groupCommitWindow = -1;
 
   bool useDefaultFlags = true;
 
@@ -223,6 +255,13 @@ static bool processArgs(int argc, char *argv[],
       // {"single-thread", 0, 0, 's'}, // single-threaded mode
       {"stdinpass", 0, 0, 'S'},  // read password from stdin
       {"annotate", 0, 0, 513},   // Print annotation lines to stderr
+      {"shared", 0, 0, 514},     // volume is mounted by multiple hosts
+      {"block-index", 1, 0, 515},  // reverse mode block change index
+      {"nfs", 0, 0, 516},          // raw directory is on NFS
+      {"group-commit", 2, 0, 517},  // batch fsync calls
+      {"mmap", 0, 0, 518},          // read through memory mappings
+      {"dedup", 0, 0, 519},         // share identical raw blocks
+      {"digest-cache", 1, 0, 520},  // plaintext digest cache
       {"verbose", 0, 0, 'v'},    // verbose mode
       {"version", 0, 0, 'V'},  // version
       {"reverse", 0, 0, 'r'},   // reverse encryption
@@ -262,6 +301,34 @@ static bool processArgs(int argc, char *argv[],
       case 513:
         out->opts->annotate = true;
         break;
+      case 514:
+        out->opts->sharedVolume = true;
+        break;
+      case 515:
+        out->opts->blockIndexDir.assign(optarg);
+        break;
+      case 516:
+        out->opts->nfsBacking = true;
+        break;
+      case 517:
+        out->opts->groupCommitWindow =
+            optarg ? strtol(optarg, (char **)NULL, 10) : 1000;
+        if (out->opts->groupCommitWindow < 0) {
+          cerr <<
+              // xgroup(usage)
+              _("The group commit window must not be negative") << endl;
+          return false;
+        }
+        break;
+      case 518:
+        out->opts->mmapBacking = true;
+        break;
+      case 519:
+        out->opts->dedupBacking = true;
+        break;
+      case 520:
+        out->opts->digestCacheDir.assign(optarg);
+        break;
       case 'f':
         out->isDaemon = false;
         // this option was added in fuse 2.x
@@ -396,6 +463,36 @@ static bool processArgs(int argc, char *argv[],
     return false;
   }
 
+  if (!out->opts->blockIndexDir.empty()) {
+    if (!out->opts->reverseEncryption) {
+      cerr <<
+          // xgroup(usage)
+          _("The block index is only available in reverse mode") << endl;
+      return false;
+    }
+    if (!isDirectory(out->opts->blockIndexDir.c_str())) {
+      cerr <<
+          // xgroup(usage)
+          _("The block index directory must exist") << endl;
+      return false;
+    }
+  }
+
+  if (!out->opts->digestCacheDir.empty()) {
+    if (out->opts->reverseEncryption) {
+      cerr <<
+          // xgroup(usage)
+          _("The digest cache is not available in reverse mode") << endl;
+      return false;
+    }
+    if (!isDirectory(out->opts->digestCacheDir.c_str())) {
+      cerr <<
+          // xgroup(usage)
+          _("The digest cache directory must exist") << endl;
+      return false;
+    }
+  }
+
   if (out->opts->mountOnDemand && out->opts->passwordProgram.empty()) {
     cerr <<
         // xgroup(usage)
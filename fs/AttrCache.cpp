@@ -0,0 +1,148 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/AttrCache.h"
+
+#include "base/WorkerPool.h"
+
+#include <glog/logging.h>
+
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+namespace encfs {
+
+static uint64_t nowMsec() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+AttrCache::AttrCache(int ttlMsec_, int maxEntries_, int maxPending_)
+    : ttlMsec(ttlMsec_),
+      maxEntries(maxEntries_),
+      maxPending(maxPending_),
+      generation(0),
+      batches(0) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_init(&idle, 0);
+#endif
+}
+
+AttrCache::~AttrCache() {
+  // queued batches refer to us.
+  Lock _lock(mutex);
+#ifdef CMAKE_USE_PTHREADS_INIT
+  while (batches > 0) pthread_cond_wait(&idle, &mutex._mutex);
+  pthread_cond_destroy(&idle);
+#endif
+}
+
+bool AttrCache::take(const string &path, struct stat *stbuf) {
+  Lock _lock(mutex);
+
+  EntryMap::iterator it = entries.find(path);
+  if (it == entries.end()) return false;
+
+  bool fresh = it->second.expires > nowMsec();
+  if (fresh) *stbuf = it->second.stbuf;
+  entries.erase(it);
+  return fresh;
+}
+
+void AttrCache::invalidate(const string &path) {
+  Lock _lock(mutex);
+  ++generation;
+  entries.erase(path);
+}
+
+void AttrCache::clear() {
+  Lock _lock(mutex);
+  ++generation;
+  entries.clear();
+}
+
+int AttrCache::pending() const {
+  Lock _lock(mutex);
+  return batches;
+}
+
+void AttrCache::statAhead(int dirFd, const string &dirPath,
+                          const vector<string> &names) {
+  {
+    Lock _lock(mutex);
+    if (names.empty() || batches >= maxPending ||
+        entries.size() >= maxEntries) {
+      VLOG(1) << "skipping stat-ahead of " << names.size() << " entries";
+      ::close(dirFd);
+      return;
+    }
+    ++batches;
+  }
+
+  WorkerPool::Default()->submit(
+      std::bind(&AttrCache::runBatch, this, dirFd, dirPath, names));
+}
+
+void AttrCache::runBatch(int dirFd, const string &dirPath,
+                         const vector<string> &names) {
+  string prefix = dirPath;
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/')
+    prefix.append(1, '/');
+
+  int cached = 0;
+  for (size_t i = 0; i < names.size(); ++i) {
+    uint64_t gen;
+    {
+      Lock _lock(mutex);
+      if (entries.size() >= maxEntries) break;
+      gen = generation;
+    }
+
+    Entry entry;
+    if (fstatat(dirFd, names[i].c_str(), &entry.stbuf, AT_SYMLINK_NOFOLLOW) !=
+        0)
+      continue;
+    entry.expires = nowMsec() + ttlMsec;
+
+    // drop the result if anything was invalidated while we were looking.
+    Lock _lock(mutex);
+    if (gen == generation) {
+      entries[prefix + names[i]] = entry;
+      ++cached;
+    }
+  }
+
+  ::close(dirFd);
+  VLOG(1) << "stat-ahead cached " << cached << " of " << names.size()
+          << " entries in " << dirPath;
+
+  Lock _lock(mutex);
+  --batches;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_broadcast(&idle);
+#endif
+}
+
+}  // namespace encfs
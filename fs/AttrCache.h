@@ -0,0 +1,105 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AttrCache_incl_
+#define _AttrCache_incl_
+
+#include "base/Mutex.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+using std::tr1::unordered_map;
+#else
+#include <unordered_map>
+using std::unordered_map;
+#endif
+
+namespace encfs {
+
+/*
+    Short lived cache of backing file attributes, filled by stat-ahead.
+
+    A directory listing is usually followed by a stat of every entry (ls -l,
+    find, rsync).  After a listing, statAhead() stats the entries in the
+    background, on the worker pool, using fstatat relative to the directory.
+    The getattr which follows then finds the result here instead of going to
+    the backing filesystem.  At most maxPending batches are outstanding, so
+    that stat-ahead can't crowd out other work on the pool.
+
+    Entries are keyed by backing (cipher) path, are used at most once, and
+    expire after a short time.  Anything which changes a file must call
+    invalidate() (or clear()) once the change is made.  A generation count
+    makes sure that a stat which raced with an invalidation is thrown away.
+*/
+class AttrCache {
+ public:
+  AttrCache(int ttlMsec, int maxEntries, int maxPending);
+  ~AttrCache();
+
+  // Takes the cached attributes for path, if there are fresh ones.
+  bool take(const std::string &path, struct stat *stbuf);
+
+  void invalidate(const std::string &path);
+  void clear();
+
+  // Stats names in the background.  Takes ownership of dirFd, which must be
+  // an open descriptor for the directory dirPath.  Does nothing (other then
+  // closing dirFd) if too much work is already queued.
+  void statAhead(int dirFd, const std::string &dirPath,
+                 const std::vector<std::string> &names);
+
+  // Number of stat-ahead batches which are queued or running.
+  int pending() const;
+
+ private:
+  struct Entry {
+    struct stat stbuf;
+    uint64_t expires;
+  };
+
+  typedef unordered_map<std::string, Entry> EntryMap;
+
+  void runBatch(int dirFd, const std::string &dirPath,
+                const std::vector<std::string> &names);
+
+  int ttlMsec;
+  size_t maxEntries;
+  int maxPending;
+
+  mutable Mutex mutex;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_t idle;
+#endif
+  EntryMap entries;
+  uint64_t generation;
+  int batches;
+
+  AttrCache(const AttrCache &);
+  AttrCache &operator=(const AttrCache &);
+};
+
+}  // namespace encfs
+
+#endif
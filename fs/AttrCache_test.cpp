@@ -0,0 +1,111 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "fs/AttrCache.h"
+
+using namespace encfs;
+using std::string;
+using std::vector;
+
+namespace {
+
+class AttrCacheTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-attr-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+
+    names.push_back("a");
+    names.push_back("b");
+    for (size_t i = 0; i < names.size(); ++i) {
+      int fd = ::open(path(names[i]).c_str(), O_CREAT | O_WRONLY, 0600);
+      ASSERT_LE(0, fd);
+      ASSERT_EQ(1 + (int)i, ::write(fd, "xyz", 1 + i));
+      ::close(fd);
+    }
+    names.push_back("missing");
+  }
+
+  virtual void TearDown() {
+    unlink(path("a").c_str());
+    unlink(path("b").c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  string path(const string &name) const { return rootDir + "/" + name; }
+
+  void statAhead(AttrCache *cache) {
+    int fd = ::open(rootDir.c_str(), O_RDONLY | O_DIRECTORY);
+    ASSERT_LE(0, fd);
+    cache->statAhead(fd, rootDir, names);
+    while (cache->pending() > 0) usleep(1000);
+  }
+
+  string rootDir;
+  vector<string> names;
+};
+
+TEST_F(AttrCacheTest, TakeOnce) {
+  AttrCache cache(60 * 1000, 100, 1);
+  statAhead(&cache);
+
+  struct stat st;
+  ASSERT_TRUE(cache.take(path("b"), &st));
+  EXPECT_EQ(2, st.st_size);
+  EXPECT_FALSE(cache.take(path("b"), &st));
+  EXPECT_FALSE(cache.take(path("missing"), &st));
+
+  cache.invalidate(path("a"));
+  EXPECT_FALSE(cache.take(path("a"), &st));
+}
+
+TEST_F(AttrCacheTest, Expires) {
+  AttrCache cache(1, 100, 1);
+  statAhead(&cache);
+  usleep(5000);
+
+  struct stat st;
+  EXPECT_FALSE(cache.take(path("a"), &st));
+}
+
+TEST_F(AttrCacheTest, Limits) {
+  struct stat st;
+
+  AttrCache small(60 * 1000, 1, 1);
+  statAhead(&small);
+  EXPECT_TRUE(small.take(path("a"), &st));
+  EXPECT_FALSE(small.take(path("b"), &st));
+
+  AttrCache none(60 * 1000, 100, 0);
+  statAhead(&none);
+  EXPECT_FALSE(none.take(path("a"), &st));
+}
+
+}  // namespace
@@ -36,19 +36,25 @@ inline Type min(Type A, Type B) {
 }
 
 static void clearCache(IORequest &req, int blockSize) {
-  memset(req.data, 0, blockSize);
+  if (req.data) memset(req.data, 0, blockSize);
   req.dataLen = 0;
 }
 
 BlockFileIO::BlockFileIO(int blockSize, const FSConfigPtr &cfg)
     : _blockSize(blockSize), _allowHoles(cfg->config->allow_holes()) {
   rAssert(_blockSize > 1);
-  _cache.data = new unsigned char[_blockSize];
 }
 
-BlockFileIO::~BlockFileIO() {
-  clearCache(_cache, _blockSize);
-  delete[] _cache.data;
+BlockFileIO::~BlockFileIO() {}
+
+void BlockFileIO::invalidateCache() { clearCache(_cache, _blockSize); }
+
+// Many nodes are only used for attributes, so the cache buffer isn't
+// allocated until the first data access.
+void BlockFileIO::allocCache() const {
+  if (_cache.data) return;
+  _cacheBlock.allocate(_blockSize);
+  _cache.data = _cacheBlock.data;
 }
 
 ssize_t BlockFileIO::cacheReadOneBlock(const IORequest &req) const {
@@ -64,6 +70,7 @@ ssize_t BlockFileIO::cacheReadOneBlock(const IORequest &req) const {
     if (_cache.dataLen > 0) clearCache(_cache, _blockSize);
 
     // cache results of read -- issue reads for full blocks
+    allocCache();
     IORequest tmp;
     tmp.offset = req.offset;
     tmp.data = _cache.data;
@@ -84,6 +91,7 @@ ssize_t BlockFileIO::cacheReadOneBlock(const IORequest &req) const {
 bool BlockFileIO::cacheWriteOneBlock(const IORequest &req) {
   // cache results of write (before pass-thru, because it may be modified
   // in-place)
+  allocCache();
   memcpy(_cache.data, req.data, req.dataLen);
   _cache.offset = req.offset;
   _cache.dataLen = req.dataLen;
@@ -92,12 +100,57 @@ bool BlockFileIO::cacheWriteOneBlock(const IORequest &req) {
   return ok;
 }
 
+ssize_t BlockFileIO::readBlocks(const IORequest &req) const {
+  IORequest blockReq;
+  blockReq.dataLen = _blockSize;
+
+  ssize_t result = 0;
+  for (int done = 0; done < req.dataLen; done += _blockSize) {
+    blockReq.offset = req.offset + done;
+    blockReq.data = req.data + done;
+
+    ssize_t readSize = cacheReadOneBlock(blockReq);
+    if (readSize <= 0) break;
+
+    result += readSize;
+    if (readSize < _blockSize) break;
+  }
+
+  return result;
+}
+
+bool BlockFileIO::writeBlocks(const IORequest &req) {
+  IORequest blockReq;
+  blockReq.dataLen = _blockSize;
+
+  for (int done = 0; done < req.dataLen; done += _blockSize) {
+    blockReq.offset = req.offset + done;
+    blockReq.data = req.data + done;
+    if (!cacheWriteOneBlock(blockReq)) return false;
+  }
+
+  return true;
+}
+
+bool BlockFileIO::readPartial(const IORequest &req, ssize_t *result) const {
+  (void)req;
+  (void)result;
+  return false;
+}
+
 ssize_t BlockFileIO::read(const IORequest &req) const {
   rAssert(_blockSize != 0);
 
   int partialOffset = req.offset % _blockSize;
   off_t blockNum = req.offset / _blockSize;
 
+  if (req.dataLen > 0 && req.dataLen < _blockSize &&
+      partialOffset + req.dataLen <= _blockSize &&
+      !(_cache.dataLen != 0 && _cache.offset == blockNum * _blockSize)) {
+    ssize_t result;
+    if (readPartial(req, &result)) return result;
+  }
+
   if (partialOffset == 0 && req.dataLen <= _blockSize) {
     // read completely within a single block -- can be handled as-is by
     // readOneBloc().
@@ -117,6 +170,25 @@ ssize_t BlockFileIO::read(const IORequest &req) const {
     while (size) {
       blockReq.offset = blockNum * _blockSize;
 
+      // hand runs of full blocks down as a batch.
+      if (partialOffset == 0 && size >= 2 * (size_t)_blockSize) {
+        IORequest runReq;
+        runReq.offset = blockReq.offset;
+        runReq.data = out;
+        runReq.dataLen = (size / _blockSize) * _blockSize;
+
+        ssize_t readSize = readBlocks(runReq);
+        if (readSize <= 0) break;
+
+        result += readSize;
+        size -= readSize;
+        out += readSize;
+        blockNum += readSize / _blockSize;
+
+        if (readSize < runReq.dataLen) break;
+        continue;
+      }
+
       // if we're reading a full block, then read directly into the
       // result buffer instead of using a temporary
       if (partialOffset == 0 && size >= (size_t)_blockSize)
@@ -195,6 +267,30 @@ bool BlockFileIO::write(const IORequest &req) {
   unsigned char *inPtr = req.data;
   while (size) {
     blockReq.offset = blockNum * _blockSize;
+
+    if (partialOffset == 0 && size >= 2 * (size_t)_blockSize) {
+      IORequest runReq;
+      runReq.offset = blockReq.offset;
+      runReq.data = inPtr;
+      runReq.dataLen = (size / _blockSize) * _blockSize;
+
+      // writeBlocks overrides may bypass the cache, so drop it if the run
+      // overwrites it.
+      if (_cache.dataLen > 0 && _cache.offset >= runReq.offset &&
+          _cache.offset < runReq.offset + runReq.dataLen)
+        clearCache(_cache, _blockSize);
+
+      if (!writeBlocks(runReq)) {
+        ok = false;
+        break;
+      }
+
+      size -= runReq.dataLen;
+      inPtr += runReq.dataLen;
+      blockNum += runReq.dataLen / _blockSize;
+      continue;
+    }
+
     int toCopy = min((size_t)(_blockSize - partialOffset), size);
 
     // if writing an entire block, or writing a partial block that requires
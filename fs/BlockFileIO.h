@@ -21,6 +21,7 @@
 #ifndef _BlockFileIO_incl_
 #define _BlockFileIO_incl_
 
+#include "cipher/MemoryPool.h"
 #include "fs/FileIO.h"
 #include "fs/FSConfig.h"
 
@@ -45,6 +46,8 @@ class BlockFileIO : public FileIO {
 
   virtual int blockSize() const;
 
+  virtual void invalidateCache();
+
  protected:
   int blockTruncate(off_t size, FileIO *base);
   void padFile(off_t oldSize, off_t newSize, bool forceWrite);
@@ -54,14 +57,29 @@ class BlockFileIO : public FileIO {
   virtual ssize_t readOneBlock(const IORequest &req) const = 0;
   virtual bool writeOneBlock(const IORequest &req) = 0;
 
+  // Multiple full blocks, starting on a block boundary.  The default
+  // implementation goes one block at a time, through the block cache.
+  // Layers which can do better with a batch of blocks override these, and
+  // overrides (such as MACFileIO's) may bypass the cache.
+  virtual ssize_t readBlocks(const IORequest &req) const;
+  virtual bool writeBlocks(const IORequest &req);
+
+  // Called for a read which covers only part of one block, when the block
+  // isn't cached.  Layers which can produce part of a block more cheaply
+  // then the whole block return true and set result.  The default returns
+  // false, in which case the whole block is read.
+  virtual bool readPartial(const IORequest &req, ssize_t *result) const;
+
   ssize_t cacheReadOneBlock(const IORequest &req) const;
   bool cacheWriteOneBlock(const IORequest &req);
+  void allocCache() const;
 
   int _blockSize;
   bool _allowHoles;
 
   // cache last block for speed...
   mutable IORequest _cache;
+  mutable MemBlock _cacheBlock;
 };
 
 }  // namespace encfs
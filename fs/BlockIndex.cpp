@@ -0,0 +1,312 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/BlockIndex.h"
+
+#include "cipher/CipherV1.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using std::string;
+using std::vector;
+
+namespace encfs {
+
+const char *BlockIndex::AttrName = "user.encfs.blockindex";
+
+static const char IndexMagic[4] = {'E', 'B', 'I', '2'};
+static const int HeaderSize = 64;
+
+// number of blocks to read from the backing file at a time while building.
+static const int ReadBlocks = 64;
+
+// Attempts at reading a file which changes while its index is built.
+static const int MaxBuilds = 3;
+
+static void putBE(unsigned char *out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i, value >>= 8) out[i] = value & 0xff;
+}
+
+static uint64_t getBE(const unsigned char *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) value = (value << 8) | in[i];
+  return value;
+}
+
+bool BlockIndex::Stamp::operator==(const Stamp &other) const {
+  return device == other.device && inode == other.inode &&
+         size == other.size && mtime == other.mtime &&
+         mtimeNsec == other.mtimeNsec && ctime == other.ctime &&
+         ctimeNsec == other.ctimeNsec;
+}
+
+BlockIndex::Stamp BlockIndex::MakeStamp(const struct stat &st) {
+  Stamp stamp;
+  stamp.device = st.st_dev;
+  stamp.inode = st.st_ino;
+  stamp.size = st.st_size;
+  stamp.mtime = st.st_mtime;
+  stamp.ctime = st.st_ctime;
+#ifdef linux
+  stamp.mtimeNsec = st.st_mtim.tv_nsec;
+  stamp.ctimeNsec = st.st_ctim.tv_nsec;
+#else
+  stamp.mtimeNsec = 0;
+  stamp.ctimeNsec = 0;
+#endif
+  return stamp;
+}
+
+BlockIndex::BlockIndex(const string &indexDir,
+                       const shared_ptr<CipherV1> &cipher_, int blockSize_)
+    : dir(indexDir),
+      cipher(cipher_),
+      blockSize(blockSize_),
+      cachedValid(false) {
+  // Tag the index with the key, so that a stale index isn't used after the
+  // volume is mounted with a different key.
+  const char tagData[] = "encfs block index";
+  keyTag = cipher->MAC_64((const byte *)tagData, sizeof(tagData) - 1);
+}
+
+BlockIndex::~BlockIndex() {}
+
+bool BlockIndex::ParseAttrName(const char *name, int *chunk) {
+  int len = strlen(AttrName);
+  if (strncmp(name, AttrName, len) != 0) return false;
+
+  if (name[len] == '\0') {
+    *chunk = 0;
+    return true;
+  }
+
+  if (name[len] != '.' || name[len + 1] == '\0') return false;
+
+  char *end = NULL;
+  long value = strtol(name + len + 1, &end, 10);
+  if (*end != '\0' || value < 0) return false;
+
+  *chunk = (int)value;
+  return true;
+}
+
+string BlockIndex::indexPath(const struct stat &st) const {
+  char name[64];
+  snprintf(name, sizeof(name), "%llx-%llx", (unsigned long long)st.st_dev,
+           (unsigned long long)st.st_ino);
+
+  string path = dir;
+  if (path.empty() || path[path.length() - 1] != '/') path.append(1, '/');
+  return path + name;
+}
+
+// Stamp layout in the index header.
+static void putStamp(unsigned char *out, uint64_t inode, uint64_t size,
+                     uint64_t mtime, uint64_t mtimeNsec, uint64_t ctime,
+                     uint64_t ctimeNsec) {
+  putBE(out, inode, 8);
+  putBE(out + 8, size, 8);
+  putBE(out + 16, mtime, 8);
+  putBE(out + 24, mtimeNsec, 4);
+  putBE(out + 28, ctime, 8);
+  putBE(out + 36, ctimeNsec, 4);
+}
+
+bool BlockIndex::load(const string &file, const Stamp &stamp,
+                      vector<uint64_t> *hashes) const {
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  unsigned char expected[40];
+  putStamp(expected, stamp.inode, stamp.size, stamp.mtime, stamp.mtimeNsec,
+           stamp.ctime, stamp.ctimeNsec);
+
+  unsigned char header[HeaderSize];
+  bool ok = (::read(fd, header, HeaderSize) == HeaderSize) &&
+            memcmp(header, IndexMagic, sizeof(IndexMagic)) == 0 &&
+            (int)getBE(header + 4, 4) == blockSize &&
+            getBE(header + 8, 8) == keyTag &&
+            memcmp(header + 16, expected, sizeof(expected)) == 0;
+
+  if (ok) {
+    uint64_t count = getBE(header + 56, 8);
+    vector<unsigned char> buf(count * sizeof(uint64_t));
+    ok = count == 0 ||
+         ::read(fd, &buf[0], buf.size()) == (ssize_t)buf.size();
+
+    hashes->resize(count);
+    for (uint64_t i = 0; ok && i < count; ++i)
+      (*hashes)[i] = getBE(&buf[i * sizeof(uint64_t)], sizeof(uint64_t));
+  }
+
+  ::close(fd);
+  return ok;
+}
+
+int BlockIndex::build(const string &path, const struct stat &st,
+                      vector<uint64_t> *hashes) const {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return -errno;
+
+  uint64_t count = (st.st_size + blockSize - 1) / blockSize;
+  hashes->resize(count);
+
+  vector<unsigned char> buf(ReadBlocks * blockSize);
+  int res = 0;
+  for (uint64_t block = 0; block < count; block += ReadBlocks) {
+    ssize_t len = pread(fd, &buf[0], buf.size(), (off_t)block * blockSize);
+    if (len < 0) {
+      res = -errno;
+      break;
+    }
+
+    // the file may have grown since st was taken.
+    for (uint64_t i = 0;
+         len > 0 && i < (uint64_t)ReadBlocks && block + i < count; ++i) {
+      int blockLen = (len > blockSize) ? blockSize : (int)len;
+      uint64_t iv = block + i;
+      (*hashes)[block + i] =
+          cipher->MAC_64(&buf[i * blockSize], blockLen, &iv);
+      len -= blockLen;
+    }
+  }
+
+  ::close(fd);
+  return res;
+}
+
+void BlockIndex::save(const string &file, const Stamp &stamp,
+                      const vector<uint64_t> &hashes) const {
+  vector<unsigned char> buf(HeaderSize + hashes.size() * sizeof(uint64_t));
+  memcpy(&buf[0], IndexMagic, sizeof(IndexMagic));
+  putBE(&buf[4], blockSize, 4);
+  putBE(&buf[8], keyTag, 8);
+  putStamp(&buf[16], stamp.inode, stamp.size, stamp.mtime, stamp.mtimeNsec,
+           stamp.ctime, stamp.ctimeNsec);
+  putBE(&buf[56], hashes.size(), 8);
+  for (size_t i = 0; i < hashes.size(); ++i)
+    putBE(&buf[HeaderSize + i * sizeof(uint64_t)], hashes[i], 8);
+
+  // write to a temporary and rename, so readers never see a partial index.
+  string tmpName = file + ".tmp";
+  int fd = ::open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    LOG(WARNING) << "unable to write block index " << tmpName << ": "
+                 << strerror(errno);
+    return;
+  }
+
+  bool ok = ::write(fd, &buf[0], buf.size()) == (ssize_t)buf.size();
+  ok = (::close(fd) == 0) && ok;
+  if (!ok || ::rename(tmpName.c_str(), file.c_str()) != 0) {
+    LOG(WARNING) << "unable to save block index " << file << ": "
+                 << strerror(errno);
+    ::unlink(tmpName.c_str());
+  }
+}
+
+int BlockIndex::lookup(const string &path) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) return -errno;
+  if (!S_ISREG(st.st_mode)) return -EINVAL;
+
+  Stamp stamp = MakeStamp(st);
+  if (cachedValid && cachedStamp == stamp) return 0;
+
+  cachedValid = false;
+  string file = indexPath(st);
+  if (!load(file, stamp, &cached)) {
+    // Hashes of a file which changed while we were reading it are never
+    // used, so read it again, and give up if it keeps changing.
+    for (int attempt = 0;; ++attempt) {
+      VLOG(1) << "rebuilding block index for inode " << st.st_ino;
+      int res = build(path, st, &cached);
+      if (res < 0) {
+        cached.clear();
+        return res;
+      }
+
+      struct stat after;
+      if (::stat(path.c_str(), &after) != 0) {
+        res = -errno;
+        cached.clear();
+        return res;
+      }
+      Stamp afterStamp = MakeStamp(after);
+      if (afterStamp == stamp) break;
+
+      if (attempt + 1 >= MaxBuilds || !S_ISREG(after.st_mode)) {
+        LOG(INFO) << "block index for inode " << st.st_ino
+                  << " not built, the file keeps changing";
+        cached.clear();
+        return -EAGAIN;
+      }
+      st = after;
+      stamp = afterStamp;
+    }
+
+    save(file, stamp, cached);
+  }
+
+  cachedValid = true;
+  cachedStamp = stamp;
+  return 0;
+}
+
+int BlockIndex::blockHashes(const string &path, vector<uint64_t> *hashes) {
+  Lock _lock(mutex);
+
+  int res = lookup(path);
+  if (res == 0) *hashes = cached;
+  return res;
+}
+
+int BlockIndex::readChunk(const string &path, int chunk, void *buf,
+                          size_t size) {
+  Lock _lock(mutex);
+
+  int res = lookup(path);
+  if (res < 0) return res;
+
+  uint64_t first = (uint64_t)chunk * ChunkEntries;
+  uint64_t count = 0;
+  if (first < cached.size()) count = cached.size() - first;
+  if (count > (uint64_t)ChunkEntries) count = ChunkEntries;
+
+  size_t len = count * sizeof(uint64_t);
+  if (size == 0) return len;
+  if (size < len) return -ERANGE;
+
+  unsigned char *out = (unsigned char *)buf;
+  for (uint64_t i = 0; i < count; ++i)
+    putBE(out + i * sizeof(uint64_t), cached[first + i], sizeof(uint64_t));
+
+  return len;
+}
+
+}  // namespace encfs
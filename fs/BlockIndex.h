@@ -0,0 +1,121 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BlockIndex_incl_
+#define _BlockIndex_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+struct stat;
+
+namespace encfs {
+
+class CipherV1;
+
+/*
+    Per-block change index for reverse mode.
+
+    For each plaintext file, keeps a list of keyed 64 bit MACs, one per file
+    block.  In reverse mode a ciphertext block only depends on the plaintext
+    block and its position, so comparing two versions of the index tells a
+    backup tool exactly which ciphertext blocks changed, without having to
+    read (and so encrypt) the unchanged ones.
+
+    The index is stored outside of the plaintext tree, one file per backing
+    inode, and is rebuilt whenever the inode, size, mtime or ctime of the
+    file changes.  The most recently used index is also kept parsed in
+    memory, since a backup tool reads it one chunk at a time.
+
+    It is exposed through the extended attribute "user.encfs.blockindex" on
+    the ciphertext view.  Since attribute values are limited in size, large
+    files are split into chunks of ChunkEntries MACs: "user.encfs.blockindex"
+    is chunk 0, "user.encfs.blockindex.N" is chunk N.  Each entry is a big
+    endian 64 bit value, and an empty value marks the end of the file.
+*/
+class BlockIndex {
+ public:
+  static const char *AttrName;
+  static const int ChunkEntries = 4096;
+
+  BlockIndex(const std::string &indexDir, const shared_ptr<CipherV1> &cipher,
+             int blockSize);
+  ~BlockIndex();
+
+  // Returns true if name is a block index attribute, and sets chunk.
+  static bool ParseAttrName(const char *name, int *chunk);
+
+  // getxattr style interface: copies the given chunk for the plaintext file
+  // at path into buf and returns the length.  If size is 0, just returns the
+  // length.  Returns -errno on failure.
+  int readChunk(const std::string &path, int chunk, void *buf, size_t size);
+
+  // Returns the MAC list for the file, rebuilding the index if necessary.
+  // Returns -EAGAIN if the file kept changing while it was being read.
+  int blockHashes(const std::string &path, std::vector<uint64_t> *hashes);
+
+ private:
+  struct Stamp {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t mtimeNsec;
+    uint64_t ctime;
+    uint64_t ctimeNsec;
+
+    bool operator==(const Stamp &other) const;
+  };
+
+  static Stamp MakeStamp(const struct stat &st);
+
+  // Points cached at the index for the file, loading or rebuilding it if
+  // necessary.  Expects the mutex to be held.
+  int lookup(const std::string &path);
+
+  std::string indexPath(const struct stat &st) const;
+  bool load(const std::string &file, const Stamp &stamp,
+            std::vector<uint64_t> *hashes) const;
+  int build(const std::string &path, const struct stat &st,
+            std::vector<uint64_t> *hashes) const;
+  void save(const std::string &file, const Stamp &stamp,
+            const std::vector<uint64_t> &hashes) const;
+
+  std::string dir;
+  shared_ptr<CipherV1> cipher;
+  int blockSize;
+  uint64_t keyTag;
+
+  // most recently used index, valid if cachedValid is set.
+  bool cachedValid;
+  Stamp cachedStamp;
+  std::vector<uint64_t> cached;
+
+  Mutex mutex;
+};
+
+}  // namespace encfs
+
+#endif
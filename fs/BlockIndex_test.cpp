@@ -0,0 +1,177 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cipher/CipherV1.h"
+#include "fs/BlockIndex.h"
+
+using namespace encfs;
+using std::string;
+using std::vector;
+
+namespace {
+
+const int BlockSize = 1024;
+
+class BlockIndexTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-index-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+    indexDir = rootDir + "/index";
+    fileName = rootDir + "/file";
+    ASSERT_EQ(0, mkdir(indexDir.c_str(), 0700));
+
+    cipher = CipherV1::New("AES", 256);
+    ASSERT_TRUE(cipher.get() != NULL);
+    cipher->setKey(cipher->newRandomKey());
+  }
+
+  virtual void TearDown() {
+    DIR *dir = opendir(indexDir.c_str());
+    if (dir != NULL) {
+      struct dirent *de;
+      while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.')
+          unlink((indexDir + "/" + de->d_name).c_str());
+      }
+      closedir(dir);
+    }
+    rmdir(indexDir.c_str());
+    unlink(fileName.c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  void writeFile(off_t offset, int len, char fill, time_t mtime) {
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT, 0600);
+    ASSERT_LE(0, fd);
+    vector<char> buf(len, fill);
+    ASSERT_EQ(len, pwrite(fd, &buf[0], len, offset));
+    close(fd);
+
+    struct utimbuf times;
+    times.actime = times.modtime = mtime;
+    ASSERT_EQ(0, utime(fileName.c_str(), &times));
+  }
+
+  string rootDir;
+  string indexDir;
+  string fileName;
+  shared_ptr<CipherV1> cipher;
+};
+
+TEST_F(BlockIndexTest, AttrName) {
+  int chunk = -1;
+  EXPECT_TRUE(BlockIndex::ParseAttrName("user.encfs.blockindex", &chunk));
+  EXPECT_EQ(0, chunk);
+  EXPECT_TRUE(BlockIndex::ParseAttrName("user.encfs.blockindex.12", &chunk));
+  EXPECT_EQ(12, chunk);
+  EXPECT_FALSE(BlockIndex::ParseAttrName("user.encfs.blockindex.", &chunk));
+  EXPECT_FALSE(BlockIndex::ParseAttrName("user.encfs.blockindex.x", &chunk));
+  EXPECT_FALSE(BlockIndex::ParseAttrName("user.encfs.blockindexes", &chunk));
+  EXPECT_FALSE(BlockIndex::ParseAttrName("user.other", &chunk));
+}
+
+TEST_F(BlockIndexTest, DetectsChangedBlocks) {
+  const int Blocks = 100;
+  ASSERT_NO_FATAL_FAILURE(writeFile(0, Blocks * BlockSize - 10, 'a', 1000));
+
+  BlockIndex index(indexDir, cipher, BlockSize);
+  vector<uint64_t> before;
+  ASSERT_EQ(0, index.blockHashes(fileName, &before));
+  ASSERT_EQ((size_t)Blocks, before.size());
+
+  // identical content at different offsets must not hash the same.
+  EXPECT_NE(before[0], before[1]);
+
+  // unchanged file is served from the saved index.
+  vector<uint64_t> again;
+  ASSERT_EQ(0, BlockIndex(indexDir, cipher, BlockSize)
+                   .blockHashes(fileName, &again));
+  EXPECT_TRUE(before == again);
+
+  ASSERT_NO_FATAL_FAILURE(writeFile(70 * BlockSize + 5, 1, 'b', 2000));
+
+  vector<uint64_t> after;
+  ASSERT_EQ(0, index.blockHashes(fileName, &after));
+  ASSERT_EQ(before.size(), after.size());
+  for (int i = 0; i < Blocks; ++i) {
+    if (i == 70)
+      EXPECT_NE(before[i], after[i]);
+    else
+      EXPECT_EQ(before[i], after[i]) << "block " << i;
+  }
+}
+
+TEST_F(BlockIndexTest, SameSizeRewriteWithSameMtime) {
+  ASSERT_NO_FATAL_FAILURE(writeFile(0, 10 * BlockSize, 'a', 1000));
+
+  BlockIndex index(indexDir, cipher, BlockSize);
+  vector<uint64_t> before;
+  ASSERT_EQ(0, index.blockHashes(fileName, &before));
+
+  // same size and whole-second mtime, but the ctime moves on (past the
+  // filesystem's timestamp granularity).
+  usleep(20 * 1000);
+  ASSERT_NO_FATAL_FAILURE(writeFile(3 * BlockSize, 1, 'b', 1000));
+
+  vector<uint64_t> after;
+  ASSERT_EQ(0, index.blockHashes(fileName, &after));
+  ASSERT_EQ(before.size(), after.size());
+  EXPECT_NE(before[3], after[3]);
+}
+
+TEST_F(BlockIndexTest, ReadChunk) {
+  const int Blocks = BlockIndex::ChunkEntries + 10;
+  ASSERT_NO_FATAL_FAILURE(writeFile(0, Blocks * BlockSize, 'c', 1000));
+
+  BlockIndex index(indexDir, cipher, BlockSize);
+  vector<uint64_t> hashes;
+  ASSERT_EQ(0, index.blockHashes(fileName, &hashes));
+
+  const int ChunkBytes = BlockIndex::ChunkEntries * sizeof(uint64_t);
+  EXPECT_EQ(ChunkBytes, index.readChunk(fileName, 0, NULL, 0));
+  EXPECT_EQ(80, index.readChunk(fileName, 1, NULL, 0));
+  EXPECT_EQ(0, index.readChunk(fileName, 2, NULL, 0));
+
+  unsigned char buf[80];
+  EXPECT_EQ(-ERANGE, index.readChunk(fileName, 0, buf, sizeof(buf)));
+  ASSERT_EQ(80, index.readChunk(fileName, 1, buf, sizeof(buf)));
+
+  uint64_t first = 0;
+  for (int i = 0; i < 8; ++i) first = (first << 8) | buf[i];
+  EXPECT_EQ(hashes[BlockIndex::ChunkEntries], first);
+}
+
+}  // namespace
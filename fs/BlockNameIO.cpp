@@ -23,6 +23,7 @@
 #include "base/base64.h"
 #include "base/Error.h"
 #include "base/i18n.h"
+#include "cipher/CipherPool.h"
 #include "cipher/CipherV1.h"
 
 #include <cstring>
@@ -91,6 +92,7 @@ BlockNameIO::BlockNameIO(const Interface &iface,
     : _interface(iface.major()),
       _bs(cipher->cipherBlockSize()),
       _cipher(cipher),
+      _ciphers(new CipherPool(cipher)),
       _caseSensitive(caseSensitiveEncoding) {
   rAssert(_bs < 128);
 }
@@ -120,6 +122,7 @@ int BlockNameIO::maxDecodedNameLen(int encodedNameLen) const {
 
 string BlockNameIO::encodeName(const string &plaintextName,
                                uint64_t *iv) const {
+  CipherV1 *cipher = _ciphers->local();
   int length = plaintextName.length();
   // Pad encryption buffer to block boundary..
   int padding = _bs - length % _bs;
@@ -138,15 +141,15 @@ string BlockNameIO::encodeName(const string &plaintextName,
   if (iv && _interface >= 3) tmpIV = *iv;
 
   // include padding in MAC computation
-  unsigned int mac = _cipher->reduceMac16(
-      _cipher->MAC_64(tmpBuf.data() + 2, length + padding, iv));
+  unsigned int mac = CipherV1::reduceMac16(
+      cipher->MAC_64(tmpBuf.data() + 2, length + padding, iv));
   tmpIV ^= (uint64_t)mac;
 
   // add checksum bytes
   tmpBuf[0] = (mac >> 8) & 0xff;
   tmpBuf[1] = (mac) & 0xff;
 
-  _cipher->blockEncode(tmpBuf.data() + 2, length + padding, tmpIV);
+  cipher->blockEncode(tmpBuf.data() + 2, length + padding, tmpIV);
 
   // convert to base 32 or 64 ascii
   if (_caseSensitive) {
@@ -161,6 +164,7 @@ string BlockNameIO::encodeName(const string &plaintextName,
 }
 
 string BlockNameIO::decodeName(const string &encodedName, uint64_t *iv) const {
+  CipherV1 *cipher = _ciphers->local();
   int length = encodedName.length();
   int decLen256 =
       _caseSensitive ? B32ToB256Bytes(length) : B64ToB256Bytes(length);
@@ -189,7 +193,7 @@ string BlockNameIO::decodeName(const string &encodedName, uint64_t *iv) const {
   if (iv && _interface >= 3) tmpIV = *iv;
   tmpIV ^= (uint64_t)mac;
 
-  _cipher->blockDecode(&tmpBuf.at(2), decodedStreamLen, tmpIV);
+  cipher->blockDecode(&tmpBuf.at(2), decodedStreamLen, tmpIV);
 
   // find out true string length
   int padding = tmpBuf[2 + decodedStreamLen - 1];
@@ -203,8 +207,8 @@ string BlockNameIO::decodeName(const string &encodedName, uint64_t *iv) const {
   }
 
   // check the mac
-  unsigned int mac2 = _cipher->reduceMac16(
-      _cipher->MAC_64(&tmpBuf.at(2), decodedStreamLen, iv));
+  unsigned int mac2 = CipherV1::reduceMac16(
+      cipher->MAC_64(&tmpBuf.at(2), decodedStreamLen, iv));
 
   if (mac2 != mac) {
     LOG(INFO) << "checksum mismatch: expected " << mac << ", got " << mac2
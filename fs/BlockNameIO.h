@@ -29,6 +29,7 @@
 namespace encfs {
 
 class CipherV1;
+class CipherPool;
 
 /*
     Implement NameIO interface for filename encoding.  Uses cipher in block
@@ -61,6 +62,7 @@ class BlockNameIO : public NameIO {
   int _interface;
   int _bs;
   shared_ptr<CipherV1> _cipher;
+  shared_ptr<CipherPool> _ciphers;  // per-thread copies of _cipher
   bool _caseSensitive;
 };
 
@@ -21,6 +21,8 @@
 #include "fs/CipherFileIO.h"
 
 #include "base/Error.h"
+#include "base/WorkerPool.h"
+#include "cipher/CipherPool.h"
 #include "cipher/CipherV1.h"
 #include "cipher/MemoryPool.h"
 #include "fs/fsconfig.pb.h"
@@ -40,6 +42,15 @@ namespace encfs {
 */
 static Interface CipherFileIO_iface = makeInterface("FileIO/Cipher", 3, 0, 2);
 
+// Reverse mode read-ahead: number of sequential block reads before starting,
+// and the amount of plaintext read and encrypted at once.
+static const int ReadAheadTrigger = 2;
+static const int ReadAheadBytes = 256 * 1024;
+
+// Reads of at most this fraction of a block only decode the cipher blocks
+// they cover.
+static const int PartialReadFraction = 4;
+
 CipherFileIO::CipherFileIO(const shared_ptr<FileIO> &_base,
                            const FSConfigPtr &cfg)
     : BlockFileIO(cfg->config->block_size(), cfg),
@@ -48,14 +59,19 @@ CipherFileIO::CipherFileIO(const shared_ptr<FileIO> &_base,
       perFileIV(cfg->config->unique_iv()),
       externalIV(0),
       fileIV(0),
-      lastFlags(0) {
+      lastFlags(0),
+      lastBlockNum(-1),
+      sequentialReads(0),
+      aheadStart(0),
+      ivCached(false),
+      ivCacheSeed(0) {
   fsConfig = cfg;
-  cipher = cfg->cipher;
+  cipher = cfg->dataCipher;
 
   if (perFileIV) headerLen += sizeof(uint64_t);  // 64bit IV per file
 
   int blockBoundary =
-      fsConfig->config->block_size() % fsConfig->cipher->cipherBlockSize();
+      fsConfig->config->block_size() % cipher->cipherBlockSize();
   if (blockBoundary != 0) {
     LOG_FIRST_N(ERROR, 1)
         << "CipherFileIO: blocks should be multiple of cipher block size";
@@ -128,6 +144,11 @@ off_t CipherFileIO::adjustedSize(off_t rawSize) const {
   return size;
 }
 
+off_t CipherFileIO::AdjustedSize(const FSConfigPtr &cfg, off_t rawSize) {
+  int headerLen = cfg->config->unique_iv() ? sizeof(uint64_t) : 0;
+  return (rawSize >= headerLen) ? rawSize - headerLen : rawSize;
+}
+
 int CipherFileIO::getAttr(struct stat *stbuf) const {
   int res = base->getAttr(stbuf);
 
@@ -163,7 +184,7 @@ void CipherFileIO::initHeader() {
     base->read(req);
 
     if (perFileIV) {
-      cipher->streamDecode(mb.data, sizeof(uint64_t), externalIV);
+      coder()->streamDecode(mb.data, sizeof(uint64_t), externalIV);
 
       fileIV = 0;
       for (unsigned int i = 0; i < sizeof(uint64_t); ++i)
@@ -186,7 +207,7 @@ void CipherFileIO::initHeader() {
           << "Unexpected result: randomize returned 8 null bytes!";
     } while (fileIV == 0);  // don't accept 0 as an option..
 
-    cipher->streamEncode(mb.data, sizeof(uint64_t), externalIV);
+    coder()->streamEncode(mb.data, sizeof(uint64_t), externalIV);
 
     if (base->isWritable()) {
       IORequest req;
@@ -225,7 +246,7 @@ bool CipherFileIO::writeHeader() {
       fileIV >>= 8;
     }
 
-    cipher->streamEncode(buf, sizeof(uint64_t), externalIV);
+    coder()->streamEncode(buf, sizeof(uint64_t), externalIV);
   }
 
   IORequest req;
@@ -246,6 +267,9 @@ ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
   off_t blockNum = req.offset / bs;
 
   ssize_t readSize = 0;
+  if (fsConfig->reverseEncryption && readAhead(req, blockNum, &readSize))
+    return readSize;
+
   IORequest tmpReq = req;
 
   MemBlock mb;
@@ -279,11 +303,163 @@ ssize_t CipherFileIO::readOneBlock(const IORequest &req) const {
   return readSize;
 }
 
+bool CipherFileIO::readPartial(const IORequest &req, ssize_t *result) const {
+  // Only decoding is chained, so this can't be used in reverse mode, where
+  // reading means encoding.
+  int bs = blockSize();
+  int cbs = cipher->cipherBlockSize();
+  if (fsConfig->reverseEncryption || bs % cbs != 0 ||
+      req.dataLen * PartialReadFraction > bs)
+    return false;
+
+  // The last block may be partial, in which case it is stream encoded.
+  off_t blockNum = req.offset / bs;
+  if (getSize() < (blockNum + 1) * bs) return false;
+
+  if (headerLen != 0 && fileIV == 0)
+    const_cast<CipherFileIO *>(this)->initHeader();
+
+  // cipher blocks covering the request, plus the one before them.
+  int partialOffset = req.offset % bs;
+  int first = (partialOffset / cbs) * cbs;
+  int end = ((partialOffset + req.dataLen + cbs - 1) / cbs) * cbs;
+  int start = (first == 0) ? 0 : first - cbs;
+
+  MemBlock mb;
+  mb.allocate(end - start);
+
+  IORequest tmpReq;
+  tmpReq.offset = blockNum * bs + start + headerLen;
+  tmpReq.data = mb.data;
+  tmpReq.dataLen = end - start;
+  if (base->read(tmpReq) != tmpReq.dataLen) return false;
+
+  // A hole reads back as zeros, which blockRead passes through undecoded.
+  // Only the whole block tells, so leave all-zero ranges to it.
+  if (_allowHoles) {
+    bool zero = true;
+    for (int i = 0; zero && i < tmpReq.dataLen; ++i) zero = (mb.data[i] == 0);
+    if (zero) return false;
+  }
+
+  unsigned char *data = mb.data + (first - start);
+  bool ok;
+  if (first == 0) {
+    uint64_t seed = blockNum ^ fileIV;
+    if (!ivCached || ivCacheSeed != seed) {
+      ivCacheData.resize(cbs);
+      coder()->blockIVec(&ivCacheData[0], seed);
+      ivCacheSeed = seed;
+      ivCached = true;
+    }
+    ok = coder()->blockDecodeFrom(&ivCacheData[0], data, end - first);
+  } else {
+    ok = coder()->blockDecodeFrom(mb.data, data, end - first);
+  }
+
+  if (!ok) {
+    VLOG(1) << "partial decode failed for block " << blockNum;
+    return false;
+  }
+
+  memcpy(req.data, data + (partialOffset - first), req.dataLen);
+  *result = req.dataLen;
+  return true;
+}
+
+void CipherFileIO::clearReadAhead() const {
+  aheadLen.clear();
+  aheadData.clear();
+}
+
+bool CipherFileIO::readAhead(const IORequest &req, off_t blockNum,
+                             ssize_t *result) const {
+  int bs = blockSize();
+
+  off_t index = blockNum - aheadStart;
+  if (index < 0 || index >= (off_t)aheadLen.size()) {
+    // not in the window, check if we should fill it.
+    if (blockNum == lastBlockNum + 1)
+      ++sequentialReads;
+    else
+      sequentialReads = 0;
+    lastBlockNum = blockNum;
+
+    if (sequentialReads < ReadAheadTrigger || !fsConfig->cipherPool)
+      return false;
+
+    int blocks = ReadAheadBytes / bs;
+    if (blocks < 2) blocks = 2;
+
+    clearReadAhead();
+    aheadData.resize(blocks * bs);
+
+    IORequest tmpReq;
+    tmpReq.offset = blockNum * bs + headerLen;
+    tmpReq.data = &aheadData[0];
+    tmpReq.dataLen = blocks * bs;
+    ssize_t len = base->read(tmpReq);
+    if (len <= 0) {
+      clearReadAhead();
+      return false;
+    }
+
+    if (headerLen != 0 && fileIV == 0)
+      const_cast<CipherFileIO *>(this)->initHeader();
+
+    aheadStart = blockNum;
+    for (ssize_t left = len; left > 0; left -= bs)
+      aheadLen.push_back(left > bs ? bs : (int)left);
+
+    // Split the window into one range of blocks per thread, each using its
+    // own cipher instance.
+    shared_ptr<WorkerPool> pool = WorkerPool::Default();
+    int ranges = pool->threadCount() + 1;
+    if (ranges > (int)aheadLen.size()) ranges = aheadLen.size();
+    int perRange = (aheadLen.size() + ranges - 1) / ranges;
+
+    std::vector<char> ok(ranges, 1);
+    CipherPool *ciphers = fsConfig->cipherPool.get();
+    pool->parallelFor(ranges, [&](int range) {
+      CipherV1 *c = ciphers->local();
+      int end = (range + 1) * perRange;
+      if (end > (int)aheadLen.size()) end = aheadLen.size();
+      for (int i = range * perRange; i < end && ok[range]; ++i) {
+        unsigned char *buf = &aheadData[i * bs];
+        uint64_t iv = (aheadStart + i) ^ fileIV;
+        if (aheadLen[i] == bs)
+          ok[range] = c->blockEncode(buf, bs, iv);
+        else
+          ok[range] = c->streamEncode(buf, aheadLen[i], iv);
+      }
+    });
+
+    for (int i = 0; i < ranges; ++i) {
+      if (!ok[i]) {
+        VLOG(1) << "read-ahead encoding failed at block " << blockNum;
+        clearReadAhead();
+        return false;
+      }
+    }
+
+    index = 0;
+  }
+
+  lastBlockNum = blockNum;
+
+  int len = aheadLen[index];
+  if (len > req.dataLen) len = req.dataLen;
+  memcpy(req.data, &aheadData[index * bs], len);
+  *result = len;
+  return true;
+}
+
 bool CipherFileIO::writeOneBlock(const IORequest &req) {
   int bs = blockSize();
   off_t blockNum = req.offset / bs;
 
   if (headerLen != 0 && fileIV == 0) initHeader();
+  clearReadAhead();
 
   MemBlock mb;
 
@@ -319,46 +495,54 @@ bool CipherFileIO::writeOneBlock(const IORequest &req) {
   return ok;
 }
 
+// Coding changes the state of a cipher instance, and other files are coded
+// on other FUSE threads at the same time, so each thread has its own.
+CipherV1 *CipherFileIO::coder() const {
+  CipherPool *pool = fsConfig->cipherPool.get();
+  return pool ? pool->local() : cipher.get();
+}
+
 bool CipherFileIO::blockWrite(unsigned char *buf, int size,
                               uint64_t _iv64) const {
   if (!fsConfig->reverseEncryption)
-    return cipher->blockEncode(buf, size, _iv64);
+    return coder()->blockEncode(buf, size, _iv64);
   else
-    return cipher->blockDecode(buf, size, _iv64);
+    return coder()->blockDecode(buf, size, _iv64);
 }
 
 bool CipherFileIO::streamWrite(unsigned char *buf, int size,
                                uint64_t _iv64) const {
   if (!fsConfig->reverseEncryption)
-    return cipher->streamEncode(buf, size, _iv64);
+    return coder()->streamEncode(buf, size, _iv64);
   else
-    return cipher->streamDecode(buf, size, _iv64);
+    return coder()->streamDecode(buf, size, _iv64);
 }
 
 bool CipherFileIO::blockRead(unsigned char *buf, int size,
                              uint64_t _iv64) const {
   if (fsConfig->reverseEncryption)
-    return cipher->blockEncode(buf, size, _iv64);
+    return coder()->blockEncode(buf, size, _iv64);
   else if (_allowHoles) {
     // special case - leave all 0's alone
     for (int i = 0; i < size; ++i)
-      if (buf[i] != 0) return cipher->blockDecode(buf, size, _iv64);
+      if (buf[i] != 0) return coder()->blockDecode(buf, size, _iv64);
 
     return true;
   } else
-    return cipher->blockDecode(buf, size, _iv64);
+    return coder()->blockDecode(buf, size, _iv64);
 }
 
 bool CipherFileIO::streamRead(unsigned char *buf, int size,
                               uint64_t _iv64) const {
   if (fsConfig->reverseEncryption)
-    return cipher->streamEncode(buf, size, _iv64);
+    return coder()->streamEncode(buf, size, _iv64);
   else
-    return cipher->streamDecode(buf, size, _iv64);
+    return coder()->streamDecode(buf, size, _iv64);
 }
 
 int CipherFileIO::truncate(off_t size) {
   rAssert(size >= 0);
+  clearReadAhead();
 
   if (headerLen == 0) {
     return blockTruncate(size, base.get());
@@ -384,4 +568,17 @@ int CipherFileIO::truncate(off_t size) {
 
 bool CipherFileIO::isWritable() const { return base->isWritable(); }
 
+int CipherFileIO::flush() { return base->flush(); }
+
+void CipherFileIO::invalidateCache() {
+  BlockFileIO::invalidateCache();
+  base->invalidateCache();
+  clearReadAhead();
+  ivCached = false;
+
+  // The header may have been rewritten by another host (eg. file truncated to
+  // 0 and recreated), so force it to be read again on next access.
+  if (headerLen != 0 && !fsConfig->reverseEncryption) fileIV = 0;
+}
+
 }  // namespace encfs
@@ -26,6 +26,7 @@
 #include "fs/FileUtils.h"
 
 #include <inttypes.h>
+#include <vector>
 
 namespace encfs {
 
@@ -52,6 +53,10 @@ class CipherFileIO : public BlockFileIO {
   virtual int getAttr(struct stat *stbuf) const;
   virtual off_t getSize() const;
 
+  // Size of the file as seen through this layer, given the size of the
+  // underlying file.
+  static off_t AdjustedSize(const FSConfigPtr &cfg, off_t rawSize);
+
   // NOTE: if truncate is used to extend the file, the extended plaintext is
   // not 0.  The extended ciphertext may be 0, resulting in non-zero
   // plaintext.
@@ -59,6 +64,9 @@ class CipherFileIO : public BlockFileIO {
 
   virtual bool isWritable() const;
 
+  virtual int flush();
+  virtual void invalidateCache();
+
  private:
   virtual ssize_t readOneBlock(const IORequest &req) const;
   virtual bool writeOneBlock(const IORequest &req);
@@ -72,6 +80,13 @@ class CipherFileIO : public BlockFileIO {
 
   off_t adjustedSize(off_t size) const;
 
+  CipherV1 *coder() const;
+
+  bool readAhead(const IORequest &req, off_t blockNum, ssize_t *result) const;
+  void clearReadAhead() const;
+
+  virtual bool readPartial(const IORequest &req, ssize_t *result) const;
+
   shared_ptr<FileIO> base;
 
   FSConfigPtr fsConfig;
@@ -84,7 +99,22 @@ class CipherFileIO : public BlockFileIO {
   uint64_t fileIV;
   int lastFlags;
 
+  // Prototype for the per-thread instances which do the coding, see coder().
   shared_ptr<CipherV1> cipher;
+
+  // Reverse mode read-ahead.  Once reads are found to be sequential, a
+  // window of blocks is read from the plaintext file at once and encrypted
+  // in parallel.
+  mutable off_t lastBlockNum;
+  mutable int sequentialReads;
+  mutable off_t aheadStart;  // first block in window
+  mutable std::vector<int> aheadLen;  // bytes in each block of the window
+  mutable std::vector<unsigned char> aheadData;
+
+  // Derived IV of the last block read partially from its start.
+  mutable bool ivCached;
+  mutable uint64_t ivCacheSeed;
+  mutable std::vector<unsigned char> ivCacheData;
 };
 
 }  // namespace encfs
@@ -27,6 +27,9 @@
 
 namespace encfs {
 
+// Maximum number of files remembered for page cache validation.
+static const size_t MaxCacheStamps = 64 * 1024;
+
 EncFS_Context::EncFS_Context() : publicFilesystem(false), running(false) {
 #ifdef CMAKE_USE_PTHREADS_INIT
   pthread_cond_init(&wakeupCond, 0);
@@ -89,6 +92,19 @@ int EncFS_Context::openFileCount() const {
   return openFiles.size();
 }
 
+bool EncFS_Context::hasOpenFiles(const char *dirPath) const {
+  std::string prefix = dirPath;
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/') prefix += '/';
+
+  Lock lock(contextMutex);
+
+  for (FileMap::const_iterator it = openFiles.begin(); it != openFiles.end();
+       ++it) {
+    if (it->first.compare(0, prefix.length(), prefix) == 0) return true;
+  }
+  return false;
+}
+
 shared_ptr<FileNode> EncFS_Context::lookupNode(const char *path) {
   Lock lock(contextMutex);
 
@@ -151,4 +167,56 @@ void EncFS_Context::eraseNode(const char *path, void *pl) {
   delete ph;
 }
 
+bool EncFS_Context::CacheStamp::operator==(const CacheStamp &other) const {
+  return size == other.size && mtime == other.mtime && ctime == other.ctime &&
+         mtimeNsec == other.mtimeNsec && ctimeNsec == other.ctimeNsec;
+}
+
+EncFS_Context::CacheStamp EncFS_Context::Stamp(const struct stat &st) {
+  CacheStamp stamp;
+  stamp.size = st.st_size;
+  stamp.mtime = st.st_mtime;
+  stamp.ctime = st.st_ctime;
+#ifdef linux
+  stamp.mtimeNsec = st.st_mtim.tv_nsec;
+  stamp.ctimeNsec = st.st_ctim.tv_nsec;
+#else
+  stamp.mtimeNsec = 0;
+  stamp.ctimeNsec = 0;
+#endif
+  return stamp;
+}
+
+void EncFS_Context::putStamp(ino_t ino, const CacheStamp &stamp) {
+  if (cacheStamps.size() >= MaxCacheStamps && !cacheStamps.count(ino))
+    cacheStamps.clear();
+  cacheStamps[ino] = stamp;
+}
+
+bool EncFS_Context::keepCache(const struct stat &st) {
+  Lock lock(contextMutex);
+
+  CacheStamp stamp = Stamp(st);
+  unordered_map<ino_t, CacheStamp>::const_iterator it =
+      cacheStamps.find(st.st_ino);
+  bool unchanged = (it != cacheStamps.end() && it->second == stamp);
+
+  putStamp(st.st_ino, stamp);
+  return unchanged;
+}
+
+void EncFS_Context::noteClosed(const struct stat &st, bool wrote) {
+  Lock lock(contextMutex);
+
+  unordered_map<ino_t, CacheStamp>::iterator it = cacheStamps.find(st.st_ino);
+  if (it == cacheStamps.end()) return;
+
+  // Changes made by others since the open may not be in the kernel's pages.
+  CacheStamp stamp = Stamp(st);
+  if (wrote)
+    it->second = stamp;
+  else if (!(it->second == stamp))
+    cacheStamps.erase(it);
+}
+
 }  // namespace encfs
@@ -25,6 +25,8 @@
 #include "base/shared_ptr.h"
 #include "base/Mutex.h"
 
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <set>
 #include <string>
 
@@ -53,6 +55,8 @@ class EncFS_Context {
 
   int getAndResetUsageCounter();
   int openFileCount() const;
+  // True if any file below the directory dirPath is open.
+  bool hasOpenFiles(const char *dirPath) const;
 
   void *putNode(const char *path, const shared_ptr<FileNode> &node);
 
@@ -60,6 +64,15 @@ class EncFS_Context {
 
   void renameNode(const char *oldName, const char *newName);
 
+  // Kernel page cache validation, by the state of the backing file (st).
+  // keepCache returns true if the file hasn't changed since it was last
+  // opened or closed here, in which case the kernel may keep the pages it
+  // has cached for it.  noteClosed records the state a file was left in if
+  // it is unchanged since it was opened, or if it was written through the
+  // node being closed (wrote), and otherwise forgets the file.
+  bool keepCache(const struct stat &st);
+  void noteClosed(const struct stat &st, bool wrote);
+
   void setRoot(const shared_ptr<DirNode> &root);
   shared_ptr<DirNode> getRoot(int *err);
   bool isMounted() const;
@@ -105,6 +118,22 @@ class EncFS_Context {
 
   FileMap openFiles;
 
+  // Backing file state when last seen, by inode.  Bounded, and simply
+  // dropped when full, which only costs some cached pages.
+  struct CacheStamp {
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    long mtimeNsec;
+    long ctimeNsec;
+
+    bool operator==(const CacheStamp &other) const;
+  };
+  static CacheStamp Stamp(const struct stat &st);
+  void putStamp(ino_t ino, const CacheStamp &stamp);
+
+  unordered_map<ino_t, CacheStamp> cacheStamps;
+
   int usageCount;
   shared_ptr<DirNode> root;
 };
@@ -0,0 +1,73 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <cstring>
+
+#include "fs/Context.h"
+
+using namespace encfs;
+
+namespace {
+
+struct stat makeStat(ino_t ino, off_t size, time_t mtime) {
+  struct stat st;
+  memset(&st, 0, sizeof(st));
+  st.st_ino = ino;
+  st.st_size = size;
+  st.st_mtime = mtime;
+  st.st_ctime = mtime;
+  return st;
+}
+
+TEST(ContextTest, KeepCache) {
+  EncFS_Context ctx;
+
+  // nothing is known about a file the first time it is opened.
+  EXPECT_FALSE(ctx.keepCache(makeStat(1, 100, 10)));
+  EXPECT_TRUE(ctx.keepCache(makeStat(1, 100, 10)));
+
+  // changed elsewhere.
+  EXPECT_FALSE(ctx.keepCache(makeStat(1, 100, 11)));
+  EXPECT_FALSE(ctx.keepCache(makeStat(1, 200, 11)));
+  EXPECT_TRUE(ctx.keepCache(makeStat(1, 200, 11)));
+
+  // changed here, and closed.
+  ctx.noteClosed(makeStat(1, 300, 12), true);
+  EXPECT_TRUE(ctx.keepCache(makeStat(1, 300, 12)));
+
+  // unchanged while open.
+  ctx.noteClosed(makeStat(1, 300, 12), false);
+  EXPECT_TRUE(ctx.keepCache(makeStat(1, 300, 12)));
+
+  // changed elsewhere while open, without writes here.
+  ctx.noteClosed(makeStat(1, 400, 13), false);
+  EXPECT_FALSE(ctx.keepCache(makeStat(1, 400, 13)));
+
+  // nothing recorded at open.
+  ctx.noteClosed(makeStat(3, 300, 12), true);
+  EXPECT_FALSE(ctx.keepCache(makeStat(3, 300, 12)));
+
+  EXPECT_FALSE(ctx.keepCache(makeStat(2, 300, 12)));
+}
+
+}  // namespace
@@ -0,0 +1,83 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/DedupFileIO.h"
+
+#include "base/Error.h"
+#include "fs/DedupIndex.h"
+
+#include <glog/logging.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace encfs {
+
+static Interface DedupFileIO_iface = makeInterface("FileIO/Dedup", 1, 0, 0);
+
+DedupFileIO::DedupFileIO(const string &fileName,
+                         const shared_ptr<DedupIndex> &index_)
+    : RawFileIO(fileName), index(index_), path(new string(fileName)) {}
+
+DedupFileIO::~DedupFileIO() {}
+
+Interface DedupFileIO::interface() const { return DedupFileIO_iface; }
+
+void DedupFileIO::setFileName(const char *fileName) {
+  RawFileIO::setFileName(fileName);
+  path.reset(new string(fileName));
+}
+
+bool DedupFileIO::write(const IORequest &req) {
+  if (!RawFileIO::write(req)) return false;
+  if (!index->aligned(req.offset, req.dataLen)) return true;
+
+  uint64_t hash = index->hash(req.data, req.dataLen);
+  if (share(req, hash))
+    VLOG(2) << "Shared " << req.dataLen << " bytes at offset " << req.offset;
+  else
+    index->insert(hash, path, req.offset, req.dataLen);
+  return true;
+}
+
+// Has the host filesystem share the block just written with the copy
+// recorded in the index, if there is one and it still holds the same bytes.
+bool DedupFileIO::share(const IORequest &req, uint64_t hash) {
+  shared_ptr<const string> srcPath;
+  off_t srcOffset;
+  if (!index->lookup(hash, req.dataLen, &srcPath, &srcOffset)) return false;
+
+  bool sameFile = (*srcPath == name);
+  if (sameFile && srcOffset == req.offset) return false;
+
+  int srcFd = sameFile ? fd : ::open(srcPath->c_str(), O_RDONLY);
+  if (srcFd < 0) return false;
+
+  // The hash only finds candidates, the contents decide.
+  bool shared =
+      DedupIndex::DedupeRange(srcFd, srcOffset, req.dataLen, fd, req.offset);
+
+  if (!sameFile) ::close(srcFd);
+  return shared;
+}
+
+}  // namespace encfs
@@ -0,0 +1,60 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DedupFileIO_incl_
+#define _DedupFileIO_incl_
+
+#include "base/shared_ptr.h"
+#include "fs/RawFileIO.h"
+
+namespace encfs {
+
+class DedupIndex;
+
+/*
+    RawFileIO variant which shares the storage of raw blocks it has seen
+    before (--dedup), see DedupIndex.
+
+    Blocks are always written as usual.  Whole aligned blocks are then
+    looked up by hash, and the host filesystem is asked to share the storage
+    of the recorded copy, which it only does if the bytes are the same.
+    Blocks which aren't shared are recorded in the index instead.
+*/
+class DedupFileIO : public RawFileIO {
+ public:
+  DedupFileIO(const std::string &fileName, const shared_ptr<DedupIndex> &index);
+  virtual ~DedupFileIO();
+
+  virtual Interface interface() const;
+
+  virtual void setFileName(const char *fileName);
+
+  virtual bool write(const IORequest &req);
+
+ private:
+  bool share(const IORequest &req, uint64_t hash);
+
+  shared_ptr<DedupIndex> index;
+  shared_ptr<const std::string> path;  // name, shared with index entries
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,184 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/DedupIndex.h"
+
+#include "cipher/CipherPool.h"
+#include "cipher/CipherV1.h"
+
+#include <glog/logging.h>
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef linux
+#include <linux/fs.h>
+#endif
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using std::string;
+
+namespace encfs {
+
+// Mixed into the MACs, so that they don't match MACs used for anything else.
+static uint64_t HashTag = 0x6465647570ULL;  // "dedup"
+
+DedupIndex::DedupIndex(const shared_ptr<CipherPool> &pool_,
+                       const string &rootDir, int blockSize_,
+                       size_t maxEntries_)
+    : pool(pool_),
+      blockSize(blockSize_),
+      unit(0),
+      maxEntries(maxEntries_),
+      usable(false) {
+  struct statvfs st;
+  if (::statvfs(rootDir.c_str(), &st) == 0) unit = st.f_bsize;
+
+  if (unit <= 0 || blockSize % unit != 0) {
+    LOG(WARNING) << "dedup disabled: block size " << blockSize
+                 << " isn't a multiple of the host block size " << unit;
+    return;
+  }
+
+  usable = probe(rootDir);
+  LOG_IF(WARNING, !usable)
+      << "dedup disabled: the host filesystem can't share blocks";
+}
+
+DedupIndex::~DedupIndex() {}
+
+bool DedupIndex::enabled() const { return usable; }
+
+// Tries to share one host block between two scratch files.
+bool DedupIndex::probe(const string &rootDir) {
+  string tmpl = rootDir;
+  if (tmpl.empty() || tmpl[tmpl.length() - 1] != '/') tmpl += '/';
+  tmpl += ".encfs-dedup-XXXXXX";
+
+  std::vector<char> src(tmpl.begin(), tmpl.end());
+  std::vector<char> dst(tmpl.begin(), tmpl.end());
+  src.push_back('\0');
+  dst.push_back('\0');
+
+  int srcFd = ::mkstemp(&src[0]);
+  if (srcFd < 0) return false;
+  int dstFd = ::mkstemp(&dst[0]);
+
+  bool ok = false;
+  if (dstFd >= 0) {
+    std::vector<char> block(unit, 'x');
+    ok = ::pwrite(srcFd, &block[0], unit, 0) == unit &&
+         ::pwrite(dstFd, &block[0], unit, 0) == unit &&
+         DedupeRange(srcFd, 0, unit, dstFd, 0);
+    ::close(dstFd);
+    ::unlink(&dst[0]);
+  }
+
+  ::close(srcFd);
+  ::unlink(&src[0]);
+  return ok;
+}
+
+bool DedupIndex::aligned(off_t offset, int len) const {
+  return usable && len == blockSize && offset % unit == 0;
+}
+
+uint64_t DedupIndex::hash(const unsigned char *data, int len) const {
+  shared_ptr<CipherV1> cipher = pool->acquire();
+  uint64_t tag = HashTag;
+  uint64_t mac = cipher->MAC_64(data, len, &tag);
+  pool->release(cipher);
+  return mac;
+}
+
+bool DedupIndex::lookup(uint64_t hash, int len,
+                        shared_ptr<const string> *path, off_t *offset) {
+  Lock _lock(mutex);
+
+  unordered_map<uint64_t, Entry>::const_iterator it = entries.find(hash);
+  if (it == entries.end() || it->second.len != len) return false;
+
+  *path = it->second.path;
+  *offset = it->second.offset;
+  return true;
+}
+
+void DedupIndex::insert(uint64_t hash, const shared_ptr<const string> &path,
+                        off_t offset, int len) {
+  Lock _lock(mutex);
+
+  if (entries.size() >= maxEntries && !entries.count(hash)) {
+    VLOG(1) << "dedup index full, dropping " << entries.size() << " entries";
+    entries.clear();
+  }
+
+  Entry &entry = entries[hash];
+  entry.path = path;
+  entry.offset = offset;
+  entry.len = len;
+}
+
+void DedupIndex::forget(uint64_t hash) {
+  Lock _lock(mutex);
+  entries.erase(hash);
+}
+
+bool DedupIndex::DedupeRange(int srcFd, off_t srcOffset, int len, int fd,
+                             off_t offset) {
+#ifdef FIDEDUPERANGE
+  std::vector<char> buf(sizeof(struct file_dedupe_range) +
+                        sizeof(struct file_dedupe_range_info));
+  struct file_dedupe_range *range =
+      reinterpret_cast<struct file_dedupe_range *>(&buf[0]);
+  range->src_offset = srcOffset;
+  range->src_length = len;
+  range->dest_count = 1;
+  range->info[0].dest_fd = fd;
+  range->info[0].dest_offset = offset;
+
+  if (::ioctl(srcFd, FIDEDUPERANGE, range) != 0) {
+    VLOG(1) << "dedupe of " << len << " bytes failed: " << strerror(errno);
+    return false;
+  }
+
+  int status = range->info[0].status;
+  if (status == FILE_DEDUPE_RANGE_SAME &&
+      range->info[0].bytes_deduped == (uint64_t)len)
+    return true;
+
+  if (status < 0)
+    VLOG(1) << "dedupe of " << len << " bytes failed: " << strerror(-status);
+#else
+  (void)srcFd;
+  (void)srcOffset;
+  (void)len;
+  (void)fd;
+  (void)offset;
+#endif
+  return false;
+}
+
+}  // namespace encfs
@@ -0,0 +1,116 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DedupIndex_incl_
+#define _DedupIndex_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <string>
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+using std::tr1::unordered_map;
+#else
+#include <unordered_map>
+using std::unordered_map;
+#endif
+
+namespace encfs {
+
+class CipherPool;
+
+/*
+    Block sharing index for --dedup.
+
+    Raw blocks which are written whole and line up with the blocks of the
+    host filesystem are recorded by a keyed 64 bit MAC of their ciphertext,
+    along with where they were written.  When the same ciphertext is written
+    again, DedupFileIO asks the host filesystem to compare the new block with
+    the recorded copy and, if they match, to share the existing storage (a
+    reflink).  Reference counting and block maps are left to the host
+    filesystem, so the raw files keep their usual layout.
+
+    Identical plaintext only produces identical ciphertext at the same block
+    of a file without a per-file IV, so this is only useful for volumes
+    created without unique IVs.  The host filesystem must support reflinks
+    (such as btrfs or XFS); otherwise the index stays disabled.
+
+    The index is kept in memory only, and is simply dropped when it grows
+    past maxEntries.  Entries may be stale, since files change and move
+    without the index being told, which is why the host filesystem compares
+    copies before it shares them.
+*/
+class DedupIndex {
+ public:
+  DedupIndex(const shared_ptr<CipherPool> &pool, const std::string &rootDir,
+             int blockSize, size_t maxEntries);
+  ~DedupIndex();
+
+  // False if the raw blocks can't be shared on this volume.
+  bool enabled() const;
+
+  // True if a raw write of len bytes at offset may be shared.
+  bool aligned(off_t offset, int len) const;
+
+  uint64_t hash(const unsigned char *data, int len) const;
+
+  // Where a block with the given hash and length was last written.
+  bool lookup(uint64_t hash, int len, shared_ptr<const std::string> *path,
+              off_t *offset);
+  void insert(uint64_t hash, const shared_ptr<const std::string> &path,
+              off_t offset, int len);
+  void forget(uint64_t hash);
+
+  // Makes len bytes at offset in fd use the storage of len bytes at
+  // srcOffset in srcFd, if they hold the same data.  The host filesystem
+  // compares and shares them in one step (FIDEDUPERANGE).  Returns false if
+  // they differ or the host filesystem refused.
+  static bool DedupeRange(int srcFd, off_t srcOffset, int len, int fd,
+                          off_t offset);
+
+ private:
+  struct Entry {
+    shared_ptr<const std::string> path;
+    off_t offset;
+    int len;
+  };
+
+  bool probe(const std::string &rootDir);
+
+  shared_ptr<CipherPool> pool;
+  int blockSize;
+  int unit;  // block size of the host filesystem
+  size_t maxEntries;
+  bool usable;
+
+  Mutex mutex;
+  unordered_map<uint64_t, Entry> entries;
+
+  DedupIndex(const DedupIndex &);
+  DedupIndex &operator=(const DedupIndex &);
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,143 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fs/testing.h"
+#include "fs/CipherFileIO.h"
+#include "fs/DedupFileIO.h"
+#include "fs/DedupIndex.h"
+#include "fs/FSConfig.h"
+#include "fs/MemFileIO.h"
+
+using namespace encfs;
+using std::string;
+using std::vector;
+
+namespace {
+
+const int BlockSize = 4096;
+
+class DedupIndexTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-dedup-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+
+    cfg = makeConfig(CipherV1::New("AES", 128), BlockSize);
+    index.reset(new DedupIndex(cfg->cipherPool, rootDir, BlockSize, 4));
+  }
+
+  virtual void TearDown() {
+    string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+  }
+
+  string rootDir;
+  FSConfigPtr cfg;
+  shared_ptr<DedupIndex> index;
+};
+
+TEST_F(DedupIndexTest, LookupAndForget) {
+  vector<byte> a(BlockSize, 'a');
+  vector<byte> b(BlockSize, 'b');
+
+  uint64_t ha = index->hash(&a[0], BlockSize);
+  EXPECT_EQ(ha, index->hash(&a[0], BlockSize));
+  EXPECT_NE(ha, index->hash(&b[0], BlockSize));
+
+  shared_ptr<const string> path(new string("file"));
+  shared_ptr<const string> found;
+  off_t offset = -1;
+  EXPECT_FALSE(index->lookup(ha, BlockSize, &found, &offset));
+
+  index->insert(ha, path, 2 * BlockSize, BlockSize);
+  ASSERT_TRUE(index->lookup(ha, BlockSize, &found, &offset));
+  EXPECT_EQ("file", *found);
+  EXPECT_EQ(2 * BlockSize, offset);
+  EXPECT_FALSE(index->lookup(ha, BlockSize / 2, &found, &offset));
+
+  index->forget(ha);
+  EXPECT_FALSE(index->lookup(ha, BlockSize, &found, &offset));
+
+  // the index is dropped when it fills up.
+  for (uint64_t h = 1; h <= 5; ++h) index->insert(h, path, 0, BlockSize);
+  EXPECT_FALSE(index->lookup(1, BlockSize, &found, &offset));
+  EXPECT_TRUE(index->lookup(5, BlockSize, &found, &offset));
+}
+
+// Whether or not the host filesystem can share blocks, the data must come
+// back the same.
+TEST_F(DedupIndexTest, IdenticalBlocks) {
+  vector<byte> data(3 * BlockSize);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = (i / BlockSize) & 1;
+
+  for (int f = 0; f < 2; ++f) {
+    string name = rootDir + (f ? "/two" : "/one");
+    ASSERT_LE(0, ::close(::open(name.c_str(), O_CREAT | O_RDWR, 0600)));
+
+    DedupFileIO io(name, index);
+    ASSERT_LE(0, io.open(O_RDWR));
+    for (int i = 0; i < 3; ++i) {
+      vector<byte> block(&data[i * BlockSize], &data[(i + 1) * BlockSize]);
+      IORequest req;
+      req.offset = i * BlockSize;
+      req.data = &block[0];
+      req.dataLen = BlockSize;
+      ASSERT_TRUE(io.write(req));
+    }
+    EXPECT_EQ(3 * BlockSize, io.getSize());
+
+    vector<byte> buf(data.size());
+    IORequest req;
+    req.offset = 0;
+    req.data = &buf[0];
+    req.dataLen = buf.size();
+    ASSERT_EQ((ssize_t)data.size(), io.read(req));
+    EXPECT_TRUE(data == buf);
+  }
+}
+
+TEST_F(DedupIndexTest, CipherCompareWithMemory) {
+  char tmpl[] = "/tmp/encfs-dedup-XXXXXX";
+  int fd = mkstemp(tmpl);
+  ASSERT_LE(0, fd);
+  close(fd);
+
+  shared_ptr<DedupFileIO> raw(new DedupFileIO(tmpl, index));
+  shared_ptr<CipherFileIO> test(new CipherFileIO(raw, cfg));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  shared_ptr<MemFileIO> dup(new MemFileIO(0));
+  comparisonTest(cfg, test.get(), dup.get());
+
+  unlink(tmpl);
+}
+
+}  // namespace
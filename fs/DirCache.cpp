@@ -0,0 +1,222 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/DirCache.h"
+
+#include <glog/logging.h>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+using std::string;
+
+namespace encfs {
+
+static const uint32_t WatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                  IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                  IN_ONLYDIR;
+
+// cache key for a directory: the path without trailing slashes.
+static string dirKey(const string &path) {
+  string::size_type end = path.find_last_not_of('/');
+  if (end == string::npos) return string("/");
+  return path.substr(0, end + 1);
+}
+
+DirCache::DirCache(int maxDirs_, int maxEntries_)
+    : maxDirs(maxDirs_), maxEntries(maxEntries_), entryCount(0), generation(1) {
+  notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  LOG_IF(WARNING, notifyFd < 0) << "inotify unavailable, not caching "
+                                << "directory listings: " << strerror(errno);
+}
+
+DirCache::~DirCache() {
+  // closing the descriptor removes all of the watches.
+  if (notifyFd >= 0) ::close(notifyFd);
+}
+
+bool DirCache::enabled() const { return notifyFd >= 0; }
+
+void DirCache::readEvents() {
+  // aligned for struct inotify_event.
+  uint64_t buf[1024];
+
+  for (;;) {
+    ssize_t len = ::read(notifyFd, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR) continue;
+    if (len <= 0) break;
+
+    const char *pos = (const char *)buf;
+    const char *end = pos + len;
+    while (pos < end) {
+      const struct inotify_event *ev = (const struct inotify_event *)pos;
+      pos += sizeof(struct inotify_event) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        VLOG(1) << "inotify queue overflow, dropping all listings";
+        ++generation;
+        for (DirMap::iterator it = dirs.begin(); it != dirs.end(); ++it)
+          dropListing(it->second);
+        continue;
+      }
+
+      std::map<int, string>::iterator w = watches.find(ev->wd);
+      if (w == watches.end()) continue;
+
+      string key = w->second;
+      ++generation;
+      if (ev->mask & IN_IGNORED) {
+        // the kernel already removed the watch.
+        drop(key, false);
+      } else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        drop(key, true);
+      } else {
+        DirMap::iterator it = dirs.find(key);
+        if (it != dirs.end()) dropListing(it->second);
+      }
+    }
+  }
+}
+
+void DirCache::dropListing(Dir &dir) {
+  if (!dir.listing) return;
+  entryCount -= dir.listing->size();
+  dir.listing.reset();
+}
+
+void DirCache::drop(const string &key, bool unwatch) {
+  DirMap::iterator it = dirs.find(key);
+  if (it == dirs.end()) return;
+
+  if (unwatch) inotify_rm_watch(notifyFd, it->second.wd);
+  watches.erase(it->second.wd);
+  dropListing(it->second);
+  lru.erase(it->second.lruPos);
+  dirs.erase(it);
+}
+
+void DirCache::evict(const string &keep) {
+  while (!lru.empty() &&
+         ((int)dirs.size() > maxDirs || entryCount > maxEntries)) {
+    if (lru.back() == keep) break;
+    drop(lru.back(), true);
+  }
+}
+
+shared_ptr<const DirListing> DirCache::lookup(const string &cipherDir) {
+  if (!enabled()) return shared_ptr<const DirListing>();
+
+  Lock _lock(mutex);
+  readEvents();
+
+  DirMap::iterator it = dirs.find(dirKey(cipherDir));
+  if (it == dirs.end() || !it->second.listing)
+    return shared_ptr<const DirListing>();
+
+  lru.splice(lru.begin(), lru, it->second.lruPos);
+  return it->second.listing;
+}
+
+uint64_t DirCache::begin(const string &cipherDir) {
+  if (!enabled()) return 0;
+
+  string key = dirKey(cipherDir);
+
+  Lock _lock(mutex);
+  readEvents();
+
+  DirMap::iterator it = dirs.find(key);
+  if (it != dirs.end()) {
+    lru.splice(lru.begin(), lru, it->second.lruPos);
+    return generation;
+  }
+
+  int wd = inotify_add_watch(notifyFd, key.c_str(), WatchMask);
+  if (wd < 0) {
+    VLOG(1) << "unable to watch " << key << ": " << strerror(errno);
+    return 0;
+  }
+
+  // the same directory under an old name (after a rename).
+  std::map<int, string>::iterator w = watches.find(wd);
+  if (w != watches.end()) {
+    string oldKey = w->second;
+    drop(oldKey, false);
+  }
+
+  Dir &dir = dirs[key];
+  dir.wd = wd;
+  lru.push_front(key);
+  dir.lruPos = lru.begin();
+  watches[wd] = key;
+
+  evict(key);
+  return generation;
+}
+
+void DirCache::insert(const string &cipherDir,
+                      const shared_ptr<const DirListing> &listing,
+                      uint64_t gen) {
+  if (!enabled() || listing->size() > maxEntries) return;
+
+  Lock _lock(mutex);
+  readEvents();
+
+  // something changed while the caller was reading the directory.
+  if (gen != generation) return;
+
+  DirMap::iterator it = dirs.find(dirKey(cipherDir));
+  if (it == dirs.end()) return;
+
+  dropListing(it->second);
+  it->second.listing = listing;
+  entryCount += listing->size();
+  lru.splice(lru.begin(), lru, it->second.lruPos);
+
+  evict(it->first);
+}
+
+void DirCache::invalidate(const string &cipherDir) {
+  Lock _lock(mutex);
+  ++generation;
+
+  DirMap::iterator it = dirs.find(dirKey(cipherDir));
+  if (it != dirs.end()) dropListing(it->second);
+}
+
+void DirCache::invalidateParent(const string &cipherPath) {
+  string path = dirKey(cipherPath);
+  string::size_type pos = path.rfind('/');
+  if (pos == string::npos) return;
+
+  invalidate(pos == 0 ? string("/") : path.substr(0, pos));
+}
+
+void DirCache::clear() {
+  Lock _lock(mutex);
+  ++generation;
+
+  for (DirMap::iterator it = dirs.begin(); it != dirs.end(); ++it)
+    dropListing(it->second);
+}
+
+}  // namespace encfs
@@ -0,0 +1,114 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DirCache_incl_
+#define _DirCache_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace encfs {
+
+struct DirEntry {
+  std::string plainName;
+  std::string cipherName;
+  int fileType;  // d_type, or 0 if unknown
+  ino_t inode;
+};
+
+typedef std::vector<DirEntry> DirListing;
+
+/*
+    Cache of decoded directory listings, keyed by backing (cipher) directory.
+
+    Every cached directory has an inotify watch on it, so that changes made
+    to the backing directory by anyone (including other processes working on
+    the raw files) drop the listing.  Events are read without blocking before
+    each lookup, and since the kernel queues them before the changing system
+    call returns, a lookup never sees a listing older then a finished change.
+    Our own changes are also invalidated explicitly.
+
+    A listing is built in three steps: begin() sets up the watch and returns a
+    generation, the caller reads the directory, and insert() stores the result
+    only if nothing was invalidated in the meantime.
+
+    The cache holds at most maxDirs directories and maxEntries names in total,
+    least recently used directories are dropped first.  If inotify isn't
+    available, nothing is cached.
+*/
+class DirCache {
+ public:
+  DirCache(int maxDirs, int maxEntries);
+  ~DirCache();
+
+  bool enabled() const;
+
+  // Returns the cached listing of the directory, or an empty pointer.
+  shared_ptr<const DirListing> lookup(const std::string &cipherDir);
+
+  // Starts watching the directory.  Returns the generation to pass to
+  // insert(), or 0 if the directory can't be cached.
+  uint64_t begin(const std::string &cipherDir);
+  void insert(const std::string &cipherDir,
+              const shared_ptr<const DirListing> &listing, uint64_t gen);
+
+  void invalidate(const std::string &cipherDir);
+  // invalidates the directory containing cipherPath.
+  void invalidateParent(const std::string &cipherPath);
+  void clear();
+
+ private:
+  struct Dir {
+    int wd;
+    shared_ptr<const DirListing> listing;
+    std::list<std::string>::iterator lruPos;
+  };
+  typedef std::map<std::string, Dir> DirMap;
+
+  void readEvents();
+  void drop(const std::string &key, bool unwatch);
+  void dropListing(Dir &dir);
+  void evict(const std::string &keep);
+
+  int maxDirs;
+  size_t maxEntries;
+
+  Mutex mutex;
+  int notifyFd;
+  DirMap dirs;
+  std::map<int, std::string> watches;  // inotify wd -> key in dirs
+  std::list<std::string> lru;          // most recently used first
+  size_t entryCount;
+  uint64_t generation;
+
+  DirCache(const DirCache &);
+  DirCache &operator=(const DirCache &);
+};
+
+}  // namespace encfs
+
+#endif
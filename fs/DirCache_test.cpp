@@ -0,0 +1,135 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+
+#include "fs/DirCache.h"
+
+using namespace encfs;
+using std::string;
+
+namespace {
+
+class DirCacheTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-dircache-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+    ASSERT_EQ(0, mkdir(path("sub").c_str(), 0700));
+  }
+
+  virtual void TearDown() {
+    unlink(path("sub/file").c_str());
+    rmdir(path("sub").c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  string path(const string &name) const { return rootDir + "/" + name; }
+
+  shared_ptr<const DirListing> listing(int entries) {
+    shared_ptr<DirListing> result(new DirListing(entries));
+    return result;
+  }
+
+  bool fill(DirCache *cache, const string &dir, int entries = 1) {
+    uint64_t gen = cache->begin(dir);
+    if (gen == 0) return false;
+    cache->insert(dir, listing(entries), gen);
+    return cache->lookup(dir).get() != NULL;
+  }
+
+  string rootDir;
+};
+
+TEST_F(DirCacheTest, ExternalChangesInvalidate) {
+  DirCache cache(16, 100);
+  if (!cache.enabled()) return;
+
+  ASSERT_TRUE(fill(&cache, path("sub")));
+  // trailing slashes don't matter.
+  EXPECT_TRUE(cache.lookup(path("sub/")).get() != NULL);
+
+  int fd = ::open(path("sub/file").c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_LE(0, fd);
+  ::close(fd);
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+
+  ASSERT_TRUE(fill(&cache, path("sub")));
+  ASSERT_EQ(0, unlink(path("sub/file").c_str()));
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+
+  ASSERT_TRUE(fill(&cache, path("sub")));
+  ASSERT_EQ(0, rmdir(path("sub").c_str()));
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+}
+
+TEST_F(DirCacheTest, RacingChangeIsNotCached) {
+  DirCache cache(16, 100);
+  if (!cache.enabled()) return;
+
+  uint64_t gen = cache.begin(path("sub"));
+  ASSERT_NE(0u, gen);
+
+  int fd = ::open(path("sub/file").c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_LE(0, fd);
+  ::close(fd);
+
+  cache.insert(path("sub"), listing(1), gen);
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+}
+
+TEST_F(DirCacheTest, ExplicitInvalidation) {
+  DirCache cache(16, 100);
+  if (!cache.enabled()) return;
+
+  ASSERT_TRUE(fill(&cache, path("sub")));
+  cache.invalidateParent(path("sub/file"));
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+
+  ASSERT_TRUE(fill(&cache, path("sub")));
+  ASSERT_TRUE(fill(&cache, rootDir));
+  cache.invalidateParent(path("sub"));
+  EXPECT_TRUE(cache.lookup(path("sub")).get() != NULL);
+  EXPECT_TRUE(cache.lookup(rootDir).get() == NULL);
+
+  cache.clear();
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+}
+
+TEST_F(DirCacheTest, Limits) {
+  DirCache cache(1, 10);
+  if (!cache.enabled()) return;
+
+  ASSERT_TRUE(fill(&cache, path("sub")));
+  ASSERT_TRUE(fill(&cache, rootDir));
+  EXPECT_TRUE(cache.lookup(path("sub")).get() == NULL);
+
+  EXPECT_FALSE(fill(&cache, path("sub"), 11));
+  EXPECT_TRUE(fill(&cache, path("sub"), 10));
+}
+
+}  // namespace
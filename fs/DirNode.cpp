@@ -25,6 +25,7 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <fcntl.h>
 #include <unistd.h>
 #ifdef linux
 #include <sys/fsuid.h>
@@ -34,9 +35,16 @@
 
 #include "base/Error.h"
 #include "base/Mutex.h"
+#include "fs/AttrCache.h"
+#include "fs/FilePrefetch.h"
+#include "fs/CipherFileIO.h"
 #include "fs/Context.h"
 #include "fs/DirNode.h"
+#include "fs/DirShards.h"
 #include "fs/FileUtils.h"
+#include "fs/MACFileIO.h"
+#include "fs/PackStore.h"
+#include "fs/PlainDigest.h"
 #include "fs/fsconfig.pb.h"
 
 #include <glog/logging.h>
@@ -45,9 +53,29 @@
 
 using std::list;
 using std::string;
+using std::vector;
 
 namespace encfs {
 
+// How long stat-ahead results are kept (msec), and how many at most.
+static const int StatAheadTTL = 1000;
+static const int StatAheadEntries = 16384;
+
+// Directory order prefetch: listings remembered, maximum files ahead of the
+// reader, and bytes read ahead from the start of each.
+static const int PrefetchListings = 16;
+static const int PrefetchWindow = 32;
+static const off_t PrefetchBytes = 128 * 1024;
+
+// Most directories, and names in all directories, to keep decoded listings
+// for.
+static const int DirCacheDirs = 256;
+static const int DirCacheEntries = 65536;
+
+// Directories with more entries then this are sharded, if the volume allows
+// it.
+static const size_t DirShardThreshold = 32768;
+
 class DirDeleter {
  public:
   void operator()(DIR *d) const { ::closedir(d); }
@@ -55,15 +83,52 @@ class DirDeleter {
 
 DirTraverse::DirTraverse(const shared_ptr<DIR> &_dirPtr, uint64_t _iv,
                          const shared_ptr<NameIO> &_naming)
-    : dir(_dirPtr), iv(_iv), naming(_naming) {}
+    : dir(_dirPtr),
+      iv(_iv),
+      naming(_naming),
+      nextShard(0),
+      nextPacked(0),
+      packsListed(false) {}
+
+DirTraverse::DirTraverse(const shared_ptr<DIR> &_dirPtr, uint64_t _iv,
+                         const shared_ptr<NameIO> &_naming,
+                         const string &_dirPath, const vector<string> &_shards,
+                         const shared_ptr<PackStore> &_packs)
+    : dir(_dirPtr),
+      iv(_iv),
+      naming(_naming),
+      dirPath(_dirPath),
+      shards(_shards),
+      nextShard(0),
+      packs(_packs),
+      nextPacked(0),
+      packsListed(false) {}
 
 DirTraverse::DirTraverse(const DirTraverse &src)
-    : dir(src.dir), iv(src.iv), naming(src.naming) {}
+    : dir(src.dir),
+      iv(src.iv),
+      naming(src.naming),
+      dirPath(src.dirPath),
+      shards(src.shards),
+      nextShard(src.nextShard),
+      shardPrefix(src.shardPrefix),
+      packs(src.packs),
+      packNames(src.packNames),
+      nextPacked(src.nextPacked),
+      packsListed(src.packsListed) {}
 
 DirTraverse &DirTraverse::operator=(const DirTraverse &src) {
   dir = src.dir;
   iv = src.iv;
   naming = src.naming;
+  dirPath = src.dirPath;
+  shards = src.shards;
+  nextShard = src.nextShard;
+  shardPrefix = src.shardPrefix;
+  packs = src.packs;
+  packNames = src.packNames;
+  nextPacked = src.nextPacked;
+  packsListed = src.packsListed;
 
   return *this;
 }
@@ -95,16 +160,61 @@ static bool _nextName(struct dirent *&de, const shared_ptr<DIR> &dir,
   }
 }
 
-std::string DirTraverse::nextPlaintextName(int *fileType, ino_t *inode) {
+bool DirTraverse::nextEntry(string &name, int *fileType, ino_t *inode) {
   struct dirent *de = 0;
-  while (_nextName(de, dir, fileType, inode)) {
+  for (;;) {
+    if (nextPacked < packNames.size()) {
+      name = packNames[nextPacked++];
+      if (fileType) *fileType = DT_REG;
+      if (inode) *inode = 0;
+      return true;
+    }
+
+    if (_nextName(de, dir, fileType, inode)) {
+      // only the top level directory has "." and "..", and the shards.
+      bool hidden;
+      if (!shardPrefix.empty())
+        hidden = de->d_name[0] == '.';
+      else
+        hidden = (!shards.empty() && DirShards::IsReserved(de->d_name)) ||
+                 (packs && PackStore::IsReserved(de->d_name));
+
+      if (!hidden) {
+        name = de->d_name;
+        return true;
+      }
+      continue;
+    }
+
+    if (packs && !packsListed) {
+      packsListed = true;
+      packNames = packs->names(dirPath + '/' + shardPrefix);
+      nextPacked = 0;
+      continue;
+    }
+
+    if (nextShard >= shards.size()) return false;
+
+    shardPrefix = shards[nextShard++] + '/';
+    packsListed = false;
+    DIR *shardDir = ::opendir((dirPath + '/' + shardPrefix).c_str());
+    if (shardDir != NULL) dir.reset(shardDir, DirDeleter());
+  }
+}
+
+std::string DirTraverse::nextPlaintextName(int *fileType, ino_t *inode,
+                                           std::string *cipherName) {
+  string name;
+  while (nextEntry(name, fileType, inode)) {
     try {
       uint64_t localIv = iv;
-      return naming->decodePath(de->d_name, &localIv);
+      string plainName = naming->decodePath(name.c_str(), &localIv);
+      if (cipherName) cipherName->assign(shardPrefix + name);
+      return plainName;
     }
     catch (Error &ex) {
       // .. .problem decoding, ignore it and continue on to next name..
-      VLOG(1) << "error decoding filename " << de->d_name << " : " << ex.what();
+      VLOG(1) << "error decoding filename " << name << " : " << ex.what();
     }
   }
 
@@ -112,16 +222,16 @@ std::string DirTraverse::nextPlaintextName(int *fileType, ino_t *inode) {
 }
 
 std::string DirTraverse::nextInvalid() {
-  struct dirent *de = 0;
+  string name;
   // find the first name which produces a decoding error...
-  while (_nextName(de, dir, (int *)0, (ino_t *)0)) {
+  while (nextEntry(name, (int *)0, (ino_t *)0)) {
     try {
       uint64_t localIv = iv;
-      naming->decodePath(de->d_name, &localIv);
+      naming->decodePath(name.c_str(), &localIv);
       continue;
     }
     catch (Error &ex) {
-      return string(de->d_name);
+      return shardPrefix + name;
     }
   }
 
@@ -260,6 +370,23 @@ DirNode::DirNode(EncFS_Context *_ctx, const string &sourceDir,
   if (rootDir[rootDir.length() - 1] != '/') rootDir.append(1, '/');
 
   naming = fsConfig->nameCoding;
+
+  // other hosts can change a shared volume at any time.
+  if (!fsConfig->leases) {
+    attrCache.reset(new AttrCache(StatAheadTTL, StatAheadEntries, 2));
+
+    dirCache.reset(new DirCache(DirCacheDirs, DirCacheEntries));
+    if (!dirCache->enabled()) dirCache.reset();
+  }
+
+  prefetch.reset(
+      new FilePrefetch(PrefetchListings, PrefetchWindow, PrefetchBytes, 2));
+
+  if (fsConfig->config->sharded_dirs() && !fsConfig->reverseEncryption)
+    shards.reset(new DirShards(fsConfig->cipher, bool(fsConfig->leases)));
+
+  if (fsConfig->config->packed_files() && !fsConfig->reverseEncryption)
+    packs.reset(new PackStore());
 }
 
 DirNode::~DirNode() {}
@@ -268,6 +395,8 @@ bool DirNode::hasDirectoryNameDependency() const {
   return naming ? naming->getChainedNameIV() : false;
 }
 
+const FSConfigPtr &DirNode::config() const { return fsConfig; }
+
 string DirNode::rootDirectory() const {
   // don't update last access here, otherwise 'du' would cause lastAccess to
   // be reset.
@@ -279,7 +408,12 @@ string DirNode::cipherPath(const char *plaintextPath) {
   if (plaintextPath[0] == '/') {
     ++plaintextPath;
   }
-  return rootDir + naming->encodePath(plaintextPath);
+  return backingPath(naming->encodePath(plaintextPath));
+}
+
+string DirNode::backingPath(const string &relativePath) {
+  if (shards) return shards->resolve(rootDir, relativePath);
+  return rootDir + relativePath;
 }
 
 string DirNode::cipherPathWithoutRoot(const char *plaintextPath) {
@@ -287,6 +421,12 @@ string DirNode::cipherPathWithoutRoot(const char *plaintextPath) {
 }
 
 string DirNode::plainPath(const char *cipherPath_) {
+  string stripped;
+  if (shards) {
+    stripped = DirShards::strip(cipherPath_);
+    cipherPath_ = stripped.c_str();
+  }
+
   try {
     if (!strncmp(cipherPath_, rootDir.c_str(), rootDir.length())) {
       return naming->decodePath(cipherPath_ + rootDir.length());
@@ -330,6 +470,11 @@ DirTraverse DirNode::openDir(const char *plaintextPath) {
     catch (Error &err) {
       LOG(ERROR) << "encode err: " << err.what();
     }
+
+    vector<string> shardNames;
+    if (shards) shardNames = shards->shardNames(cyName);
+    if (!shardNames.empty() || packs)
+      return DirTraverse(dp, iv, naming, cyName, shardNames, packs);
     return DirTraverse(dp, iv, naming);
   }
 }
@@ -343,47 +488,35 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
   string toCPart = naming->encodePath(toP, &toIV);
 
   // where the files live before the rename..
-  string sourcePath = rootDir + fromCPart;
+  string sourcePath = cipherPath(fromP);
 
   // ok..... we wish it was so simple.. should almost never happen
   if (fromIV == toIV) return true;
 
   // generate the real destination path, where we expect to find the files..
   VLOG(1) << "opendir " << sourcePath;
-  shared_ptr<DIR> dir =
-      shared_ptr<DIR>(opendir(sourcePath.c_str()), DirDeleter());
-  if (!dir) return false;
-
-  struct dirent *de = NULL;
-  while ((de = ::readdir(dir.get())) != NULL) {
-    // decode the name using the oldIV
-    uint64_t localIV = fromIV;
-    string plainName;
-
-    if ((de->d_name[0] == '.') &&
-        ((de->d_name[1] == '\0') ||
-         ((de->d_name[1] == '.') && (de->d_name[2] == '\0')))) {
-      // skip "." and ".."
-      continue;
-    }
-
-    try {
-      plainName = naming->decodePath(de->d_name, &localIV);
-    }
-    catch (Error &ex) {
-      // if filename can't be decoded, then ignore it..
-      continue;
-    }
+  // decodes names using the old IV, and skips those which can't be decoded.
+  DirTraverse dt = openDir(fromP);
+  if (!dt.valid()) return false;
+
+  int fileType = 0;
+  string cipherName;
+  string plainName;
+  while (!(plainName = dt.nextPlaintextName(&fileType, 0, &cipherName))
+              .empty()) {
+    // skip "." and ".."
+    if (plainName == "." || plainName == "..") continue;
 
     // any error in the following will trigger a rename failure.
     try {
       // re-encode using the new IV..
-      localIV = toIV;
+      uint64_t localIV = toIV;
       string newName = naming->encodePath(plainName.c_str(), &localIV);
 
       // store rename information..
-      string oldFull = sourcePath + '/' + de->d_name;
-      string newFull = sourcePath + '/' + newName;
+      string oldFull = sourcePath + '/' + cipherName;
+      string newFull = shards ? shards->entryPath(sourcePath, newName)
+                              : sourcePath + '/' + newName;
 
       RenameEl ren;
       ren.oldCName = oldFull;
@@ -393,8 +526,8 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
 
       bool isDir;
 #if defined(_DIRENT_HAVE_D_TYPE)
-      if (de->d_type != DT_UNKNOWN) {
-        isDir = (de->d_type == DT_DIR);
+      if (fileType != DT_UNKNOWN) {
+        isDir = (fileType == DT_DIR);
       } else
 #endif
       {
@@ -403,6 +536,9 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
 
       ren.isDirectory = isDir;
 
+      // the encryption of a packed file can't change in place.
+      if (!isDir && packs && unpack(ren.oldPName.c_str()) < 0) return false;
+
       if (isDir) {
         // recurse..  We want to add subdirectory elements before the
         // parent, as that is the logical rename order..
@@ -419,7 +555,7 @@ bool DirNode::genRenameList(list<RenameEl> &renameList, const char *fromP,
       // We can't convert this name, because we don't have a valid IV for
       // it (or perhaps a valid key).. It will be inaccessible..
       LOG(WARNING) << "Aborting rename: error on file "
-                   << fromCPart.append(1, '/').append(de->d_name) << ":"
+                   << fromCPart.append(1, '/').append(cipherName) << ":"
                    << err.what();
 
       // abort.. Err on the side of safety and disallow rename, rather
@@ -476,6 +612,25 @@ int DirNode::mkdir(const char *plaintextPath, mode_t mode, uid_t uid,
   } else
     res = 0;
 
+  nameChanged(cyName);
+  return res;
+}
+
+int DirNode::rmdir(const char *plaintextPath) {
+  string cyName = cipherPath(plaintextPath);
+  rAssert(!cyName.empty());
+
+  VLOG(1) << "rmdir on " << cyName;
+
+  int res = 0;
+  if (shards)
+    res = shards->removeDir(cyName);
+  else if (::rmdir(cyName.c_str()) != 0)
+    res = -errno;
+
+  LOG_IF(INFO, res != 0) << "rmdir error: " << strerror(-res);
+
+  nameChanged(cyName);
   return res;
 }
 
@@ -489,6 +644,11 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
 
   VLOG(1) << "rename " << fromCName << " -> " << toCName;
 
+  if (packs) {
+    int res = unpack(fromPlaintext);
+    if (res < 0) return res;
+  }
+
   shared_ptr<FileNode> toNode = findOrCreate(toPlaintext);
 
   shared_ptr<RenameOp> renameOp;
@@ -511,6 +671,7 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
     bool preserve_mtime = ::stat(fromCName.c_str(), &st) == 0;
 
     renameNode(fromPlaintext, toPlaintext);
+    inodeChanged(toCName);
     res = ::rename(fromCName.c_str(), toCName.c_str());
 
     if (res == -1) {
@@ -519,11 +680,15 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
       renameNode(toPlaintext, fromPlaintext, false);
 
       if (renameOp) renameOp->undo();
-    } else if (preserve_mtime) {
-      struct utimbuf ut;
-      ut.actime = st.st_atime;
-      ut.modtime = st.st_mtime;
-      ::utime(toCName.c_str(), &ut);
+    } else {
+      // the file replaced any packed copy of the target.
+      if (packs) packs->remove(toCName);
+      if (preserve_mtime) {
+        struct utimbuf ut;
+        ut.actime = st.st_atime;
+        ut.modtime = st.st_mtime;
+        ::utime(toCName.c_str(), &ut);
+      }
     }
   }
   catch (Error &err) {
@@ -532,6 +697,11 @@ int DirNode::rename(const char *fromPlaintext, const char *toPlaintext) {
     res = -EIO;
   }
 
+  // names below a renamed directory move too.
+  if (attrCache) attrCache->clear();
+  if (dirCache) dirCache->clear();
+  if (shards) shards->clear();
+
   if (res != 0) {
     VLOG(1) << "rename failed: " << strerror(errno);
     res = -errno;
@@ -554,12 +724,18 @@ int DirNode::link(const char *from, const char *to) {
   int res = -EPERM;
   if (fsConfig->config->external_iv()) {
     VLOG(1) << "hard links not supported with external IV chaining!";
+  } else if (packs && (res = unpack(from)) < 0) {
+    VLOG(1) << "unable to unpack link source: " << strerror(-res);
   } else {
     res = ::link(fromCName.c_str(), toCName.c_str());
-    if (res == -1)
+    if (res == -1) {
       res = -errno;
-    else
+    } else {
       res = 0;
+      if (packs) packs->remove(toCName);
+    }
+    attrChanged(fromCName);  // link count
+    nameChanged(toCName);
   }
 
   return res;
@@ -579,7 +755,8 @@ shared_ptr<FileNode> DirNode::renameNode(const char *from, const char *to,
 
   if (node) {
     uint64_t newIV = 0;
-    string cname = rootDir + naming->encodePath(to, &newIV);
+    const char *toRel = (to[0] == '/') ? to + 1 : to;
+    string cname = backingPath(naming->encodePath(toRel, &newIV));
 
     VLOG(1) << "renaming internal node " << node->cipherName() << " -> "
             << cname.c_str();
@@ -607,7 +784,7 @@ shared_ptr<FileNode> DirNode::findOrCreate(const char *plainName) {
     }
     string cipherName = naming->encodePath(plainName, &iv);
     node.reset(new FileNode(this, fsConfig, plainName,
-                            (rootDir + cipherName).c_str()));
+                            backingPath(cipherName).c_str()));
 
     if (fsConfig->config->external_iv()) node->setName(0, 0, iv);
 
@@ -627,6 +804,128 @@ shared_ptr<FileNode> DirNode::lookupNode(const char *plainName,
   return node;
 }
 
+void DirNode::statAhead(const char *plainDirName,
+                        const vector<string> &cipherNames) {
+  if (cipherNames.empty()) return;
+
+  string cyName = cipherPath(plainDirName);
+  prefetch->listed(cyName, cipherNames);
+  if (!attrCache) return;
+
+  int fd = ::open(cyName.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return;
+
+  attrCache->statAhead(fd, cyName, cipherNames);
+}
+
+void DirNode::attrChanged(const string &cipherPath) {
+  if (attrCache) attrCache->invalidate(cipherPath);
+}
+
+void DirNode::inodeChanged(const string &cipherPath) {
+  if (!fsConfig->digests) return;
+
+  // the tracked changes describe the file which had the inode before.
+  struct stat st;
+  if (::lstat(cipherPath.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    fsConfig->digests->changed(st.st_ino, 0);
+}
+
+void DirNode::nameChanged(const string &cipherPath) {
+  attrChanged(cipherPath);
+  if (dirCache) dirCache->invalidateParent(cipherPath);
+  if (shards) shards->forget(cipherPath);
+}
+
+shared_ptr<const DirListing> DirNode::listDir(const char *plaintextPath) {
+  string cyName = cipherPath(plaintextPath);
+
+  // shards can't be watched cheaply, and are too large to keep anyway.
+  bool sharded = shards && shards->isSharded(cyName);
+
+  uint64_t gen = 0;
+  if (dirCache && !sharded) {
+    shared_ptr<const DirListing> cached = dirCache->lookup(cyName);
+    if (cached) {
+      VLOG(2) << "listing cache hit for " << cyName;
+      return cached;
+    }
+
+    gen = dirCache->begin(cyName);
+  }
+
+  DirTraverse dt = openDir(plaintextPath);
+  if (!dt.valid()) return shared_ptr<const DirListing>();
+
+  shared_ptr<DirListing> listing(new DirListing);
+  DirEntry entry;
+  entry.plainName =
+      dt.nextPlaintextName(&entry.fileType, &entry.inode, &entry.cipherName);
+  while (!entry.plainName.empty()) {
+    listing->push_back(entry);
+    entry.plainName =
+        dt.nextPlaintextName(&entry.fileType, &entry.inode, &entry.cipherName);
+  }
+
+  // packed names have to stay where the pack is.
+  if (shards && ((!sharded && listing->size() > DirShardThreshold) ||
+                 shards->isMigrating(cyName)) &&
+      !(packs && packs->hasPack(cyName))) {
+    Lock _lock(mutex);
+    // open files keep the backing path they were opened with, so wait
+    // until they are closed.
+    if (ctx && ctx->hasOpenFiles(plaintextPath)) {
+      VLOG(1) << "open files, not sharding " << cyName << " yet";
+    } else {
+      int res = shards->migrate(cyName);
+      LOG_IF(WARNING, res != 0) << "unable to shard " << cyName << ": "
+                                << strerror(-res);
+      // the listing still has the old locations.
+      return listing;
+    }
+  }
+
+  if (gen) dirCache->insert(cyName, listing, gen);
+  return listing;
+}
+
+int DirNode::getAttr(const char *plainName, struct stat *stbuf,
+                     string *cipherName) {
+  shared_ptr<FileNode> node;
+  {
+    Lock _lock(mutex);
+    if (ctx) node = ctx->lookupNode(plainName);
+  }
+
+  // An open file may know more then the backing file does.
+  if (node) {
+    *cipherName = node->cipherName();
+    return node->getAttr(stbuf);
+  }
+
+  *cipherName = cipherPath(plainName);
+  if (attrCache && attrCache->take(*cipherName, stbuf)) {
+    VLOG(2) << "stat-ahead hit for " << *cipherName;
+  } else if (::lstat(cipherName->c_str(), stbuf) != 0) {
+    int eno = errno;
+    if (eno != ENOENT || !packs || packs->stat(*cipherName, stbuf) != 0) {
+      LOG(INFO) << "getAttr error on " << *cipherName << ": "
+                << strerror(eno);
+      return -eno;
+    }
+  }
+
+  // same adjustments as the FileIO stack which FileNode would build.
+  if (S_ISREG(stbuf->st_mode)) {
+    stbuf->st_size = CipherFileIO::AdjustedSize(fsConfig, stbuf->st_size);
+    if (fsConfig->config->block_mac_bytes() ||
+        fsConfig->config->block_mac_rand_bytes())
+      stbuf->st_size = MACFileIO::AdjustedSize(fsConfig, stbuf->st_size);
+  }
+
+  return 0;
+}
+
 /*
     Similar to lookupNode, except that we also call open() and only return a
     node on sucess..  This is done in one step to avoid any race conditions
@@ -641,12 +940,68 @@ shared_ptr<FileNode> DirNode::openNode(const char *plainName,
 
   shared_ptr<FileNode> node = findOrCreate(plainName);
 
-  if (node && (*result = node->open(flags)) >= 0)
+  if (node) {
+    *result = node->open(flags);
+    if (packs && (*result == -ENOENT || *result == -EROFS))
+      *result = openPacked(node, flags, *result);
+  }
+
+  if (node && *result >= 0) {
+    prefetch->opened(node->cipherName());
     return node;
-  else
+  } else
     return shared_ptr<FileNode>();
 }
 
+int DirNode::openPacked(const shared_ptr<FileNode> &node, int flags,
+                        int result) {
+  string cyName = node->cipherName();
+
+  if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC)) {
+    // writers get a standalone file.
+    int res = packs->promote(cyName);
+    if (res < 0) return res;
+    if (res > 0) inodeChanged(cyName);
+    if (res == 0 && !node->isPacked()) return result;
+
+    if (node->isPacked()) node->usePack(shared_ptr<FileIO>());
+    attrChanged(cyName);
+  } else {
+    shared_ptr<FileIO> packIO = packs->open(cyName);
+    if (!packIO) return result;
+
+    VLOG(1) << "reading " << cyName << " from its pack";
+    node->usePack(packIO);
+  }
+
+  return node->open(flags);
+}
+
+int DirNode::unpack(const char *plaintextPath) {
+  if (!packs) return 0;
+
+  string cyName = cipherPath(plaintextPath);
+  int res = packs->promote(cyName);
+  if (res < 0) return res;
+  if (res > 0) inodeChanged(cyName);
+
+  // an open node keeps reading from the pack until it is switched over.
+  shared_ptr<FileNode> node;
+  if (ctx) node = ctx->lookupNode(plaintextPath);
+  if (node && node->isPacked()) {
+    node->usePack(shared_ptr<FileIO>());
+    res = 1;
+  }
+
+  if (res > 0) attrChanged(cyName);
+  return res;
+}
+
+bool DirNode::isPacked(const char *plaintextPath) {
+  struct stat st;
+  return packs && packs->stat(cipherPath(plaintextPath), &st) == 0;
+}
+
 int DirNode::unlink(const char *plaintextName) {
   string cyName = cipherPath(plaintextName);
   VLOG(1) << "unlink " << cyName;
@@ -662,11 +1017,14 @@ int DirNode::unlink(const char *plaintextName) {
                  << ", hard_remove option is probably in effect";
     res = -EBUSY;
   } else {
+    inodeChanged(cyName);
     res = ::unlink(cyName.c_str());
     if (res == -1) {
       res = -errno;
-      VLOG(1) << "unlink error: " << strerror(errno);
+      if (res == -ENOENT && packs) res = packs->remove(cyName);
+      if (res != 0) VLOG(1) << "unlink error: " << strerror(-res);
     }
+    nameChanged(cyName);
   }
 
   return res;
@@ -33,6 +33,7 @@
 #include "base/Mutex.h"
 #include "base/shared_ptr.h"
 #include "cipher/CipherKey.h"
+#include "fs/DirCache.h"
 #include "fs/FileNode.h"
 #include "fs/NameIO.h"
 #include "fs/FSConfig.h"
@@ -43,11 +44,19 @@ class Cipher;
 class RenameOp;
 struct RenameEl;
 class EncFS_Context;
+class PackStore;
 
 class DirTraverse {
  public:
   DirTraverse(const shared_ptr<DIR> &dirPtr, uint64_t iv,
               const shared_ptr<NameIO> &naming);
+  // Traversal of a sharded directory: after dirPtr, which is the directory
+  // dirPath, each of its shard subdirectories is read.  If packs is set, the
+  // files packed in each directory follow the directory's own entries.
+  DirTraverse(const shared_ptr<DIR> &dirPtr, uint64_t iv,
+              const shared_ptr<NameIO> &naming, const std::string &dirPath,
+              const std::vector<std::string> &shards,
+              const shared_ptr<PackStore> &packs);
   DirTraverse(const DirTraverse &src);
   ~DirTraverse();
 
@@ -59,8 +68,10 @@ class DirTraverse {
 
   // return next plaintext filename
   // If fileType is not 0, then it is used to return the filetype (or 0 if
-  // unknown)
-  std::string nextPlaintextName(int *fileType = 0, ino_t *inode = 0);
+  // unknown).  If cipherName is not 0, it is set to the encrypted name,
+  // including the shard subdirectory it was found in.
+  std::string nextPlaintextName(int *fileType = 0, ino_t *inode = 0,
+                                std::string *cipherName = 0);
 
   /* Return cipher name of next undecodable filename..
      The opposite of nextPlaintextName(), as that skips undecodable names..
@@ -68,14 +79,32 @@ class DirTraverse {
   std::string nextInvalid();
 
  private:
+  bool nextEntry(std::string &name, int *fileType, ino_t *inode);
+
   shared_ptr<DIR> dir;  // struct DIR
   // initialization vector to use.  Not very general purpose, but makes it
   // more efficient to support filename IV chaining..
   uint64_t iv;
   shared_ptr<NameIO> naming;
+
+  // shards still to be read, and the one being read.
+  std::string dirPath;
+  std::vector<std::string> shards;
+  size_t nextShard;
+  std::string shardPrefix;
+
+  // packed files of the directory being read, once its entries are done.
+  shared_ptr<PackStore> packs;
+  std::vector<std::string> packNames;
+  size_t nextPacked;
+  bool packsListed;
 };
 inline bool DirTraverse::valid() const { return dir != 0; }
 
+class AttrCache;
+class FilePrefetch;
+class DirShards;
+
 class DirNode {
  public:
   // sourceDir points to where raw files are stored
@@ -86,6 +115,9 @@ class DirNode {
   // return the path to the root directory
   std::string rootDirectory() const;
 
+  // filesystem state shared by all nodes
+  const FSConfigPtr &config() const;
+
   // find files
   shared_ptr<FileNode> lookupNode(const char *plaintextName,
                                   const char *requestor);
@@ -98,6 +130,32 @@ class DirNode {
                                 const char *requestor, int flags,
                                 int *openResult);
 
+  /*
+      Attributes of a file, without creating a FileNode for it unless it is
+      already open.  Sets cipherName to the encrypted path.  Returns 0 on
+      success, -errno on failure.
+  */
+  int getAttr(const char *plaintextName, struct stat *stbuf,
+              std::string *cipherName);
+
+  /*
+      Stat-ahead: after a directory listing, stat the listed entries in the
+      background so that the getattr calls which usually follow are answered
+      from memory.  cipherNames are the encrypted names which were listed.
+      The order is also kept, to prefetch files opened in that order.
+  */
+  void statAhead(const char *plainDirName,
+                 const std::vector<std::string> &cipherNames);
+
+  // Must be called after anything changes a file (or directory) by path.
+  void attrChanged(const std::string &cipherPath);
+  // Must be called after a name is added to or removed from a directory.
+  void nameChanged(const std::string &cipherPath);
+  // Must be called before the backing file at cipherPath is removed, and
+  // after it is created other than by FileNode::mknod, since a new file may
+  // reuse the inode of one which is gone.
+  void inodeChanged(const std::string &cipherPath);
+
   std::string cipherPath(const char *plaintextPath);
   std::string cipherPathWithoutRoot(const char *plaintextPath);
   std::string plainPath(const char *cipherPath);
@@ -120,9 +178,14 @@ class DirNode {
   // traverse directory
   DirTraverse openDir(const char *plainDirName);
 
+  // Returns the decoded listing of a directory, from the listing cache if
+  // possible.  Returns an empty pointer if the directory can't be read.
+  shared_ptr<const DirListing> listDir(const char *plainDirName);
+
   // uid and gid are used as the directory owner, only if not zero
   int mkdir(const char *plaintextPath, mode_t mode, uid_t uid = 0,
             gid_t gid = 0);
+  int rmdir(const char *plaintextPath);
 
   int rename(const char *fromPlaintext, const char *toPlaintext);
 
@@ -131,7 +194,18 @@ class DirNode {
   // returns idle time of filesystem in seconds
   int idleSeconds();
 
+  /*
+      Moves a packed file (see PackStore) out to a standalone backing file,
+      before anything changes it.  Returns 1 if the file was packed, 0 if it
+      wasn't, or -errno.
+  */
+  int unpack(const char *plaintextPath);
+  bool isPacked(const char *plaintextPath);
+
  protected:
+  // backing path of an encoded path relative to the root.
+  std::string backingPath(const std::string &relativePath);
+
   /*
       notify that a file is being renamed.
       This renames the internal node, if any.  If the file is not open, then
@@ -158,6 +232,9 @@ class DirNode {
 
   shared_ptr<FileNode> findOrCreate(const char *plainName);
 
+  // open of a node whose backing file wasn't found, or was read-only.
+  int openPacked(const shared_ptr<FileNode> &node, int flags, int result);
+
   Mutex mutex;
 
   EncFS_Context *ctx;
@@ -167,6 +244,12 @@ class DirNode {
   FSConfigPtr fsConfig;
 
   shared_ptr<NameIO> naming;
+
+  shared_ptr<AttrCache> attrCache;
+  shared_ptr<FilePrefetch> prefetch;
+  shared_ptr<DirCache> dirCache;
+  shared_ptr<DirShards> shards;
+  shared_ptr<PackStore> packs;
 };
 
 }  // namespace encfs
@@ -0,0 +1,317 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/DirShards.h"
+
+#include "cipher/CipherV1.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+using std::string;
+using std::vector;
+
+namespace encfs {
+
+const char *DirShards::MarkerName = ".encfs-shards";
+
+// contents of the marker once all entries are in their shards.
+static const char MarkerDone[] = "sharded\n";
+
+static const size_t MaxCachedStates = 65536;
+
+// cache key for a directory: the path without trailing slashes.
+static string dirKey(const string &path) {
+  string::size_type end = path.find_last_not_of('/');
+  if (end == string::npos) return string("/");
+  return path.substr(0, end + 1);
+}
+
+static uint64_t nowMsec() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static string shardDir(const string &cipherDir, int shard) {
+  char name[8];
+  snprintf(name, sizeof(name), ".sh%02x", shard);
+  return cipherDir + '/' + name;
+}
+
+DirShards::DirShards(const shared_ptr<CipherV1> &cipher_, bool shared_)
+    : cipher(cipher_), shared(shared_) {}
+
+DirShards::~DirShards() {}
+
+bool DirShards::IsReserved(const char *name) {
+  if (strcmp(name, MarkerName) == 0) return true;
+
+  return strncmp(name, ".sh", 3) == 0 && isxdigit(name[3]) &&
+         isxdigit(name[4]) && name[5] == '\0';
+}
+
+string DirShards::shardName(const string &cipherName) const {
+  uint64_t mac =
+      cipher->MAC_64((const byte *)cipherName.data(), cipherName.length());
+
+  char name[8];
+  snprintf(name, sizeof(name), ".sh%02x", (int)(mac % ShardCount));
+  return name;
+}
+
+DirShards::State DirShards::state(const string &cipherDir) {
+  {
+    Lock _lock(mutex);
+    unordered_map<string, CachedState>::const_iterator it =
+        states.find(dirKey(cipherDir));
+    if (it != states.end() &&
+        (it->second.expires == 0 || it->second.expires > nowMsec()))
+      return it->second.state;
+  }
+
+  State result = Flat;
+  struct stat st;
+  if (::lstat((cipherDir + '/' + MarkerName).c_str(), &st) == 0)
+    result = (st.st_size > 0) ? Sharded : Migrating;
+
+  // other hosts may shard a directory at any time, but never undo it.
+  if (result == Sharded || !shared)
+    setState(cipherDir, result);
+  else
+    setState(cipherDir, result, nowMsec() + SharedTtlMsec);
+  return result;
+}
+
+void DirShards::setState(const string &cipherDir, State value,
+                         uint64_t expires) {
+  Lock _lock(mutex);
+  if (states.size() >= MaxCachedStates) states.clear();
+  CachedState &cached = states[dirKey(cipherDir)];
+  cached.state = value;
+  cached.expires = expires;
+}
+
+void DirShards::forget(const string &cipherDir) {
+  Lock _lock(mutex);
+  states.erase(dirKey(cipherDir));
+}
+
+void DirShards::clear() {
+  Lock _lock(mutex);
+  states.clear();
+}
+
+bool DirShards::isSharded(const string &cipherDir) {
+  return state(cipherDir) != Flat;
+}
+
+bool DirShards::isMigrating(const string &cipherDir) {
+  return state(cipherDir) == Migrating;
+}
+
+string DirShards::entryPath(const string &cipherDir, const string &cipherName) {
+  string flat = cipherDir + '/' + cipherName;
+  if (cipherName.empty() || cipherName[0] == '.') return flat;
+
+  State dirState = state(cipherDir);
+  if (dirState == Flat) return flat;
+
+  string sharded = cipherDir + '/' + shardName(cipherName) + '/' + cipherName;
+  if (dirState == Migrating) {
+    // may not have been moved yet.
+    struct stat st;
+    if (::lstat(sharded.c_str(), &st) != 0 && ::lstat(flat.c_str(), &st) == 0)
+      return flat;
+  }
+
+  return sharded;
+}
+
+string DirShards::resolve(const string &rootDir, const string &relPath) {
+  if (relPath.empty()) return rootDir;
+
+  string path = rootDir;
+  while (!path.empty() && path[path.length() - 1] == '/')
+    path.erase(path.length() - 1);
+
+  string::size_type pos = 0;
+  while (pos < relPath.length()) {
+    string::size_type end = relPath.find('/', pos);
+    if (end == string::npos) end = relPath.length();
+    if (end > pos) path = entryPath(path, relPath.substr(pos, end - pos));
+    pos = end + 1;
+  }
+
+  if (relPath[relPath.length() - 1] == '/') path.append(1, '/');
+  return path;
+}
+
+string DirShards::strip(const string &path) {
+  string result;
+  string::size_type pos = 0;
+  for (;;) {
+    string::size_type end = path.find('/', pos);
+    string part = path.substr(pos, (end == string::npos) ? end : end - pos);
+
+    bool isShard = IsReserved(part.c_str()) && part != MarkerName;
+    if (!isShard) {
+      result.append(part);
+      if (end != string::npos) result.append(1, '/');
+    }
+
+    if (end == string::npos) break;
+    pos = end + 1;
+  }
+
+  return result;
+}
+
+vector<string> DirShards::shardNames(const string &cipherDir) {
+  vector<string> names;
+  if (state(cipherDir) == Flat) return names;
+
+  names.reserve(ShardCount);
+  for (int i = 0; i < ShardCount; ++i) {
+    char name[8];
+    snprintf(name, sizeof(name), ".sh%02x", i);
+    names.push_back(name);
+  }
+  return names;
+}
+
+int DirShards::migrate(const string &cipherDir) {
+  struct stat dirSt;
+  if (::lstat(cipherDir.c_str(), &dirSt) != 0) return -errno;
+
+  string marker = cipherDir + '/' + MarkerName;
+  int fd = ::open(marker.c_str(), O_WRONLY | O_CREAT, 0600);
+  if (fd < 0) return -errno;
+  ::close(fd);
+  setState(cipherDir, Migrating);
+
+  for (int i = 0; i < ShardCount; ++i) {
+    string shard = shardDir(cipherDir, i);
+    if (::mkdir(shard.c_str(), dirSt.st_mode & 07777) != 0 &&
+        errno != EEXIST) {
+      int eno = errno;
+      LOG(WARNING) << "unable to create shard " << shard << ": "
+                   << strerror(eno);
+      return -eno;
+    }
+  }
+
+  // Entries which are renamed away while reading a directory can make
+  // readdir skip others, so repeat until a pass finds nothing left to move.
+  int moved = 0;
+  int passMoved;
+  do {
+    DIR *dir = ::opendir(cipherDir.c_str());
+    if (dir == NULL) return -errno;
+
+    passMoved = 0;
+    struct dirent *de;
+    while ((de = ::readdir(dir)) != NULL) {
+      // ".", "..", the shards, and config files in the root.
+      if (de->d_name[0] == '.') continue;
+
+      string name = de->d_name;
+      string to = cipherDir + '/' + shardName(name) + '/' + name;
+      if (::rename((cipherDir + '/' + name).c_str(), to.c_str()) != 0) {
+        if (errno == ENOENT) continue;  // removed meanwhile
+
+        int eno = errno;
+        LOG(WARNING) << "unable to move " << name << " into shard: "
+                     << strerror(eno);
+        ::closedir(dir);
+        return -eno;
+      }
+      ++passMoved;
+    }
+
+    ::closedir(dir);
+    moved += passMoved;
+  } while (passMoved > 0);
+
+  fd = ::open(marker.c_str(), O_WRONLY | O_TRUNC);
+  if (fd < 0) return -errno;
+  bool ok =
+      ::write(fd, MarkerDone, sizeof(MarkerDone) - 1) ==
+      (ssize_t)(sizeof(MarkerDone) - 1);
+  ok = (::close(fd) == 0) && ok;
+  if (!ok) return -EIO;
+
+  setState(cipherDir, Sharded);
+  LOG(INFO) << "moved " << moved << " entries of " << cipherDir
+            << " into shards";
+  return 0;
+}
+
+int DirShards::removeDir(const string &cipherDir) {
+  if (state(cipherDir) != Flat) {
+    struct stat dirSt;
+    if (::lstat(cipherDir.c_str(), &dirSt) != 0) return -errno;
+
+    // anything not yet moved into a shard.
+    DIR *dir = ::opendir(cipherDir.c_str());
+    if (dir == NULL) return -errno;
+    bool empty = true;
+    struct dirent *de;
+    while (empty && (de = ::readdir(dir)) != NULL)
+      empty = (de->d_name[0] == '.');
+    ::closedir(dir);
+    if (!empty) return -ENOTEMPTY;
+
+    int removed = 0;
+    int res = 0;
+    for (; removed < ShardCount; ++removed) {
+      if (::rmdir(shardDir(cipherDir, removed).c_str()) != 0 &&
+          errno != ENOENT) {
+        res = -errno;
+        break;
+      }
+    }
+
+    if (res != 0) {
+      // put back the shards which were already removed.
+      for (int i = 0; i < removed; ++i)
+        ::mkdir(shardDir(cipherDir, i).c_str(), dirSt.st_mode & 07777);
+      return res;
+    }
+
+    ::unlink((cipherDir + '/' + MarkerName).c_str());
+  }
+
+  forget(cipherDir);
+  if (::rmdir(cipherDir.c_str()) != 0) return -errno;
+  return 0;
+}
+
+}  // namespace encfs
@@ -0,0 +1,139 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DirShards_incl_
+#define _DirShards_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+using std::tr1::unordered_map;
+#else
+#include <unordered_map>
+using std::unordered_map;
+#endif
+
+namespace encfs {
+
+class CipherV1;
+
+/*
+    Sharded backing directories, for volumes created with sharded_dirs.
+
+    Once a directory grows past the shard threshold, its entries are moved
+    into ShardCount subdirectories named ".shXX", where XX is taken from a
+    MAC of the encrypted name.  The plaintext view doesn't change: listings
+    merge the shards, and lookups go straight to the shard the name hashes
+    to.  Encoded names never start with '.', so the shard directories (and
+    the marker) can't collide with real entries.
+
+    A sharded directory holds a marker file.  While the entries are being
+    moved the marker is empty and lookups which miss in the shard fall back
+    to the top level directory, so an interrupted migration is harmless and
+    is finished the next time the directory is listed.  Once all entries are
+    moved the marker is filled in.
+
+    The state of each directory is cached.  For volumes shared with other
+    hosts only the (permanent) sharded state is cached for good, the others
+    for SharedTtlMsec, so that another host sharding a directory is noticed
+    soon without a marker lookup for every path component of every call.
+
+    All paths are backing paths without a trailing '/'.
+*/
+class DirShards {
+ public:
+  static const char *MarkerName;
+  static const int ShardCount = 256;
+  static const int SharedTtlMsec = 1000;
+
+  DirShards(const shared_ptr<CipherV1> &cipher, bool shared);
+  ~DirShards();
+
+  // True for the names of the marker and of the shard directories.
+  static bool IsReserved(const char *name);
+
+  // Backing path of the entry cipherName in the directory cipherDir.
+  std::string entryPath(const std::string &cipherDir,
+                        const std::string &cipherName);
+
+  // Resolves a path relative to rootDir (an encoded path, as returned by
+  // NameIO::encodePath), adding shard directories where needed.
+  std::string resolve(const std::string &rootDir, const std::string &relPath);
+
+  // Removes shard components from a backing path.
+  static std::string strip(const std::string &path);
+
+  // Shard subdirectories of cipherDir to list after the directory itself, or
+  // nothing if it isn't sharded.
+  std::vector<std::string> shardNames(const std::string &cipherDir);
+
+  bool isSharded(const std::string &cipherDir);
+  // True if cipherDir is sharded but the entries haven't all been moved.
+  bool isMigrating(const std::string &cipherDir);
+
+  // Moves the entries of cipherDir into shards.  Returns 0 or -errno.
+  int migrate(const std::string &cipherDir);
+
+  // rmdir which also removes the shard directories.  Returns 0 or -errno.
+  int removeDir(const std::string &cipherDir);
+
+  // Forget the cached state of a directory (or of all of them), after it
+  // was created, removed or renamed.
+  void forget(const std::string &cipherDir);
+  void clear();
+
+ private:
+  enum State {
+    Flat,
+    Migrating,
+    Sharded
+  };
+
+  // A cached state, which expires at the given time (in msec), or never if
+  // that is 0.
+  struct CachedState {
+    State state;
+    uint64_t expires;
+  };
+
+  State state(const std::string &cipherDir);
+  void setState(const std::string &cipherDir, State state,
+                uint64_t expires = 0);
+  std::string shardName(const std::string &cipherName) const;
+
+  shared_ptr<CipherV1> cipher;
+  bool shared;
+
+  Mutex mutex;
+  unordered_map<std::string, CachedState> states;
+
+  DirShards(const DirShards &);
+  DirShards &operator=(const DirShards &);
+};
+
+}  // namespace encfs
+
+#endif
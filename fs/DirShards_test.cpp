@@ -0,0 +1,192 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+
+#include "fs/testing.h"
+#include "fs/BlockNameIO.h"
+#include "fs/DirNode.h"
+#include "fs/DirShards.h"
+
+using namespace encfs;
+using std::set;
+using std::string;
+
+namespace {
+
+const int FileCount = 20;
+
+class DirShardsTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-shards-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+
+    cfg = makeConfig(CipherV1::New("AES", 128), 512);
+    cfg->nameCoding = NameIO::New(BlockNameIO::CurrentInterface(), cfg->cipher);
+    cfg->nameCoding->setChainedNameIV(true);
+    cfg->config->set_sharded_dirs(true);
+  }
+
+  virtual void TearDown() {
+    string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+  }
+
+  static string fileName(const char *dir, int i) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/file%d", dir, i);
+    return name;
+  }
+
+  static bool exists(const string &path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+  }
+
+  static set<string> list(DirNode *dn, const char *dir) {
+    set<string> names;
+    DirTraverse dt = dn->openDir(dir);
+    EXPECT_TRUE(dt.valid());
+    for (string name = dt.nextPlaintextName(); !name.empty();
+         name = dt.nextPlaintextName())
+      names.insert(name);
+    return names;
+  }
+
+  string rootDir;
+  FSConfigPtr cfg;
+};
+
+TEST_F(DirShardsTest, ReservedNames) {
+  EXPECT_TRUE(DirShards::IsReserved(DirShards::MarkerName));
+  EXPECT_TRUE(DirShards::IsReserved(".sh0a"));
+  EXPECT_FALSE(DirShards::IsReserved(".sh0"));
+  EXPECT_FALSE(DirShards::IsReserved(".sh0ab"));
+  EXPECT_FALSE(DirShards::IsReserved("sh0a"));
+
+  EXPECT_EQ("/a/b/c", DirShards::strip("/a/.sh1f/b/.sh00/c"));
+  EXPECT_EQ("/a/.shx1/b", DirShards::strip("/a/.shx1/b"));
+}
+
+TEST_F(DirShardsTest, MigratedDirectory) {
+  {
+    DirNode dn(NULL, rootDir, cfg);
+    ASSERT_EQ(0, dn.mkdir("/d", 0700));
+    for (int i = 0; i < FileCount; ++i) {
+      int fd = ::open(dn.cipherPath(fileName("/d", i).c_str()).c_str(),
+                      O_CREAT | O_WRONLY, 0600);
+      ASSERT_LE(0, fd);
+      ::close(fd);
+    }
+    EXPECT_TRUE(dn.cipherPath("/d/file0").find("/.sh") == string::npos);
+
+    // as done once a listing finds the directory too large.
+    DirShards shards(cfg->cipher, false);
+    ASSERT_EQ(0, shards.migrate(dn.cipherPath("/d")));
+  }
+
+  DirNode dn(NULL, rootDir, cfg);
+  string cipherPath = dn.cipherPath("/d/file3");
+  EXPECT_NE(string::npos, cipherPath.find("/.sh"));
+  EXPECT_TRUE(exists(cipherPath));
+  EXPECT_EQ("d/file3", dn.plainPath(cipherPath.c_str()));
+
+  set<string> names = list(&dn, "/d");
+  EXPECT_EQ((size_t)FileCount + 2, names.size());
+  EXPECT_TRUE(names.count("file3"));
+  EXPECT_TRUE(names.count("."));
+
+  // new entries go straight into their shard.
+  int fd = ::open(dn.cipherPath("/d/new").c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_LE(0, fd);
+  ::close(fd);
+  EXPECT_TRUE(list(&dn, "/d").count("new"));
+
+  // with chained IVs, every entry is renamed into its new shard.
+  ASSERT_EQ(0, dn.rename("/d", "/e"));
+  names = list(&dn, "/e");
+  EXPECT_EQ((size_t)FileCount + 3, names.size());
+  EXPECT_TRUE(exists(dn.cipherPath("/e/file3")));
+  EXPECT_TRUE(exists(dn.cipherPath("/e/new")));
+
+  EXPECT_EQ(-ENOTEMPTY, dn.rmdir("/e"));
+  for (int i = 0; i < FileCount; ++i)
+    ASSERT_EQ(0, dn.unlink(fileName("/e", i).c_str()));
+  ASSERT_EQ(0, dn.unlink("/e/new"));
+
+  string dirPath = dn.cipherPath("/e");
+  EXPECT_EQ(0, dn.rmdir("/e"));
+  EXPECT_FALSE(exists(dirPath));
+}
+
+TEST_F(DirShardsTest, InterruptedMigration) {
+  DirNode dn(NULL, rootDir, cfg);
+  ASSERT_EQ(0, dn.mkdir("/d", 0700));
+  int fd = ::open(dn.cipherPath("/d/old").c_str(), O_CREAT | O_WRONLY, 0600);
+  ASSERT_LE(0, fd);
+  ::close(fd);
+
+  // an empty marker means the entries may not have been moved yet.
+  string dirPath = dn.cipherPath("/d");
+  fd = ::open((dirPath + "/" + DirShards::MarkerName).c_str(),
+              O_CREAT | O_WRONLY, 0600);
+  ASSERT_LE(0, fd);
+  ::close(fd);
+
+  DirNode fresh(NULL, rootDir, cfg);
+  EXPECT_TRUE(exists(fresh.cipherPath("/d/old")));
+  EXPECT_TRUE(fresh.cipherPath("/d/old").find("/.sh") == string::npos);
+
+  // listing finishes the job.
+  EXPECT_TRUE(fresh.listDir("/d"));
+  EXPECT_NE(string::npos, fresh.cipherPath("/d/old").find("/.sh"));
+  EXPECT_TRUE(exists(fresh.cipherPath("/d/old")));
+  EXPECT_TRUE(fresh.listDir("/d"));
+}
+
+// With --shared, another host sharding a directory is seen once the cached
+// flat state expires.
+TEST_F(DirShardsTest, SharedFlatStateExpires) {
+  string dir = rootDir + "/d";
+  ASSERT_EQ(0, mkdir(dir.c_str(), 0700));
+
+  DirShards a(cfg->cipher, true);
+  DirShards b(cfg->cipher, true);
+  EXPECT_FALSE(a.isSharded(dir));
+
+  ASSERT_EQ(0, b.migrate(dir));
+  EXPECT_TRUE(b.isSharded(dir));
+  EXPECT_FALSE(a.isSharded(dir));
+
+  usleep((DirShards::SharedTtlMsec + 100) * 1000);
+  EXPECT_TRUE(a.isSharded(dir));
+}
+
+}  // namespace
@@ -44,6 +44,12 @@ enum ConfigType {
 struct EncFS_Opts;
 class CipherV1;
 class NameIO;
+class CipherPool;
+class LeaseTable;
+class BlockIndex;
+class GroupCommit;
+class DedupIndex;
+class PlainDigest;
 
 CipherKey getUserKey(const EncfsConfig &config, bool useStdin);
 CipherKey getUserKey(const EncfsConfig &config,
@@ -56,6 +62,12 @@ CipherKey getNewUserKey(EncfsConfig &config, bool useStdin,
 shared_ptr<CipherV1> getCipher(const EncfsConfig &cfg);
 shared_ptr<CipherV1> getCipher(const Interface &iface, int keySize);
 
+// Returns the cipher for file contents, keyed from the volume key.  That is
+// cipher itself unless the config names a separate data_cipher.
+shared_ptr<CipherV1> getDataCipher(const EncfsConfig &cfg,
+                                   const shared_ptr<CipherV1> &cipher,
+                                   const CipherKey &volumeKey);
+
 // helpers for serializing to/from a stream
 std::ostream &operator<<(std::ostream &os, const EncfsConfig &cfg);
 std::istream &operator>>(std::istream &os, EncfsConfig &cfg);
@@ -67,8 +79,29 @@ struct FSConfig {
 
   shared_ptr<CipherV1> cipher;
   CipherKey key;
+
+  // file contents cipher, which is cipher unless the volume uses another
+  shared_ptr<CipherV1> dataCipher;
+
+  // per-thread copies of dataCipher, for parallel encoding
+  shared_ptr<CipherPool> cipherPool;
   shared_ptr<NameIO> nameCoding;
 
+  // set when the volume is shared between hosts (--shared)
+  shared_ptr<LeaseTable> leases;
+
+  // reverse mode per-block change index (--block-index)
+  shared_ptr<BlockIndex> blockIndex;
+
+  // batches fsync requests (--group-commit)
+  shared_ptr<GroupCommit> groupCommit;
+
+  // shares identical raw blocks (--dedup)
+  shared_ptr<DedupIndex> dedup;
+
+  // plaintext digests for the user.encfs.sha256 attribute (forward mode)
+  shared_ptr<PlainDigest> digests;
+
   bool forceDecode;        // force decode on MAC block failures
   bool reverseEncryption;  // reverse encryption operation
 
@@ -33,4 +33,8 @@ bool FileIO::setIV(uint64_t iv) {
   return true;
 }
 
+int FileIO::flush() { return 0; }
+
+void FileIO::invalidateCache() {}
+
 }  // namespace encfs
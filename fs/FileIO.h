@@ -72,6 +72,15 @@ class FileIO {
 
   virtual bool isWritable() const = 0;
 
+  // Called when a handle to the file is closed.  Writes out any buffered
+  // data, so that it is visible to other users of the backing store.
+  // Returns 0 on success, -errno on failure.  Default does nothing.
+  virtual int flush();
+
+  // Drop any cached data or metadata.  Called when another host may have
+  // modified the underlying file.  Default implementation does nothing.
+  virtual void invalidateCache();
+
  private:
   // not implemented..
   FileIO(const FileIO &);
@@ -36,15 +36,23 @@
 #include "base/config.h"
 #include "base/Error.h"
 #include "base/Mutex.h"
+#include "cipher/CipherV1.h"
 #include "cipher/MemoryPool.h"
 
 #include "fs/CipherFileIO.h"
+#include "fs/DedupFileIO.h"
 #include "fs/DirNode.h"
 #include "fs/FileIO.h"
 #include "fs/FileNode.h"
 #include "fs/FileUtils.h"
+#include "fs/GroupCommit.h"
+#include "fs/LeaseTable.h"
 #include "fs/MACFileIO.h"
+#include "fs/PlainDigest.h"
+#include "fs/MMapFileIO.h"
+#include "fs/NFSFileIO.h"
 #include "fs/RawFileIO.h"
+#include "fs/ReadCache.h"
 #include "fs/fsconfig.pb.h"
 
 #include <glog/logging.h>
@@ -62,33 +70,86 @@ namespace encfs {
    sent to the IO subsystem!
 */
 
+// The standalone backing file, through the FileIO selected by the options.
+static shared_ptr<FileIO> backingIO(const FSConfigPtr &cfg,
+                                    const string &name) {
+  shared_ptr<FileIO> rawIO;
+  if (cfg->opts && cfg->opts->nfsBacking)
+    rawIO.reset(new NFSFileIO(name));
+  else if (cfg->opts && cfg->opts->mmapBacking)
+    rawIO.reset(new MMapFileIO(name));
+  else if (cfg->dedup)
+    rawIO.reset(new DedupFileIO(name, cfg->dedup));
+  else
+    rawIO.reset(new RawFileIO(name));
+  return rawIO;
+}
+
 FileNode::FileNode(DirNode *parent_, const FSConfigPtr &cfg,
                    const char *plaintextName_, const char *cipherName_) {
   Lock _lock(mutex);
 
   this->_pname = plaintextName_;
-  this->_cname = cipherName_;
   this->parent = parent_;
+  this->_inode = 0;
+  this->_leaseEpoch = 0;
+  this->_leaseDirty = false;
+  this->_written = false;
+  this->_externalIV = 0;
+  this->_packed = false;
 
   this->fsConfig = cfg;
 
+  buildIO(backingIO(cfg, cipherName_));
+}
+
+// True if file contents are stored as they are: a separate Null data cipher
+// and no per-file header or MACs.  Such files skip the block layers
+// entirely, so reads and writes go straight to the backing file.
+static bool storedAsIs(const FSConfigPtr &cfg) {
+  const EncfsConfig &config = *cfg->config;
+  return config.has_data_cipher() && cfg->dataCipher->isNull() &&
+         !config.unique_iv() && config.block_mac_bytes() == 0 &&
+         config.block_mac_rand_bytes() == 0;
+}
+
+void FileNode::buildIO(const shared_ptr<FileIO> &rawIO) {
+  if (storedAsIs(fsConfig)) {
+    // the page cache already holds the backing file's data.
+    io = rawIO;
+    return;
+  }
+
   // chain RawFileIO & CipherFileIO
-  shared_ptr<FileIO> rawIO(new RawFileIO(_cname));
   io = shared_ptr<FileIO>(new CipherFileIO(rawIO, fsConfig));
 
-  if (cfg->config->block_mac_bytes() || cfg->config->block_mac_rand_bytes())
+  if (fsConfig->config->block_mac_bytes() ||
+      fsConfig->config->block_mac_rand_bytes())
     io = shared_ptr<FileIO>(new MACFileIO(io, fsConfig));
+
+  if (fsConfig->config->external_iv() && _externalIV)
+    io->setIV(_externalIV);
+
+  // Readers use readCache without the mutex, so it is only created once
+  // and then just cleared when the stack is rebuilt.
+  if (readCache)
+    readCache->clear();
+  else if (!fsConfig->leases && !fsConfig->reverseEncryption)
+    readCache.reset(new ReadCache(io->blockSize()));
 }
 
 FileNode::~FileNode() {
   // FileNode mutex should be locked before the destructor is called
 
+  if (_leaseDirty) publishLease();
+
   _pname.assign(_pname.length(), '\0');
-  _cname.assign(_cname.length(), '\0');
   io.reset();
 }
 
-const char *FileNode::cipherName() const { return _cname.c_str(); }
+// The encrypted name is only kept by the RawFileIO at the bottom of the
+// chain, rather then in every layer.
+const char *FileNode::cipherName() const { return io->getFileName(); }
 
 const char *FileNode::plaintextName() const { return _pname.c_str(); }
 
@@ -108,28 +169,24 @@ bool FileNode::setName(const char *plaintextName_, const char *cipherName_,
   VLOG(1) << "calling setIV on " << cipherName_;
   if (setIVFirst) {
     if (fsConfig->config->external_iv() && !setIV(io, iv)) return false;
+    _externalIV = iv;
 
     // now change the name..
     if (plaintextName_) this->_pname = plaintextName_;
-    if (cipherName_) {
-      this->_cname = cipherName_;
-      io->setFileName(cipherName_);
-    }
+    if (cipherName_) io->setFileName(cipherName_);
   } else {
     std::string oldPName = _pname;
-    std::string oldCName = _cname;
+    std::string oldCName = cipherName();
 
     if (plaintextName_) this->_pname = plaintextName_;
-    if (cipherName_) {
-      this->_cname = cipherName_;
-      io->setFileName(cipherName_);
-    }
+    if (cipherName_) io->setFileName(cipherName_);
 
     if (fsConfig->config->external_iv() && !setIV(io, iv)) {
       _pname = oldPName;
-      _cname = oldCName;
+      io->setFileName(oldCName.c_str());
       return false;
     }
+    _externalIV = iv;
   }
 
   return true;
@@ -162,12 +219,12 @@ int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
    * were a create method (advised to have)
    */
   if (S_ISREG(mode)) {
-    res = ::open(_cname.c_str(), O_CREAT | O_EXCL | O_WRONLY, mode);
+    res = ::open(cipherName(), O_CREAT | O_EXCL | O_WRONLY, mode);
     if (res >= 0) res = ::close(res);
   } else if (S_ISFIFO(mode))
-    res = ::mkfifo(_cname.c_str(), mode);
+    res = ::mkfifo(cipherName(), mode);
   else
-    res = ::mknod(_cname.c_str(), mode, rdev);
+    res = ::mknod(cipherName(), mode, rdev);
 
   if (olduid >= 0) setfsuid(olduid);
   if (oldgid >= 0) setfsgid(oldgid);
@@ -176,14 +233,68 @@ int FileNode::mknod(mode_t mode, dev_t rdev, uid_t uid, gid_t gid) {
     int eno = errno;
     VLOG(1) << "mknod error: " << strerror(eno);
     res = -eno;
-  }
+  } else if (S_ISREG(mode))
+    noteChange(0);  // the inode may have held another file before
 
   return res;
 }
 
+ino_t FileNode::leaseInode() const {
+  if (_inode == 0) {
+    struct stat stbuf;
+    if (::lstat(cipherName(), &stbuf) == 0) _inode = stbuf.st_ino;
+  }
+  return _inode;
+}
+
+void FileNode::noteChange(off_t offset) const {
+  if (!fsConfig->digests) return;
+
+  ino_t inode = leaseInode();
+  if (inode != 0) fsConfig->digests->changed(inode, offset);
+}
+
+void FileNode::validateLease() const {
+  if (!fsConfig->leases) return;
+
+  ino_t inode = leaseInode();
+  if (inode == 0) return;
+
+  uint64_t epoch = fsConfig->leases->epoch(inode);
+  if (epoch != _leaseEpoch) {
+    VLOG(1) << "lease changed for " << cipherName() << ", dropping cache";
+    io->invalidateCache();
+    _leaseEpoch = epoch;
+  }
+}
+
+void FileNode::publishLease() {
+  if (!fsConfig->leases) return;
+  _leaseDirty = false;
+
+  ino_t inode = leaseInode();
+  if (inode == 0) return;
+
+  // Other hosts must be able to see the data once they see the new epoch.
+  int fh = io->open(O_RDONLY);
+  if (fh >= 0 && fdatasync(fh) != 0)
+    LOG(WARNING) << "fdatasync failed for " << cipherName() << ": "
+                 << strerror(errno);
+
+  // If anyone else changed the file in the mean time, then the epoch jumped
+  // by more then our own update and our cache is suspect as well.
+  uint64_t epoch = fsConfig->leases->bump(inode);
+  if (epoch != _leaseEpoch + 1) io->invalidateCache();
+  _leaseEpoch = epoch;
+}
+
 int FileNode::open(int flags) const {
   Lock _lock(mutex);
 
+  if (flags & O_TRUNC) {
+    if (readCache) readCache->clear();
+    noteChange(0);
+  }
   int res = io->open(flags);
   return res;
 }
@@ -191,6 +302,7 @@ int FileNode::open(int flags) const {
 int FileNode::getAttr(struct stat *stbuf) const {
   Lock _lock(mutex);
 
+  validateLease();
   int res = io->getAttr(stbuf);
   return res;
 }
@@ -198,6 +310,7 @@ int FileNode::getAttr(struct stat *stbuf) const {
 off_t FileNode::getSize() const {
   Lock _lock(mutex);
 
+  validateLease();
   int res = io->getSize();
   return res;
 }
@@ -208,9 +321,17 @@ ssize_t FileNode::read(off_t offset, unsigned char *data, ssize_t size) const {
   req.dataLen = size;
   req.data = data;
 
+  if (readCache) {
+    ssize_t res = readCache->read(offset, data, size);
+    if (res >= 0) return res;
+  }
+
   Lock _lock(mutex);
 
-  return io->read(req);
+  validateLease();
+  ssize_t res = io->read(req);
+  if (readCache) readCache->insert(offset, data, res, size);
+  return res;
 }
 
 bool FileNode::write(off_t offset, unsigned char *data, ssize_t size) {
@@ -223,19 +344,73 @@ bool FileNode::write(off_t offset, unsigned char *data, ssize_t size) {
 
   Lock _lock(mutex);
 
-  return io->write(req);
+  // drop cached blocks first, so that no reader sees them once the write
+  // has returned.
+  if (readCache) readCache->clear();
+
+  validateLease();
+  noteChange(offset);
+  bool ok = io->write(req);
+  if (ok) _written = true;
+  if (ok && fsConfig->leases) _leaseDirty = true;
+  return ok;
 }
 
 int FileNode::truncate(off_t size) {
   Lock _lock(mutex);
 
-  return io->truncate(size);
+  if (readCache) readCache->clear();
+
+  validateLease();
+  noteChange(size);
+  int res = io->truncate(size);
+  if (res == 0) _written = true;
+  if (res == 0 && fsConfig->leases) _leaseDirty = true;
+  if (parent) parent->attrChanged(cipherName());
+  return res;
+}
+
+int FileNode::flush() {
+  Lock _lock(mutex);
+
+  // Called on close, after any writes.  Drop attributes which stat-ahead may
+  // have picked up while the file was being changed.
+  if (parent) parent->attrChanged(cipherName());
+
+  int res = io->flush();
+  if (_leaseDirty) publishLease();
+  return res;
+}
+
+void FileNode::usePack(const shared_ptr<FileIO> &packIO) {
+  Lock _lock(mutex);
+
+  if (packIO)
+    buildIO(packIO);
+  else
+    buildIO(backingIO(fsConfig, cipherName()));
+  _packed = bool(packIO);
+}
+
+bool FileNode::isPacked() const {
+  Lock _lock(mutex);
+  return _packed;
+}
+
+bool FileNode::written() const {
+  Lock _lock(mutex);
+  return _written;
 }
 
 int FileNode::sync(bool datasync) {
   Lock _lock(mutex);
 
+  if (_leaseDirty) publishLease();
+
   int fh = io->open(O_RDONLY);
+  if (fh >= 0 && fsConfig->groupCommit)
+    return fsConfig->groupCommit->sync(fh, datasync);
+
   if (fh >= 0) {
     int res;
 #ifdef linux
@@ -35,6 +35,7 @@ namespace encfs {
 class Cipher;
 class FileIO;
 class DirNode;
+class ReadCache;
 
 class FileNode {
  public:
@@ -70,10 +71,36 @@ class FileNode {
   // truncate the file to a particular size
   int truncate(off_t size);
 
+  // called when a handle to the file is closed.
+  int flush();
+
   // datasync or full sync
   int sync(bool dataSync);
 
+  // True once the file has been written or truncated through this node.
+  bool written() const;
+
+  // Serve the file from a pack (see PackStore) through packIO, or from its
+  // standalone backing file again if packIO is empty.
+  void usePack(const shared_ptr<FileIO> &packIO);
+  bool isPacked() const;
+
  private:
+  // builds the FileIO stack on top of rawIO.  Expects the mutex to be held.
+  void buildIO(const shared_ptr<FileIO> &rawIO);
+
+  // Shared volume support.  Drops cached data if another host has changed
+  // the file since we last looked, and publishes our own changes.  Both
+  // expect the mutex to be held, and do nothing unless leases are enabled.
+  // Changes are published once per flush or sync rather than per write.
+  void validateLease() const;
+  void publishLease();
+  ino_t leaseInode() const;
+
+  // Tells the digest cache (see PlainDigest) that the plaintext is about to
+  // change from offset onwards.
+  void noteChange(off_t offset) const;
+
   // doing locking at the FileNode level isn't as efficient as at the
   // lowest level of RawFileIO, since that means locks are held longer
   // (held during CPU intensive crypto operations!).  However it makes it
@@ -85,10 +112,23 @@ class FileNode {
   FSConfigPtr fsConfig;
 
   shared_ptr<FileIO> io;
-  std::string _pname;  // plaintext name
-  std::string _cname;  // encrypted name
+
+  // Recently read blocks, served without taking the mutex.  Not used for
+  // shared volumes or reverse mode, where the data can change without
+  // going through this node.  Created once and only cleared afterwards.
+  shared_ptr<ReadCache> readCache;
+  std::string _pname;  // plaintext name, the encrypted name is kept by io
   DirNode *parent;
 
+  mutable ino_t _inode;
+  mutable uint64_t _leaseEpoch;
+  bool _leaseDirty;  // changed since the lease was last published
+  bool _written;
+
+  // external IV of the file, to rebuild the FileIO stack with.
+  uint64_t _externalIV;
+  bool _packed;
+
  private:
   FileNode(const FileNode &src);
   FileNode &operator=(const FileNode &src);
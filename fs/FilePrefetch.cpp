@@ -0,0 +1,211 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/FilePrefetch.h"
+
+#include "base/WorkerPool.h"
+#include "fs/DirShards.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+namespace encfs {
+
+// Opens in listing order before prefetching starts.
+static const int PrefetchTrigger = 2;
+
+// Entries which may be passed over (subdirectories, skipped files) and
+// still count as reading in order.
+static const int MaxSkip = 4;
+
+static const int MinWindow = 2;
+
+static string withSlash(const string &dir) {
+  if (!dir.empty() && dir[dir.length() - 1] == '/') return dir;
+  return dir + '/';
+}
+
+// Listings are keyed the same way as the directory part of opened paths,
+// without shard directories, since the files of a sharded directory are
+// listed from the directory but opened from their shards.
+static string dirKey(const string &dir) {
+  return withSlash(DirShards::strip(dir));
+}
+
+FilePrefetch::FilePrefetch(int maxListings_, int maxWindow_, off_t leadBytes_,
+                           int maxPending_)
+    : maxListings(maxListings_),
+      maxWindow(maxWindow_),
+      leadBytes(leadBytes_),
+      maxPending(maxPending_),
+      clock(0),
+      batches(0) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_init(&idle, 0);
+#endif
+}
+
+FilePrefetch::~FilePrefetch() {
+  // queued batches refer to us.
+  Lock _lock(mutex);
+#ifdef CMAKE_USE_PTHREADS_INIT
+  while (batches > 0) pthread_cond_wait(&idle, &mutex._mutex);
+  pthread_cond_destroy(&idle);
+#endif
+}
+
+void FilePrefetch::listed(const string &dir, const vector<string> &names) {
+  if (names.empty()) return;
+
+  string dirPath = dirKey(dir);
+
+  Lock _lock(mutex);
+
+  if (listings.size() >= maxListings && !listings.count(dirPath)) {
+    // forget the least recently used listing.
+    ListingMap::iterator oldest = listings.begin();
+    for (ListingMap::iterator it = listings.begin(); it != listings.end();
+         ++it)
+      if (it->second.used < oldest->second.used) oldest = it;
+    listings.erase(oldest);
+  }
+
+  Listing &listing = listings[dirPath];
+  listing.dir = withSlash(dir);
+  listing.names = names;
+  listing.index.clear();
+  for (size_t i = 0; i < names.size(); ++i)
+    listing.index[DirShards::strip(names[i])] = i;
+  listing.last = -1;
+  listing.streak = 0;
+  listing.window = MinWindow;
+  listing.fetched = 0;
+  listing.used = ++clock;
+}
+
+void FilePrefetch::opened(const string &backingPath) {
+  string path = DirShards::strip(backingPath);
+  string::size_type pos = path.rfind('/');
+  if (pos == string::npos) return;
+  string dirPath = path.substr(0, pos + 1);
+  string name = path.substr(pos + 1);
+
+  string dir;
+  vector<string> batch;
+  {
+    Lock _lock(mutex);
+
+    ListingMap::iterator lit = listings.find(dirPath);
+    if (lit == listings.end()) return;
+    Listing &listing = lit->second;
+
+    unordered_map<string, int>::const_iterator it = listing.index.find(name);
+    if (it == listing.index.end()) return;
+    int i = it->second;
+
+    listing.used = ++clock;
+    if (i > listing.last && i - listing.last <= MaxSkip) {
+      ++listing.streak;
+    } else {
+      listing.streak = 0;
+      listing.window = MinWindow;
+      listing.fetched = i + 1;
+    }
+    listing.last = i;
+
+    if (listing.streak < PrefetchTrigger) return;
+
+    // the reader has caught up with what was prefetched, so look further
+    // ahead.
+    if (i + 1 >= listing.fetched && listing.fetched > 0 &&
+        listing.window < maxWindow)
+      listing.window = std::min(2 * listing.window, maxWindow);
+
+    int start = std::max(listing.fetched, i + 1);
+    int end = std::min(i + 1 + listing.window, (int)listing.names.size());
+    if (start >= end || batches >= maxPending) return;
+
+    dir = listing.dir;
+    batch.assign(listing.names.begin() + start, listing.names.begin() + end);
+    listing.fetched = end;
+    ++batches;
+  }
+
+  WorkerPool::Default()->submit(
+      std::bind(&FilePrefetch::runBatch, this, dir, batch));
+}
+
+int FilePrefetch::pending() const {
+  Lock _lock(mutex);
+  return batches;
+}
+
+int FilePrefetch::window(const string &dir) const {
+  string dirPath = dirKey(dir);
+
+  Lock _lock(mutex);
+  ListingMap::const_iterator it = listings.find(dirPath);
+  return it == listings.end() ? 0 : it->second.window;
+}
+
+void FilePrefetch::runBatch(const string &dirPath,
+                            const vector<string> &names) {
+  int fetched = 0;
+  for (size_t i = 0; i < names.size(); ++i) {
+    string path = dirPath + names[i];
+
+    // only regular files, opening anything else may have side effects.
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size == 0)
+      continue;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd < 0) continue;
+
+    off_t len = std::min(st.st_size, leadBytes);
+#ifdef POSIX_FADV_WILLNEED
+    if (posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED) == 0) ++fetched;
+#else
+    // read it ourselves.
+    vector<char> buf(len);
+    if (::pread(fd, &buf[0], len, 0) > 0) ++fetched;
+#endif
+    ::close(fd);
+  }
+
+  VLOG(1) << "prefetched " << fetched << " of " << names.size()
+          << " files in " << dirPath;
+
+  Lock _lock(mutex);
+  --batches;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_broadcast(&idle);
+#endif
+}
+
+}  // namespace encfs
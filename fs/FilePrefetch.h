@@ -0,0 +1,119 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FilePrefetch_incl_
+#define _FilePrefetch_incl_
+
+#include "base/Mutex.h"
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+using std::tr1::unordered_map;
+#else
+#include <unordered_map>
+using std::unordered_map;
+#endif
+
+namespace encfs {
+
+/*
+    Prefetches files in directory order.
+
+    tar, cp -r, grep -r, indexers and backup tools read the files of a
+    directory one after another, in the order they were listed.  Each file
+    then starts with a cold read of its header and first blocks.
+
+    listed() remembers the order of recent directory listings, and opened()
+    follows the files opened from them.  Once a few files have been opened
+    in listing order, the leading bytes of the next files are read ahead in
+    the background on the worker pool (posix_fadvise WILLNEED), so that the
+    backing filesystem has them cached by the time they are opened.
+
+    The window of files kept ahead starts small and doubles, up to
+    maxWindow, each time the reader catches up with it.  It goes back to
+    the start when the reader leaves listing order.  At most maxPending
+    batches are outstanding.
+
+    In sharded directories (see DirShards) names are listed with their shard
+    directory, and files are opened from there, so both are matched with
+    the shard components removed.
+*/
+class FilePrefetch {
+ public:
+  FilePrefetch(int maxListings, int maxWindow, off_t leadBytes,
+               int maxPending);
+  ~FilePrefetch();
+
+  // Records the order of the names (backing names) listed in dirPath.
+  void listed(const std::string &dirPath,
+              const std::vector<std::string> &names);
+
+  // Notes that the backing file path was opened, and prefetches what
+  // follows it if the directory is being read in order.
+  void opened(const std::string &backingPath);
+
+  // Number of prefetch batches which are queued or running.
+  int pending() const;
+
+  // Current window for the listing of dirPath, or 0 if there is none.
+  int window(const std::string &dirPath) const;
+
+ private:
+  struct Listing {
+    std::string dir;  // as listed, names are relative to it
+    std::vector<std::string> names;
+    unordered_map<std::string, int> index;
+    int last;     // last opened entry, or -1
+    int streak;   // opens in listing order
+    int window;   // entries to keep ahead of the reader
+    int fetched;  // entries before this have been prefetched
+    uint64_t used;
+  };
+
+  typedef unordered_map<std::string, Listing> ListingMap;
+
+  void runBatch(const std::string &dirPath,
+                const std::vector<std::string> &names);
+
+  size_t maxListings;
+  int maxWindow;
+  off_t leadBytes;
+  int maxPending;
+
+  mutable Mutex mutex;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_t idle;
+#endif
+  ListingMap listings;
+  uint64_t clock;
+  int batches;
+
+  FilePrefetch(const FilePrefetch &);
+  FilePrefetch &operator=(const FilePrefetch &);
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,142 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "fs/FilePrefetch.h"
+
+using namespace encfs;
+using std::string;
+using std::vector;
+
+namespace {
+
+const int FileCount = 40;
+
+class FilePrefetchTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-prefetch-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+
+    for (int i = 0; i < FileCount; ++i) {
+      char name[16];
+      snprintf(name, sizeof(name), "f%02d", i);
+      names.push_back(name);
+
+      int fd = ::open(path(i).c_str(), O_CREAT | O_WRONLY, 0600);
+      ASSERT_LE(0, fd);
+      ASSERT_EQ(3, ::write(fd, "xyz", 3));
+      ::close(fd);
+    }
+  }
+
+  virtual void TearDown() {
+    for (int i = 0; i < FileCount; ++i) unlink(path(i).c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  string path(int i) const { return rootDir + "/" + names[i]; }
+
+  string rootDir;
+  vector<string> names;
+};
+
+TEST_F(FilePrefetchTest, SlowReader) {
+  FilePrefetch prefetch(4, 16, 4096, 1);
+  prefetch.listed(rootDir, names);
+  EXPECT_EQ(2, prefetch.window(rootDir));
+
+  // each file is opened after the previous batch is done, so the reader
+  // never catches up with the window.
+  for (int i = 0; i < 10; ++i) {
+    prefetch.opened(path(i));
+    while (prefetch.pending() > 0) usleep(1000);
+  }
+  EXPECT_EQ(2, prefetch.window(rootDir));
+
+  // files which aren't listed are ignored.
+  prefetch.opened(rootDir + "/other");
+  prefetch.opened("/elsewhere/f00");
+  EXPECT_EQ(0, prefetch.pending());
+}
+
+TEST_F(FilePrefetchTest, WindowAdapts) {
+  // nothing is ever fetched, as if the pool were always busy, so the reader
+  // keeps catching up.
+  FilePrefetch prefetch(4, 16, 4096, 0);
+  prefetch.listed(rootDir, names);
+
+  prefetch.opened(path(5));
+  prefetch.opened(path(6));
+  EXPECT_EQ(2, prefetch.window(rootDir));
+  prefetch.opened(path(7));
+  EXPECT_EQ(4, prefetch.window(rootDir));
+  prefetch.opened(path(9));  // skipping a few entries is still in order.
+  EXPECT_EQ(8, prefetch.window(rootDir));
+  for (int i = 10; i < 20; ++i) prefetch.opened(path(i));
+  EXPECT_EQ(16, prefetch.window(rootDir));
+
+  // out of order.
+  prefetch.opened(path(30));
+  EXPECT_EQ(2, prefetch.window(rootDir));
+  prefetch.opened(path(2));
+  EXPECT_EQ(2, prefetch.window(rootDir));
+}
+
+// Entries of sharded directories are listed and opened with their shards.
+TEST_F(FilePrefetchTest, Shards) {
+  FilePrefetch prefetch(4, 16, 4096, 0);
+  vector<string> sharded;
+  for (int i = 0; i < FileCount; ++i)
+    sharded.push_back((i & 1 ? ".sh01/" : ".sh02/") + names[i]);
+  prefetch.listed("/a/.sh03/b", sharded);
+  EXPECT_EQ(2, prefetch.window("/a/b"));
+
+  prefetch.opened("/a/.sh03/b/.sh01/f05");
+  prefetch.opened("/a/.sh03/b/.sh02/f06");
+  prefetch.opened("/a/.sh03/b/.sh01/f07");
+  EXPECT_EQ(4, prefetch.window("/a/.sh03/b"));
+}
+
+TEST_F(FilePrefetchTest, Listings) {
+  FilePrefetch prefetch(2, 16, 4096, 1);
+  prefetch.listed("/a", names);
+  prefetch.listed("/b/", names);
+  EXPECT_EQ(2, prefetch.window("/a/"));
+  EXPECT_EQ(2, prefetch.window("/b"));
+
+  // the least recently used listing is dropped.
+  prefetch.opened("/a/f00");
+  prefetch.listed("/c", names);
+  EXPECT_EQ(2, prefetch.window("/a"));
+  EXPECT_EQ(0, prefetch.window("/b"));
+  EXPECT_EQ(2, prefetch.window("/c"));
+}
+
+}  // namespace
@@ -34,16 +34,22 @@
 #include "base/i18n.h"
 #include "base/XmlReader.h"
 
+#include "cipher/CipherPool.h"
 #include "cipher/CipherV1.h"
 #include "cipher/MemoryPool.h"
 #include "cipher/readpassphrase.h"
 
+#include "fs/BlockIndex.h"
 #include "fs/BlockNameIO.h"
 #include "fs/Context.h"
+#include "fs/DedupIndex.h"
 #include "fs/DirNode.h"
+#include "fs/GroupCommit.h"
 #include "fs/FileUtils.h"
 #include "fs/FSConfig.h"
+#include "fs/LeaseTable.h"
 #include "fs/NullNameIO.h"
+#include "fs/PlainDigest.h"
 #include "fs/StreamNameIO.h"
 
 #include <glog/logging.h>
@@ -783,6 +789,39 @@ static bool selectExternalChainedIV() {
         "in the filesystem."));
 }
 
+static bool selectShardedDirs() {
+  // xgroup(setup)
+  return boolDefaultNo(
+      _("Enable sharded directories?\n"
+        "Large directories are spread over hashed subdirectories of the\n"
+        "encrypted directory, which keeps them fast on filesystems that\n"
+        "slow down with very many entries in one directory.\n"
+        "Older versions of encfs can't read such filesystems."));
+}
+
+// Returns the algorithm for file contents, or an empty one to use the
+// filesystem cipher.
+static CipherV1::CipherAlgorithm selectDataCipher(int blockSize) {
+  // xgroup(setup)
+  bool same = boolDefaultYes(
+      _("Encrypt file contents with the same cipher as names?\n"
+        "Otherwise another cipher can be chosen for file contents, such as\n"
+        "the Null cipher for data which needs no protection.  Names are\n"
+        "still encrypted with the filesystem cipher.\n"
+        "Older versions of encfs can't read such filesystems."));
+  if (same) return CipherV1::CipherAlgorithm();
+
+  for (;;) {
+    CipherV1::CipherAlgorithm alg = selectCipherAlgorithm();
+    if (alg.blockSize.allowed(blockSize)) return alg;
+
+    cout << autosprintf(
+                // xgroup(setup)
+                _("That cipher doesn't support a block size of %i bytes."),
+                blockSize) << "\n";
+  }
+}
+
 static bool selectZeroBlockPassThrough() {
   // xgroup(setup)
   return boolDefaultYes(
@@ -790,6 +829,39 @@ static bool selectZeroBlockPassThrough() {
         "This avoids writing encrypted blocks when file holes are created."));
 }
 
+static bool openLeases(const FSConfigPtr &fsConfig,
+                       const std::string &rootDir) {
+  // A reverse mount never modifies the backing files, so nothing can change
+  // underneath another host.
+  if (fsConfig->reverseEncryption) return true;
+
+  fsConfig->leases = LeaseTable::Open(rootDir);
+  if (!fsConfig->leases) {
+    // xgroup(diag)
+    cout << _("Unable to open the lease table needed for --shared\n");
+    return false;
+  }
+  return true;
+}
+
+// Maximum number of blocks remembered for --dedup.
+static const size_t DedupIndexSize = 256 * 1024;
+
+static void openDedup(const FSConfigPtr &fsConfig, const std::string &rootDir) {
+  // Nothing is written in reverse mode, and with per-file IVs no two files
+  // have the same ciphertext.
+  if (fsConfig->reverseEncryption) return;
+  if (fsConfig->config->unique_iv()) {
+    LOG(WARNING) << "--dedup has no effect on volumes with per-file IVs";
+    return;
+  }
+
+  shared_ptr<DedupIndex> dedup(
+      new DedupIndex(fsConfig->cipherPool, rootDir,
+                     fsConfig->config->block_size(), DedupIndexSize));
+  if (dedup->enabled()) fsConfig->dedup = dedup;
+}
+
 RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   const std::string rootDir = opts->rootDir;
   bool enableIdleTracking = opts->idleTracking;
@@ -826,12 +898,14 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   int keySize = 0;
   int blockSize = 0;
   CipherV1::CipherAlgorithm alg;
+  CipherV1::CipherAlgorithm dataAlg;
   Interface nameIOIface;
   int blockMACBytes = 0;
   int blockMACRandBytes = 0;
   bool uniqueIV = false;
   bool chainedIV = false;
   bool externalIV = false;
+  bool shardedDirs = false;
   bool allowHoles = true;
   long desiredKDFDuration = NormalKDFDuration;
 
@@ -902,6 +976,7 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
     alg = selectCipherAlgorithm();
     keySize = selectKeySize(alg);
     blockSize = selectBlockSize(alg);
+    dataAlg = selectDataCipher(blockSize);
     nameIOIface = selectNameCoding(alg);
     if (reverseEncryption) {
       cout << _("--reverse specified, not using unique/chained IV") << "\n";
@@ -917,6 +992,9 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
              << "\n";
         externalIV = false;
       }
+      // shard names would collide with plaintext names.
+      if (nameIOIface.name() != NullNameIO::CurrentInterface().name())
+        shardedDirs = selectShardedDirs();
       selectBlockMAC(&blockMACBytes, &blockMACRandBytes);
       allowHoles = selectZeroBlockPassThrough();
     }
@@ -936,6 +1014,8 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   EncfsConfig config;
 
   config.mutable_cipher()->MergeFrom(cipher->interface());
+  if (!dataAlg.name.empty())
+    config.mutable_data_cipher()->MergeFrom(dataAlg.iface);
   config.set_block_size(blockSize);
   config.mutable_naming()->MergeFrom(nameIOIface);
   config.set_creator("EncFS " VERSION);
@@ -945,6 +1025,7 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   config.set_unique_iv(uniqueIV);
   config.set_chained_iv(chainedIV);
   config.set_external_iv(externalIV);
+  config.set_sharded_dirs(shardedDirs);
   config.set_allow_holes(allowHoles);
 
   EncryptedKey *key = config.mutable_key();
@@ -1004,6 +1085,14 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   }
 
   cipher->setKey(volumeKey);
+
+  shared_ptr<CipherV1> dataCipher = getDataCipher(config, cipher, volumeKey);
+  if (!dataCipher) {
+    LOG(WARNING) << "Data cipher not supported";
+    cout << _("The file data cipher requested is not available") << endl;
+    return rootInfo;
+  }
+
   if (!saveConfig(rootDir, config)) return rootInfo;
 
   // fill in config struct
@@ -1021,6 +1110,8 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   FSConfigPtr fsConfig(new FSConfig);
   fsConfig->cipher = cipher;
   fsConfig->key = volumeKey;
+  fsConfig->dataCipher = dataCipher;
+  fsConfig->cipherPool.reset(new CipherPool(dataCipher));
   fsConfig->nameCoding = nameCoder;
   fsConfig->config = shared_ptr<EncfsConfig>(new EncfsConfig(config));
   fsConfig->forceDecode = forceDecode;
@@ -1028,6 +1119,21 @@ RootPtr createConfig(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   fsConfig->idleTracking = enableIdleTracking;
   fsConfig->opts = opts;
 
+  if (opts->sharedVolume && !openLeases(fsConfig, rootDir)) return rootInfo;
+
+  if (reverseEncryption && !opts->blockIndexDir.empty())
+    fsConfig->blockIndex.reset(
+        new BlockIndex(opts->blockIndexDir, cipher, config.block_size()));
+
+  if (!reverseEncryption)
+    fsConfig->digests.reset(new PlainDigest(opts->digestCacheDir, cipher,
+                                            !opts->sharedVolume));
+
+  if (opts->groupCommitWindow >= 0)
+    fsConfig->groupCommit.reset(new GroupCommit(opts->groupCommitWindow));
+
+  if (opts->dedupBacking) openDedup(fsConfig, rootDir);
+
   rootInfo = RootPtr(new EncFS_Root);
   rootInfo->cipher = cipher;
   rootInfo->volumeKey = volumeKey;
@@ -1060,6 +1166,19 @@ void showFSInfo(const EncfsConfig &config) {
     }
   }
 
+  if (config.has_data_cipher()) {
+    const Interface &iface = config.data_cipher();
+    cout << autosprintf(
+                // xgroup(diag)
+                _("File data cipher: \"%s\", version %i:%i:%i"),
+                iface.name().c_str(), iface.major(), iface.minor(),
+                iface.age());
+    if (!CipherV1::New(iface, 8 * config.key().size()))
+      cout << _(" (NOT supported)\n");
+    else
+      cout << "\n";
+  }
+
   // xgroup(diag)
   cout << autosprintf(_("Filename encoding: \"%s\", version %i:%i:%i"),
                       config.naming().name().c_str(), config.naming().major(),
@@ -1134,6 +1253,14 @@ void showFSInfo(const EncfsConfig &config) {
     // xgroup(diag)
     cout << _("File data IV is chained to filename IV.\n");
   }
+  if (config.sharded_dirs()) {
+    // xgroup(diag)
+    cout << _("Large directories are sharded.\n");
+  }
+  if (config.packed_files()) {
+    // xgroup(diag)
+    cout << _("Small files may be stored in packs.\n");
+  }
   if (config.allow_holes()) {
     // xgroup(diag)
     cout << _("File holes passed through to ciphertext.\n");
@@ -1149,6 +1276,30 @@ shared_ptr<CipherV1> getCipher(const Interface &iface, int keySize) {
   return CipherV1::New(iface, keySize);
 }
 
+shared_ptr<CipherV1> getDataCipher(const EncfsConfig &config,
+                                   const shared_ptr<CipherV1> &cipher,
+                                   const CipherKey &volumeKey) {
+  if (!config.has_data_cipher()) return cipher;
+
+  shared_ptr<CipherV1> dataCipher =
+      getCipher(config.data_cipher(), 8 * config.key().size());
+  if (!dataCipher) return dataCipher;
+
+  // The volume key is random, so a single PBKDF2 round is enough to derive
+  // an independent key of the right size from it.
+  static const char salt[] = "encfs data cipher";
+  int iterations = 1;
+  CipherKey dataKey = dataCipher->newKey(
+      (const char *)volumeKey.data(), volumeKey.size(), &iterations, 0,
+      (const byte *)salt, sizeof(salt) - 1);
+  if (!dataKey.valid() || !dataCipher->setKey(dataKey)) {
+    LOG(ERROR) << "Unable to key the data cipher";
+    dataCipher.reset();
+  }
+
+  return dataCipher;
+}
+
 CipherKey makeNewKey(EncfsConfig &config, const char *password, int passwdLen) {
   CipherKey userKey;
   shared_ptr<CipherV1> cipher = getCipher(config);
@@ -1406,7 +1557,8 @@ RootPtr initFS(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
   if (readConfig(opts->rootDir, config) != Config_None) {
     if (opts->reverseEncryption) {
       if (config.block_mac_bytes() != 0 || config.block_mac_rand_bytes() != 0 ||
-          config.unique_iv() || config.external_iv() || config.chained_iv()) {
+          config.unique_iv() || config.external_iv() || config.chained_iv() ||
+          config.sharded_dirs() || config.packed_files()) {
         cout
             << _("The configuration loaded is not compatible with --reverse\n");
         return rootInfo;
@@ -1474,15 +1626,44 @@ RootPtr initFS(EncFS_Context *ctx, const shared_ptr<EncFS_Opts> &opts) {
     nameCoder->setChainedNameIV(config.chained_iv());
     nameCoder->setReverseEncryption(opts->reverseEncryption);
 
+    shared_ptr<CipherV1> dataCipher = getDataCipher(config, cipher, volumeKey);
+    if (!dataCipher) {
+      Interface iface = config.data_cipher();
+      LOG(ERROR) << "Unable to find data cipher " << iface.name()
+                 << ", version " << iface.major() << ":" << iface.minor() << ":"
+                 << iface.age();
+      // xgroup(diag)
+      cout << _("The requested file data cipher is not available\n");
+      return rootInfo;
+    }
+
     FSConfigPtr fsConfig(new FSConfig);
     fsConfig->cipher = cipher;
     fsConfig->key = volumeKey;
+    fsConfig->dataCipher = dataCipher;
+    fsConfig->cipherPool.reset(new CipherPool(dataCipher));
     fsConfig->nameCoding = nameCoder;
     fsConfig->config = shared_ptr<EncfsConfig>(new EncfsConfig(config));
     fsConfig->forceDecode = opts->forceDecode;
     fsConfig->reverseEncryption = opts->reverseEncryption;
     fsConfig->opts = opts;
 
+    if (opts->sharedVolume && !openLeases(fsConfig, opts->rootDir))
+      return rootInfo;
+
+    if (opts->reverseEncryption && !opts->blockIndexDir.empty())
+      fsConfig->blockIndex.reset(
+          new BlockIndex(opts->blockIndexDir, cipher, config.block_size()));
+
+    if (!opts->reverseEncryption)
+      fsConfig->digests.reset(new PlainDigest(opts->digestCacheDir, cipher,
+                                              !opts->sharedVolume));
+
+    if (opts->groupCommitWindow >= 0)
+      fsConfig->groupCommit.reset(new GroupCommit(opts->groupCommitWindow));
+
+    if (opts->dedupBacking) openDedup(fsConfig, opts->rootDir);
+
     rootInfo = RootPtr(new EncFS_Root);
     rootInfo->cipher = cipher;
     rootInfo->volumeKey = volumeKey;
@@ -82,6 +82,16 @@ struct EncFS_Opts {
 
   bool reverseEncryption;  // Reverse encryption
 
+  bool sharedVolume;  // volume is mounted by multiple hosts at once
+  bool nfsBacking;    // raw directory is on a network filesystem
+  bool mmapBacking;   // read raw files through memory mappings
+  bool dedupBacking;  // share identical raw blocks
+
+  std::string blockIndexDir;  // where to keep reverse mode block indexes
+  std::string digestCacheDir;  // where to keep plaintext digests
+
+  int groupCommitWindow;  // batch fsync calls (usec), or -1 if disabled
+
   ConfigMode configMode;
 
   EncFS_Opts() {
@@ -95,6 +105,11 @@ struct EncFS_Opts {
     annotate = false;
     ownerCreate = false;
     reverseEncryption = false;
+    sharedVolume = false;
+    nfsBacking = false;
+    mmapBacking = false;
+    dedupBacking = false;
+    groupCommitWindow = -1;
     configMode = Config_Prompt;
   }
 };
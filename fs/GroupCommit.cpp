@@ -0,0 +1,170 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "fs/GroupCommit.h"
+
+#include "base/WorkerPool.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <map>
+
+namespace encfs {
+
+static int syncOne(int fd, bool dataSync) {
+  int res;
+#ifdef linux
+  if (dataSync)
+    res = fdatasync(fd);
+  else
+    res = fsync(fd);
+#else
+  (void)dataSync;
+  res = fsync(fd);
+#endif
+  return (res == -1) ? -errno : 0;
+}
+
+GroupCommit::GroupCommit(int windowUsec)
+    : window(windowUsec), committing(false), commits(0) {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_init(&changed, 0);
+#endif
+}
+
+GroupCommit::~GroupCommit() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_destroy(&changed);
+#endif
+}
+
+uint64_t GroupCommit::commitCount() const {
+  Lock _lock(mutex);
+  return commits;
+}
+
+// Called with the mutex held.
+void GroupCommit::wait() {
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_wait(&changed, &mutex._mutex);
+#endif
+}
+
+int GroupCommit::sync(int fd, bool dataSync) {
+#ifndef CMAKE_USE_PTHREADS_INIT
+  Lock _lock(mutex);
+  ++commits;
+  return syncOne(fd, dataSync);
+#else
+  Request request = {fd, dataSync, 0};
+
+  Lock _lock(mutex);
+
+  shared_ptr<Batch> batch = gathering;
+  if (batch) {
+    size_t index = batch->requests.size();
+    batch->requests.push_back(request);
+    while (!batch->done) wait();
+    return batch->requests[index].result;
+  }
+
+  batch.reset(new Batch);
+  batch->requests.push_back(request);
+  gathering = batch;
+
+  // Give others a chance to join, then wait for the previous batch.  Requests
+  // arriving while a commit is running are grouped into the next one.
+  if (window > 0) {
+    mutex.unlock();
+    usleep(window);
+    mutex.lock();
+  }
+  while (committing) wait();
+
+  gathering.reset();
+  committing = true;
+  ++commits;
+
+  mutex.unlock();
+  commit(batch.get());
+  mutex.lock();
+
+  committing = false;
+  batch->done = true;
+  pthread_cond_broadcast(&changed);
+
+  return batch->requests[0].result;
+#endif
+}
+
+void GroupCommit::commit(Batch *batch) {
+  std::vector<Request> &requests = batch->requests;
+  VLOG(1) << "committing " << requests.size() << " sync requests";
+
+  if (requests.size() == 1) {
+    requests[0].result = syncOne(requests[0].fd, requests[0].dataSync);
+    return;
+  }
+
+#ifdef HAVE_SYNCFS
+  // syncfs only flushes one filesystem, and the members of a batch may be on
+  // different ones (bind mounts or submounts below the raw root), so there
+  // is one syncfs per device.  A writeback error is reported by syncfs for
+  // the whole filesystem, so it is passed on to every caller on it.
+  std::map<dev_t, int> synced;
+  std::vector<size_t> separate;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    struct stat st;
+    if (fstat(requests[i].fd, &st) == -1) {
+      requests[i].result = -errno;
+      continue;
+    }
+
+    std::map<dev_t, int>::const_iterator it = synced.find(st.st_dev);
+    if (it == synced.end()) {
+      int res = (syncfs(requests[i].fd) == -1) ? -errno : 0;
+      it = synced.insert(std::make_pair(st.st_dev, res)).first;
+    }
+
+    if (it->second == -EBADF || it->second == -ENOSYS)
+      separate.push_back(i);
+    else
+      requests[i].result = it->second;
+  }
+  if (separate.empty()) return;
+  VLOG(1) << "syncfs unavailable, syncing files separately";
+
+  WorkerPool::Default()->parallelFor(separate.size(),
+                                     [&requests, &separate](int i) {
+    Request &request = requests[separate[i]];
+    request.result = syncOne(request.fd, request.dataSync);
+  });
+#else
+  WorkerPool::Default()->parallelFor(requests.size(), [&requests](int i) {
+    requests[i].result = syncOne(requests[i].fd, requests[i].dataSync);
+  });
+#endif
+}
+
+}  // namespace encfs
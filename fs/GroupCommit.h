@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GroupCommit_incl_
+#define _GroupCommit_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <vector>
+
+namespace encfs {
+
+/*
+    Batches fsync requests for the backing filesystem (--group-commit).
+
+    The first caller to arrive becomes the leader of a new batch.  It waits
+    for a short window (and for any commit already in progress) so that other
+    callers can join, then closes the batch and commits it for everyone:
+
+    - a batch with several requests is committed with a single syncfs() per
+      backing filesystem it touches, where available,
+    - otherwise each descriptor is synced, all at the same time, so that the
+      filesystem can merge them into one journal commit.
+
+    Every caller blocks until the batch it joined has been committed, so the
+    durability guarantee of fsync is unchanged.  A writeback error seen by
+    syncfs() is returned to every member of the batch on that filesystem.  A
+    batch is only closed after all of its members have asked for the sync, so
+    any data they wrote before calling sync() is covered.
+*/
+class GroupCommit {
+ public:
+  // window is the time, in microseconds, a leader waits for others to join.
+  explicit GroupCommit(int windowUsec);
+  ~GroupCommit();
+
+  // Flushes fd to stable storage, like fdatasync() (or fsync() when dataSync
+  // is false).  Returns 0 on success, or -errno.
+  int sync(int fd, bool dataSync);
+
+  // Number of commits issued so far.  Each commit satisfies one batch.
+  uint64_t commitCount() const;
+
+ private:
+  struct Request {
+    int fd;
+    bool dataSync;
+    int result;
+  };
+
+  struct Batch {
+    std::vector<Request> requests;
+    bool done;
+    Batch() : done(false) {}
+  };
+
+  void wait();
+  void commit(Batch *batch);
+
+  int window;
+
+  mutable Mutex mutex;
+#ifdef CMAKE_USE_PTHREADS_INIT
+  pthread_cond_t changed;
+#endif
+  shared_ptr<Batch> gathering;  // batch which new requests join
+  bool committing;
+  uint64_t commits;
+
+  GroupCommit(const GroupCommit &);
+  GroupCommit &operator=(const GroupCommit &);
+};
+
+}  // namespace encfs
+
+#endif
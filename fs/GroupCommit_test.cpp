@@ -0,0 +1,135 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "fs/GroupCommit.h"
+
+using namespace encfs;
+using std::string;
+
+namespace {
+
+const int ThreadCount = 8;
+
+struct SyncCall {
+  GroupCommit *group;
+  int fd;
+  int result;
+};
+
+void *doSync(void *arg) {
+  SyncCall *call = static_cast<SyncCall *>(arg);
+  call->result = call->group->sync(call->fd, true);
+  return 0;
+}
+
+class GroupCommitTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-commit-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+  }
+
+  virtual void TearDown() {
+    for (size_t i = 0; i < files.size(); ++i) unlink(files[i].c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  int createFile(int i) {
+    string path = rootDir + "/file" + std::to_string(i);
+    files.push_back(path);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    EXPECT_LE(0, fd);
+    EXPECT_EQ(5, ::write(fd, "hello", 5));
+    return fd;
+  }
+
+  // Calls sync on all descriptors at once, from separate threads.
+  void syncAll(GroupCommit *group, SyncCall *calls, int count) {
+    pthread_t threads[ThreadCount];
+    for (int i = 0; i < count; ++i) {
+      calls[i].group = group;
+      ASSERT_EQ(0, pthread_create(&threads[i], 0, doSync, &calls[i]));
+    }
+    for (int i = 0; i < count; ++i) pthread_join(threads[i], 0);
+  }
+
+  string rootDir;
+  std::vector<string> files;
+};
+
+TEST_F(GroupCommitTest, SingleSync) {
+  GroupCommit group(0);
+  int fd = createFile(0);
+
+  EXPECT_EQ(0, group.sync(fd, true));
+  EXPECT_EQ(0, group.sync(fd, false));
+  EXPECT_EQ(2u, group.commitCount());
+
+  ::close(fd);
+}
+
+TEST_F(GroupCommitTest, BatchesConcurrentCalls) {
+  // long window, so that all threads join the first batch.
+  GroupCommit group(100000);
+
+  SyncCall calls[ThreadCount];
+  for (int i = 0; i < ThreadCount; ++i) calls[i].fd = createFile(i);
+
+  syncAll(&group, calls, ThreadCount);
+
+  for (int i = 0; i < ThreadCount; ++i) {
+    EXPECT_EQ(0, calls[i].result);
+    ::close(calls[i].fd);
+  }
+  EXPECT_LE(1u, group.commitCount());
+  EXPECT_GT((uint64_t)ThreadCount, group.commitCount());
+}
+
+TEST_F(GroupCommitTest, ErrorsReportedPerCall) {
+  GroupCommit group(100000);
+
+  SyncCall calls[ThreadCount];
+  for (int i = 0; i < ThreadCount; ++i)
+    calls[i].fd = (i % 2) ? createFile(i) : -1;
+
+  syncAll(&group, calls, ThreadCount);
+
+  for (int i = 0; i < ThreadCount; ++i) {
+    if (i % 2) {
+      EXPECT_EQ(0, calls[i].result);
+      ::close(calls[i].fd);
+    } else {
+      EXPECT_EQ(-EBADF, calls[i].result);
+    }
+  }
+}
+
+}  // namespace
@@ -19,16 +19,25 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <list>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "fs/testing.h"
 
+#include "base/Error.h"
+#include "cipher/CipherPool.h"
 #include "cipher/MemoryPool.h"
 
 #include "fs/CipherFileIO.h"
+#include "fs/FileNode.h"
 #include "fs/FileUtils.h"
 #include "fs/FSConfig.h"
+#include "fs/fsconfig.pb.h"
 #include "fs/MACFileIO.h"
 #include "fs/MemFileIO.h"
 
@@ -72,6 +81,70 @@ TEST(IOTest, NullMacIO) { runWithCipher("Null", 512, testMacIO); }
 
 TEST(IOTest, MacIO) { runWithAllCiphers(testMacIO); }
 
+void testMacHeaderIO(FSConfigPtr& cfg) {
+  cfg->config->set_block_mac_bytes(8);
+  cfg->config->set_block_mac_rand_bytes(4);
+  testMacIO(cfg);
+}
+
+TEST(IOTest, MacHeaderIO) { runWithAllCiphers(testMacHeaderIO); }
+
+void testMacBatch(FSConfigPtr& cfg) {
+  cfg->config->set_block_mac_bytes(8);
+
+  shared_ptr<MemFileIO> baseA(new MemFileIO(0));
+  shared_ptr<MACFileIO> a(new MACFileIO(baseA, cfg));
+  shared_ptr<MemFileIO> baseB(new MemFileIO(0));
+  shared_ptr<MACFileIO> b(new MACFileIO(baseB, cfg));
+
+  int bs = a->blockSize();
+  const int size = 40 * bs + 33;
+  std::vector<byte> data(size);
+  cfg->cipher->pseudoRandomize(&data[0], size);
+
+  // a is written in one request, which is done as a batch.
+  IORequest req;
+  req.offset = 0;
+  req.data = &data[0];
+  req.dataLen = size;
+  ASSERT_TRUE(a->write(req));
+
+  // b is written one block at a time.
+  for (int offset = 0; offset < size; offset += bs) {
+    req.offset = offset;
+    req.data = &data[offset];
+    req.dataLen = std::min(bs, size - offset);
+    ASSERT_TRUE(b->write(req));
+  }
+
+  // both produce the same stored format.
+  ASSERT_EQ(baseA->getSize(), baseB->getSize());
+  compare(baseA.get(), baseB.get(), 0, baseA->getSize());
+
+  std::vector<byte> buf(size);
+  req.offset = 0;
+  req.data = &buf[0];
+  req.dataLen = size;
+  ASSERT_EQ(size, b->read(req));
+  ASSERT_TRUE(memcmp(&data[0], &buf[0], size) == 0);
+
+  // damage a block in the middle, which a batched read must notice.
+  byte junk;
+  IORequest damage;
+  damage.offset = 20 * (bs + 8) + 100;
+  damage.data = &junk;
+  damage.dataLen = 1;
+  ASSERT_EQ(1, baseB->read(damage));
+  junk ^= 0x55;
+  ASSERT_TRUE(baseB->write(damage));
+  b->invalidateCache();
+
+  req.offset = 0;
+  EXPECT_THROW(b->read(req), Error);
+}
+
+TEST(IOTest, MacBatch) { runWithAllCiphers(testMacBatch); }
+
 void testBasicCipherIO(FSConfigPtr& cfg) {
   shared_ptr<MemFileIO> base(new MemFileIO(0));
   shared_ptr<CipherFileIO> test(new CipherFileIO(base, cfg));
@@ -113,4 +186,288 @@ TEST(IOTest, NullCipherFileIO) { runWithCipher("Null", 512, testCipherIO); }
 
 TEST(IOTest, CipherFileIO) { runWithAllCiphers(testCipherIO); }
 
+void testReverseReadAhead(FSConfigPtr& cfg) {
+  cfg->reverseEncryption = true;
+  int bs = cfg->config->block_size();
+
+  // enough for several read-ahead windows, ending with a partial block.
+  const int blocks = (3 * 256 * 1024) / bs;
+  const int size = blocks * bs + 77;
+  std::vector<byte> plain(size);
+  cfg->cipher->pseudoRandomize(&plain[0], size);
+
+  shared_ptr<MemFileIO> base(new MemFileIO(0));
+  IORequest req;
+  req.offset = 0;
+  req.data = &plain[0];
+  req.dataLen = size;
+  ASSERT_TRUE(base->write(req));
+
+  std::vector<byte> expected(plain);
+  for (int i = 0; i <= blocks; ++i) {
+    int len = (i == blocks) ? size - i * bs : bs;
+    if (len == bs)
+      ASSERT_TRUE(cfg->cipher->blockEncode(&expected[i * bs], len, i));
+    else
+      ASSERT_TRUE(cfg->cipher->streamEncode(&expected[i * bs], len, i));
+  }
+
+  shared_ptr<CipherFileIO> test(new CipherFileIO(base, cfg));
+  std::vector<byte> buf(size);
+
+  // sequential reads, which trigger read-ahead.
+  for (int offset = 0; offset < size; offset += 4096) {
+    req.offset = offset;
+    req.data = &buf[offset];
+    req.dataLen = std::min(4096, size - offset);
+    ASSERT_EQ(req.dataLen, test->read(req));
+  }
+  ASSERT_TRUE(memcmp(&expected[0], &buf[0], size) == 0);
+
+  // scattered reads.
+  for (int i = 0; i < 20; ++i) {
+    int block = (i * 7919) % blocks;
+    req.offset = block * bs;
+    req.data = &buf[0];
+    req.dataLen = bs;
+    ASSERT_EQ(bs, test->read(req));
+    ASSERT_TRUE(memcmp(&expected[block * bs], &buf[0], bs) == 0);
+  }
+}
+
+void testPartialBlockRead(FSConfigPtr& cfg) {
+  cfg->config->set_unique_iv(true);
+  int bs = cfg->config->block_size();
+
+  shared_ptr<MemFileIO> base(new MemFileIO(0));
+  shared_ptr<CipherFileIO> writer(new CipherFileIO(base, cfg));
+  ASSERT_LE(0, writer->open(O_RDWR));
+
+  // full blocks, then a partial (stream encoded) one.
+  const int size = 8 * bs + 100;
+  std::vector<byte> data(size);
+  cfg->cipher->pseudoRandomize(&data[0], size);
+
+  // writes are encoded in place.
+  std::vector<byte> tmp(data);
+  IORequest req;
+  req.offset = 0;
+  req.data = &tmp[0];
+  req.dataLen = size;
+  ASSERT_TRUE(writer->write(req));
+
+  // read back through a new instance, so nothing is cached.
+  shared_ptr<CipherFileIO> reader(new CipherFileIO(base, cfg));
+
+  byte buf[64];
+  for (int i = 0; i < 200; ++i) {
+    int len = 1 + (i * 37) % sizeof(buf);
+    int offset = (i * 7919) % (size - len);
+    // every few reads, start at the beginning of a block.
+    if (i % 5 == 0) offset = ((offset / bs) * bs);
+
+    req.offset = offset;
+    req.data = buf;
+    req.dataLen = len;
+    ASSERT_EQ(len, reader->read(req));
+    ASSERT_TRUE(memcmp(&data[offset], buf, len) == 0) << "offset " << offset
+                                                      << ", length " << len;
+  }
+}
+
+TEST(IOTest, PartialBlockRead) { runWithAllCiphers(testPartialBlockRead); }
+
+void testPartialHoleRead(FSConfigPtr& cfg) {
+  cfg->config->set_allow_holes(true);
+  int bs = cfg->config->block_size();
+
+  shared_ptr<MemFileIO> base(new MemFileIO(0));
+  shared_ptr<CipherFileIO> writer(new CipherFileIO(base, cfg));
+  ASSERT_LE(0, writer->open(O_RDWR));
+
+  // blocks 1 to 4 are left as a hole.
+  std::vector<byte> data(bs, 'x');
+  IORequest req;
+  req.offset = 0;
+  req.data = &data[0];
+  req.dataLen = bs;
+  ASSERT_TRUE(writer->write(req));
+  data.assign(bs, 'y');
+  req.offset = 5 * bs;
+  ASSERT_TRUE(writer->write(req));
+
+  shared_ptr<CipherFileIO> reader(new CipherFileIO(base, cfg));
+  byte buf[32];
+  byte zeros[sizeof(buf)];
+  memset(zeros, 0, sizeof(zeros));
+  for (int offset = bs; offset < 5 * bs; offset += bs / 2 + 16) {
+    memset(buf, 0xff, sizeof(buf));
+    req.offset = offset;
+    req.data = buf;
+    req.dataLen = sizeof(buf);
+    ASSERT_EQ((ssize_t)sizeof(buf), reader->read(req));
+    ASSERT_TRUE(memcmp(zeros, buf, sizeof(buf)) == 0) << "offset " << offset;
+  }
+}
+
+TEST(IOTest, PartialHoleRead) { runWithAllCiphers(testPartialHoleRead); }
+
+TEST(IOTest, ReverseReadAhead) { runWithAllCiphers(testReverseReadAhead); }
+
+void testAdjustedSize(FSConfigPtr& cfg) {
+  cfg->config->set_unique_iv(true);
+  cfg->config->set_block_mac_bytes(8);
+  cfg->config->set_block_mac_rand_bytes(4);
+
+  shared_ptr<MemFileIO> base(new MemFileIO(0));
+  shared_ptr<CipherFileIO> cipherIO(new CipherFileIO(base, cfg));
+  shared_ptr<MACFileIO> test(new MACFileIO(cipherIO, cfg));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  // the static size adjustments must match the stack, for any file size.
+  std::vector<byte> data(5 * cfg->config->block_size());
+  int sizes[] = {1, 7, test->blockSize() - 1, test->blockSize(),
+                 test->blockSize() + 1, 3 * test->blockSize() + 17};
+  for (int size : sizes) {
+    ASSERT_EQ(0, test->truncate(0));
+    IORequest req;
+    req.offset = 0;
+    req.data = &data[0];
+    req.dataLen = size;
+    ASSERT_TRUE(test->write(req));
+
+    off_t rawSize = base->getSize();
+    off_t plainSize = MACFileIO::AdjustedSize(
+        cfg, CipherFileIO::AdjustedSize(cfg, rawSize));
+    ASSERT_EQ(size, test->getSize());
+    ASSERT_EQ(size, plainSize) << "raw size " << rawSize;
+  }
+}
+
+TEST(IOTest, AdjustedSize) { runWithAllCiphers(testAdjustedSize); }
+
+// Writes data through a CipherFileIO and returns the raw bytes.
+static std::vector<byte> rawWrite(FSConfigPtr& cfg,
+                                  const std::vector<byte>& data) {
+  shared_ptr<MemFileIO> base(new MemFileIO(0));
+  shared_ptr<CipherFileIO> test(new CipherFileIO(base, cfg));
+  EXPECT_LE(0, test->open(O_RDWR));
+
+  std::vector<byte> tmp(data);
+  IORequest req;
+  req.offset = 0;
+  req.data = &tmp[0];
+  req.dataLen = tmp.size();
+  EXPECT_TRUE(test->write(req));
+
+  std::vector<byte> buf(data.size());
+  req.data = &buf[0];
+  EXPECT_EQ((ssize_t)buf.size(), test->read(req));
+  EXPECT_TRUE(buf == data);
+
+  std::vector<byte> raw(base->getSize());
+  req.data = &raw[0];
+  req.dataLen = raw.size();
+  EXPECT_EQ((ssize_t)raw.size(), base->read(req));
+  return raw;
+}
+
+TEST(IOTest, SeparateDataCipher) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("AES", 128), 512);
+  cfg->config->mutable_key()->set_size(16);
+
+  std::vector<byte> data(3 * 512 + 100);
+  cfg->cipher->pseudoRandomize(&data[0], data.size());
+
+  std::vector<byte> named = rawWrite(cfg, data);
+  EXPECT_FALSE(named == data);
+
+  // full blocks stored as is, while the names cipher is unchanged.
+  cfg->config->mutable_data_cipher()->MergeFrom(
+      CipherV1::New("Null")->interface());
+  cfg->dataCipher = getDataCipher(*cfg->config, cfg->cipher, cfg->key);
+  ASSERT_TRUE(cfg->dataCipher != NULL);
+  ASSERT_TRUE(cfg->dataCipher != cfg->cipher);
+  cfg->cipherPool.reset(new CipherPool(cfg->dataCipher));
+  std::vector<byte> plain = rawWrite(cfg, data);
+  ASSERT_EQ(data.size(), plain.size());
+  EXPECT_EQ(0, memcmp(&data[0], &plain[0], 3 * 512));
+
+  // the same algorithm again, with a key derived from the volume key.
+  cfg->config->mutable_data_cipher()->MergeFrom(cfg->cipher->interface());
+  cfg->dataCipher = getDataCipher(*cfg->config, cfg->cipher, cfg->key);
+  ASSERT_TRUE(cfg->dataCipher != NULL);
+  cfg->cipherPool.reset(new CipherPool(cfg->dataCipher));
+  std::vector<byte> raw = rawWrite(cfg, data);
+  EXPECT_FALSE(raw == data);
+  EXPECT_FALSE(raw == named);
+}
+
+// Block MACs stay keyed by the volume cipher when contents aren't encrypted.
+TEST(IOTest, NullDataCipherMAC) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("AES", 128), 512);
+  cfg->config->mutable_key()->set_size(16);
+  cfg->config->mutable_data_cipher()->MergeFrom(
+      CipherV1::New("Null")->interface());
+  cfg->dataCipher = getDataCipher(*cfg->config, cfg->cipher, cfg->key);
+  ASSERT_TRUE(cfg->dataCipher != NULL);
+  cfg->cipherPool.reset(new CipherPool(cfg->dataCipher));
+  cfg->config->set_block_mac_bytes(8);
+
+  shared_ptr<MemFileIO> base(new MemFileIO(0));
+  shared_ptr<MACFileIO> test(new MACFileIO(base, cfg));
+  int bs = test->blockSize();
+
+  std::vector<byte> data(bs);
+  cfg->cipher->pseudoRandomize(&data[0], data.size());
+  IORequest req;
+  req.offset = 0;
+  req.data = &data[0];
+  req.dataLen = bs;
+  ASSERT_TRUE(test->write(req));
+
+  std::vector<byte> raw(bs + 8);
+  req.data = &raw[0];
+  req.dataLen = raw.size();
+  ASSERT_EQ((ssize_t)raw.size(), base->read(req));
+
+  uint64_t mac = cfg->cipher->MAC_64(&data[0], bs);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(mac & 0xff, raw[i]);
+    mac >>= 8;
+  }
+}
+
+TEST(IOTest, NullDataStoredAsIs) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("AES", 128), 512);
+  cfg->config->mutable_key()->set_size(16);
+  cfg->config->mutable_data_cipher()->MergeFrom(
+      CipherV1::New("Null")->interface());
+  cfg->dataCipher = getDataCipher(*cfg->config, cfg->cipher, cfg->key);
+  ASSERT_TRUE(cfg->dataCipher != NULL);
+
+  char path[] = "/tmp/encfs-io-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_LE(0, fd);
+
+  std::vector<byte> data(3 * 512 + 100);
+  cfg->cipher->pseudoRandomize(&data[0], data.size());
+  {
+    FileNode node(NULL, cfg, "/file", path);
+    ASSERT_LE(0, node.open(O_RDWR));
+
+    std::vector<byte> tmp(data);
+    ASSERT_TRUE(node.write(0, &tmp[0], tmp.size()));
+    EXPECT_EQ((off_t)data.size(), node.getSize());
+  }
+
+  // the backing file holds the data unchanged, partial block included.
+  std::vector<byte> raw(data.size() + 1);
+  EXPECT_EQ((ssize_t)data.size(), pread(fd, &raw[0], raw.size(), 0));
+  EXPECT_EQ(0, memcmp(&data[0], &raw[0], data.size()));
+
+  close(fd);
+  unlink(path);
+}
+
 }  // namespace
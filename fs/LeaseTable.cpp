@@ -0,0 +1,138 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/LeaseTable.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace encfs {
+
+const char *LeaseTable::FileName = ".encfs-leases";
+
+// Number of epoch slots.  32KB of table is enough to keep collisions rare for
+// the set of files that are open at any one time.
+static const int DefaultSlotCount = 4096;
+static const int SlotSize = sizeof(uint64_t);
+
+LeaseTable::LeaseTable(int fd_, int slots_) : fd(fd_), slots(slots_) {}
+
+LeaseTable::~LeaseTable() {
+  if (fd >= 0) ::close(fd);
+}
+
+shared_ptr<LeaseTable> LeaseTable::Open(const std::string &rootDir) {
+  std::string path = rootDir;
+  if (path.empty() || path[path.length() - 1] != '/') path.append(1, '/');
+  path.append(FileName);
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LOG(ERROR) << "unable to open lease table " << path << ": "
+               << strerror(errno);
+    return shared_ptr<LeaseTable>();
+  }
+
+  // Extending the file is idempotent, so it is safe for several hosts to do
+  // this at the same time.  The new slots read as 0.
+  off_t tableSize = (off_t)DefaultSlotCount * SlotSize;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size < tableSize && ::ftruncate(fd, tableSize) != 0)) {
+    LOG(ERROR) << "unable to size lease table " << path << ": "
+               << strerror(errno);
+    ::close(fd);
+    return shared_ptr<LeaseTable>();
+  }
+
+  VLOG(1) << "opened lease table " << path;
+  return shared_ptr<LeaseTable>(new LeaseTable(fd, DefaultSlotCount));
+}
+
+int LeaseTable::slotCount() const { return slots; }
+
+off_t LeaseTable::slotOffset(ino_t inode) const {
+  // multiplicative hash, so that sequentially allocated inodes spread out.
+  uint64_t h = (uint64_t)inode * 0x9E3779B97F4A7C15ULL;
+  return (off_t)((h >> 32) % slots) * SlotSize;
+}
+
+bool LeaseTable::lockSlot(off_t offset, short type) const {
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = offset;
+  fl.l_len = SlotSize;
+
+  int res;
+  do {
+    res = fcntl(fd, F_SETLKW, &fl);
+  } while (res == -1 && errno == EINTR);
+
+  LOG_IF(WARNING, res == -1) << "lease lock failed: " << strerror(errno);
+  return res == 0;
+}
+
+static uint64_t readSlot(int fd, off_t offset) {
+  unsigned char buf[SlotSize];
+  if (pread(fd, buf, SlotSize, offset) != SlotSize) return 0;
+
+  uint64_t value = 0;
+  for (int i = SlotSize - 1; i >= 0; --i) value = (value << 8) | buf[i];
+  return value;
+}
+
+uint64_t LeaseTable::epoch(ino_t inode) const {
+  off_t offset = slotOffset(inode);
+
+  Lock _lock(mutex);
+  bool locked = lockSlot(offset, F_RDLCK);
+  uint64_t value = readSlot(fd, offset);
+  if (locked) lockSlot(offset, F_UNLCK);
+
+  return value;
+}
+
+uint64_t LeaseTable::bump(ino_t inode) {
+  off_t offset = slotOffset(inode);
+
+  Lock _lock(mutex);
+  bool locked = lockSlot(offset, F_WRLCK);
+  uint64_t value = readSlot(fd, offset) + 1;
+
+  unsigned char buf[SlotSize];
+  uint64_t tmp = value;
+  for (int i = 0; i < SlotSize; ++i, tmp >>= 8) buf[i] = tmp & 0xff;
+
+  if (pwrite(fd, buf, SlotSize, offset) != SlotSize)
+    LOG(WARNING) << "lease update failed: " << strerror(errno);
+
+  if (locked) lockSlot(offset, F_UNLCK);
+
+  return value;
+}
+
+}  // namespace encfs
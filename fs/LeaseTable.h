@@ -0,0 +1,87 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LeaseTable_incl_
+#define _LeaseTable_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <string>
+
+namespace encfs {
+
+/*
+    Lease table for volumes which are mounted by more then one host at a time
+    (eg. a backing directory on NFS).
+
+    The table is a small file stored in the root of the backing directory.  It
+    holds a fixed number of 64 bit epoch counters, and every backing inode
+    hashes to one of them.  A host which modifies a file bumps the epoch after
+    the data has reached the backing store.  A host which caches data for a
+    file remembers the epoch it saw when the cache was filled, and must drop
+    the cache once the epoch changes.  Hash collisions only cause spurious
+    cache invalidation.
+
+    Each slot is guarded by a POSIX byte-range lock.  Besides serializing
+    updates, taking the lock forces NFS clients to revalidate their cached
+    copy of the table, which is what makes the epochs visible across hosts.
+    Record locks don't exclude other threads of the same process, so threads
+    of this mount are serialized by a mutex as well.
+*/
+class LeaseTable {
+ public:
+  static const char *FileName;
+
+  ~LeaseTable();
+
+  // Opens (or creates) the lease table in the given backing directory.
+  // Returns an empty pointer on failure.
+  static shared_ptr<LeaseTable> Open(const std::string &rootDir);
+
+  // current epoch of the lease slot for the given inode.
+  uint64_t epoch(ino_t inode) const;
+
+  // increment the epoch for the given inode and return the new value.
+  uint64_t bump(ino_t inode);
+
+  int slotCount() const;
+
+ private:
+  LeaseTable(int fd, int slots);
+
+  off_t slotOffset(ino_t inode) const;
+  bool lockSlot(off_t offset, short type) const;
+
+  int fd;
+  int slots;
+
+  // held around the byte-range locked sections.
+  mutable Mutex mutex;
+
+  LeaseTable(const LeaseTable &);
+  LeaseTable &operator=(const LeaseTable &);
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,146 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "fs/testing.h"
+#include "fs/FileNode.h"
+#include "fs/FSConfig.h"
+#include "fs/LeaseTable.h"
+
+using namespace encfs;
+using std::string;
+
+namespace {
+
+class LeaseTableTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-lease-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+  }
+
+  virtual void TearDown() {
+    unlink((rootDir + "/file").c_str());
+    unlink((rootDir + "/" + LeaseTable::FileName).c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  // Each config represents a separate mount of the same raw directory.
+  FSConfigPtr makeMount(const FSConfigPtr &base) {
+    FSConfigPtr cfg(new FSConfig(*base));
+    cfg->leases = LeaseTable::Open(rootDir);
+    return cfg;
+  }
+
+  string rootDir;
+};
+
+TEST_F(LeaseTableTest, EpochVisibleToOtherInstance) {
+  shared_ptr<LeaseTable> a = LeaseTable::Open(rootDir);
+  shared_ptr<LeaseTable> b = LeaseTable::Open(rootDir);
+  ASSERT_TRUE(a.get() != NULL);
+  ASSERT_TRUE(b.get() != NULL);
+
+  EXPECT_EQ(0u, b->epoch(1234));
+  EXPECT_EQ(1u, a->bump(1234));
+  EXPECT_EQ(2u, a->bump(1234));
+  EXPECT_EQ(2u, b->epoch(1234));
+  EXPECT_EQ(3u, b->bump(1234));
+  EXPECT_EQ(3u, a->epoch(1234));
+}
+
+void *bumpMany(void *arg) {
+  LeaseTable *table = (LeaseTable *)arg;
+  for (int i = 0; i < 1000; ++i) table->bump(1234);
+  return NULL;
+}
+
+// Record locks don't exclude threads of one process, so nothing may be lost
+// when the workers of one mount bump at the same time.
+TEST_F(LeaseTableTest, ConcurrentBumps) {
+  shared_ptr<LeaseTable> table = LeaseTable::Open(rootDir);
+  ASSERT_TRUE(table.get() != NULL);
+
+  pthread_t threads[4];
+  for (int i = 0; i < 4; ++i)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, bumpMany, table.get()));
+  for (int i = 0; i < 4; ++i) pthread_join(threads[i], NULL);
+
+  EXPECT_EQ(4000u, table->epoch(1234));
+}
+
+TEST_F(LeaseTableTest, SharedFileNodes) {
+  FSConfigPtr base = makeConfig(CipherV1::New("Null"), 512);
+  FSConfigPtr cfgA = makeMount(base);
+  FSConfigPtr cfgB = makeMount(base);
+  ASSERT_TRUE(cfgA->leases.get() != NULL);
+  ASSERT_TRUE(cfgB->leases.get() != NULL);
+
+  string path = rootDir + "/file";
+  FileNode nodeA(NULL, cfgA, "file", path.c_str());
+  FileNode nodeB(NULL, cfgB, "file", path.c_str());
+
+  ASSERT_EQ(0, nodeA.mknod(S_IFREG | 0600, 0));
+  ASSERT_LE(0, nodeA.open(O_RDWR));
+  ASSERT_LE(0, nodeB.open(O_RDWR));
+
+  unsigned char buf[16];
+  memset(buf, 'a', sizeof(buf));
+  ASSERT_TRUE(nodeA.write(0, buf, sizeof(buf)));
+  ASSERT_EQ(0, nodeA.flush());
+
+  // fills the block cache in B.
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ((ssize_t)sizeof(buf), nodeB.read(0, buf, sizeof(buf)));
+  EXPECT_EQ('a', buf[0]);
+
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  uint64_t epoch = cfgA->leases->epoch(st.st_ino);
+
+  // changes are published once, when the file is flushed.
+  memset(buf, 'b', sizeof(buf));
+  ASSERT_TRUE(nodeA.write(0, buf, sizeof(buf)));
+  ASSERT_TRUE(nodeA.write(sizeof(buf), buf, sizeof(buf)));
+  EXPECT_EQ(epoch, cfgA->leases->epoch(st.st_ino));
+  ASSERT_EQ(0, nodeA.flush());
+  EXPECT_EQ(epoch + 1, cfgA->leases->epoch(st.st_ino));
+
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ((ssize_t)sizeof(buf), nodeB.read(0, buf, sizeof(buf)));
+  EXPECT_EQ('b', buf[0]);
+  EXPECT_EQ((off_t)(2 * sizeof(buf)), nodeB.getSize());
+
+  ASSERT_EQ(0, nodeB.truncate(4));
+  ASSERT_EQ(0, nodeB.sync(true));
+  EXPECT_EQ(4, nodeA.getSize());
+}
+
+}  // namespace
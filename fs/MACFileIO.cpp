@@ -28,6 +28,7 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cstring>
 
 namespace encfs {
@@ -61,6 +62,9 @@ MACFileIO::MACFileIO(const shared_ptr<FileIO> &_base, const FSConfigPtr &cfg)
       warnOnly(cfg->opts->forceDecode) {
   rAssert(macBytes >= 0 && macBytes <= 8);
   rAssert(randBytes >= 0);
+  // MACs are keyed by the volume cipher, even when contents use a separate
+  // (possibly Null) data cipher.  The pool only holds copies of the latter.
+  if (cfg->dataCipher == cfg->cipher) cipherPool = cfg->cipherPool;
   VLOG(1) << "fs block size = " << cfg->config->block_size()
           << ", macBytes = " << cfg->config->block_mac_bytes()
           << ", randBytes = " << cfg->config->block_mac_rand_bytes();
@@ -112,6 +116,12 @@ static off_t locWithoutHeader(off_t offset, int blockSize, int headerSize) {
   return offset - blockNum * headerSize;
 }
 
+off_t MACFileIO::AdjustedSize(const FSConfigPtr &cfg, off_t size) {
+  int headerSize =
+      cfg->config->block_mac_bytes() + cfg->config->block_mac_rand_bytes();
+  return locWithoutHeader(size, cfg->config->block_size(), headerSize);
+}
+
 int MACFileIO::getAttr(struct stat *stbuf) const {
   int res = base->getAttr(stbuf);
 
@@ -152,36 +162,12 @@ ssize_t MACFileIO::readOneBlock(const IORequest &req) const {
   // get the data from the base FileIO layer
   ssize_t readSize = base->read(tmp);
 
-  // don't store zeros if configured for zero-block pass-through
-  bool skipBlock = true;
-  if (_allowHoles) {
-    for (int i = 0; i < readSize; ++i)
-      if (tmp.data[i] != 0) {
-        skipBlock = false;
-        break;
-      }
-  } else if (macBytes > 0)
-    skipBlock = false;
-
   if (readSize > headerSize) {
-    if (!skipBlock) {
+    if (needsCheck(tmp.data, readSize)) {
       // At this point the data has been decoded.  So, compute the MAC of
       // the block and check against the checksum stored in the header..
-      uint64_t mac = cipher->MAC_64(tmp.data + macBytes, readSize - macBytes);
-
-      for (int i = 0; i < macBytes; ++i, mac >>= 8) {
-        int test = mac & 0xff;
-        int stored = tmp.data[i];
-        if (test != stored) {
-          // uh oh..
-          long blockNum = req.offset / bs;
-          LOG(WARNING) << "MAC comparison failure in block " << blockNum;
-          if (!warnOnly) {
-            throw Error(_("MAC comparison failure, refusing to read"));
-          }
-          break;
-        }
-      }
+      uint64_t mac = coder()->MAC_64(tmp.data + macBytes, readSize - macBytes);
+      checkMAC(tmp.data, mac, req.offset / bs);
     }
 
     // now copy the data to the output buffer
@@ -219,7 +205,7 @@ bool MACFileIO::writeOneBlock(const IORequest &req) {
   if (macBytes > 0) {
     // compute the mac (which includes the random data) and fill it in
     uint64_t mac =
-        cipher->MAC_64(newReq.data + macBytes, req.dataLen + randBytes);
+        coder()->MAC_64(newReq.data + macBytes, req.dataLen + randBytes);
 
     for (int i = 0; i < macBytes; ++i) {
       newReq.data[i] = mac & 0xff;
@@ -233,6 +219,146 @@ bool MACFileIO::writeOneBlock(const IORequest &req) {
   return ok;
 }
 
+bool MACFileIO::needsCheck(const unsigned char *block, int len) const {
+  if (macBytes == 0) return false;
+
+  // don't check zeros if configured for zero-block pass-through
+  if (_allowHoles) {
+    for (int i = 0; i < len; ++i)
+      if (block[i] != 0) return true;
+    return false;
+  }
+
+  return true;
+}
+
+void MACFileIO::checkMAC(const unsigned char *block, uint64_t mac,
+                         off_t blockNum) const {
+  for (int i = 0; i < macBytes; ++i, mac >>= 8) {
+    int test = mac & 0xff;
+    int stored = block[i];
+    if (test != stored) {
+      // uh oh..
+      LOG(WARNING) << "MAC comparison failure in block " << blockNum;
+      if (!warnOnly) {
+        throw Error(_("MAC comparison failure, refusing to read"));
+      }
+      break;
+    }
+  }
+}
+
+// MAC_64 serializes callers of one instance, so each thread uses its own.
+CipherV1 *MACFileIO::coder() const {
+  return cipherPool ? cipherPool->local() : cipher.get();
+}
+
+void MACFileIO::computeMACs(
+    std::vector<CipherPool::MACRequest> &requests) const {
+  if (requests.empty()) return;
+
+  if (cipherPool && requests.size() > 1) {
+    cipherPool->batchMAC_64(&requests[0], requests.size());
+  } else {
+    for (size_t i = 0; i < requests.size(); ++i)
+      requests[i].mac = coder()->MAC_64(requests[i].data, requests[i].dataLen);
+  }
+}
+
+ssize_t MACFileIO::readBlocks(const IORequest &req) const {
+  int headerSize = macBytes + randBytes;
+  int bs = blockSize() + headerSize;
+  int blocks = req.dataLen / blockSize();
+
+  MemBlock mb;
+  mb.allocate(blocks * bs);
+
+  IORequest tmp;
+  tmp.offset = locWithHeader(req.offset, bs, headerSize);
+  tmp.data = mb.data;
+  tmp.dataLen = blocks * bs;
+
+  ssize_t readSize = base->read(tmp);
+  if (readSize <= headerSize) {
+    VLOG(1) << "readSize " << readSize << " at offset " << req.offset;
+    return (readSize > 0) ? 0 : readSize;
+  }
+
+  // blocks which were (at least partly) read, and which hold data
+  int count = 0;
+  std::vector<CipherPool::MACRequest> macs;
+  std::vector<int> macBlock;
+  for (; count < blocks && readSize - count * bs > headerSize; ++count) {
+    unsigned char *block = tmp.data + count * bs;
+    int len = std::min<ssize_t>(bs, readSize - count * bs);
+    if (needsCheck(block, len)) {
+      CipherPool::MACRequest mac = {block + macBytes, len - macBytes, 0};
+      macs.push_back(mac);
+      macBlock.push_back(count);
+    }
+  }
+
+  computeMACs(macs);
+
+  off_t firstBlock = req.offset / blockSize();
+  for (size_t i = 0; i < macs.size(); ++i)
+    checkMAC(tmp.data + macBlock[i] * bs, macs[i].mac,
+             firstBlock + macBlock[i]);
+
+  // now copy the data to the output buffer
+  ssize_t result = 0;
+  for (int i = 0; i < count; ++i) {
+    int len = std::min<ssize_t>(bs, readSize - i * bs) - headerSize;
+    memcpy(req.data + i * blockSize(), tmp.data + i * bs + headerSize, len);
+    result += len;
+  }
+
+  return result;
+}
+
+bool MACFileIO::writeBlocks(const IORequest &req) {
+  int headerSize = macBytes + randBytes;
+  int bs = blockSize() + headerSize;
+  int blocks = req.dataLen / blockSize();
+
+  MemBlock mb;
+  mb.allocate(blocks * bs);
+
+  std::vector<CipherPool::MACRequest> macs(macBytes > 0 ? blocks : 0);
+  for (int i = 0; i < blocks; ++i) {
+    unsigned char *block = mb.data + i * bs;
+    memset(block, 0, headerSize);
+    memcpy(block + headerSize, req.data + i * blockSize(), blockSize());
+    if (randBytes > 0) {
+      if (!cipher->pseudoRandomize(block + macBytes, randBytes)) return false;
+    }
+
+    if (macBytes > 0) {
+      CipherPool::MACRequest mac = {block + macBytes, blockSize() + randBytes,
+                                    0};
+      macs[i] = mac;
+    }
+  }
+
+  computeMACs(macs);
+
+  for (size_t i = 0; i < macs.size(); ++i) {
+    uint64_t mac = macs[i].mac;
+    unsigned char *block = mb.data + i * bs;
+    for (int j = 0; j < macBytes; ++j) {
+      block[j] = mac & 0xff;
+      mac >>= 8;
+    }
+  }
+
+  IORequest newReq;
+  newReq.offset = locWithHeader(req.offset, bs, headerSize);
+  newReq.data = mb.data;
+  newReq.dataLen = blocks * bs;
+
+  return base->write(newReq);
+}
+
 int MACFileIO::truncate(off_t size) {
   int headerSize = macBytes + randBytes;
   int bs = blockSize() + headerSize;
@@ -246,4 +372,11 @@ int MACFileIO::truncate(off_t size) {
 
 bool MACFileIO::isWritable() const { return base->isWritable(); }
 
+int MACFileIO::flush() { return base->flush(); }
+
+void MACFileIO::invalidateCache() {
+  BlockFileIO::invalidateCache();
+  base->invalidateCache();
+}
+
 }  // namespace encfs
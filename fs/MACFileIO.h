@@ -21,9 +21,12 @@
 #ifndef _MACFileIO_incl_
 #define _MACFileIO_incl_
 
+#include "cipher/CipherPool.h"
 #include "cipher/CipherV1.h"
 #include "fs/BlockFileIO.h"
 
+#include <vector>
+
 namespace encfs {
 
 class MACFileIO : public BlockFileIO {
@@ -47,16 +50,33 @@ class MACFileIO : public BlockFileIO {
   virtual int getAttr(struct stat *stbuf) const;
   virtual off_t getSize() const;
 
+  // Size of the file as seen through this layer, given the size of the
+  // underlying (CipherFileIO) file.
+  static off_t AdjustedSize(const FSConfigPtr &cfg, off_t size);
+
   virtual int truncate(off_t size);
 
   virtual bool isWritable() const;
 
+  virtual int flush();
+  virtual void invalidateCache();
+
  private:
   virtual ssize_t readOneBlock(const IORequest &req) const;
   virtual bool writeOneBlock(const IORequest &req);
 
+  // MACs for several blocks are computed as a batch.
+  virtual ssize_t readBlocks(const IORequest &req) const;
+  virtual bool writeBlocks(const IORequest &req);
+
+  bool needsCheck(const unsigned char *block, int len) const;
+  void checkMAC(const unsigned char *block, uint64_t mac, off_t blockNum) const;
+  void computeMACs(std::vector<CipherPool::MACRequest> &requests) const;
+  CipherV1 *coder() const;
+
   shared_ptr<FileIO> base;
   shared_ptr<CipherV1> cipher;
+  shared_ptr<CipherPool> cipherPool;
   int macBytes;
   int randBytes;
   bool warnOnly;
@@ -0,0 +1,190 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/MMapFileIO.h"
+
+#include "base/Error.h"
+
+#include <glog/logging.h>
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <cstring>
+
+namespace encfs {
+
+static Interface MMapFileIO_iface = makeInterface("FileIO/MMap", 1, 0, 0);
+
+// Number of reads in a row before an access pattern is assumed.
+static const int AdviceTrigger = 2;
+
+// Set while the current thread copies from a mapping.
+static __thread sigjmp_buf *busJump = NULL;
+
+static void busHandler(int sig) {
+  if (busJump) siglongjmp(*busJump, 1);
+
+  // not ours, so crash as usual.
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static void installBusHandler() {
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = busHandler;
+  sigemptyset(&act.sa_mask);
+  // not blocked in the handler, so that the jump out doesn't need to restore
+  // the signal mask.
+  act.sa_flags = SA_NODEFER;
+  if (sigaction(SIGBUS, &act, NULL) != 0)
+    LOG(WARNING) << "unable to install SIGBUS handler";
+}
+
+// Copies from a mapping.  Returns false if the pages are gone.
+static bool copyMapped(unsigned char *dst, const unsigned char *src,
+                       size_t len) {
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, installBusHandler);
+
+  sigjmp_buf jump;
+  if (sigsetjmp(jump, 0) != 0) {
+    busJump = NULL;
+    return false;
+  }
+
+  busJump = &jump;
+  memcpy(dst, src, len);
+  busJump = NULL;
+  return true;
+}
+
+MMapFileIO::MMapFileIO(const std::string &fileName)
+    : RawFileIO(fileName),
+      mapData(NULL),
+      mapStart(0),
+      mapLen(0),
+      mapFailed(false),
+      lastEnd(-1),
+      sequentialReads(0),
+      randomReads(0),
+      advice(MADV_NORMAL) {}
+
+MMapFileIO::~MMapFileIO() { unmap(); }
+
+Interface MMapFileIO::interface() const { return MMapFileIO_iface; }
+
+void MMapFileIO::unmap() const {
+  if (mapData) munmap(mapData, mapLen);
+  mapData = NULL;
+  mapLen = 0;
+}
+
+bool MMapFileIO::mapWindow(off_t offset, off_t end, off_t size) const {
+  if (mapData && offset >= mapStart && end <= mapStart + (off_t)mapLen)
+    return true;
+
+  unmap();
+
+  off_t start = offset - (offset % WindowSize);
+  off_t last = start + WindowSize;
+  if (last < end) last = end;
+  if (last > size) last = size;
+
+  void *data = mmap(NULL, last - start, PROT_READ, MAP_SHARED, fd, start);
+  if (data == MAP_FAILED) {
+    LOG(INFO) << "mmap failed for " << name << ": " << strerror(errno);
+    mapFailed = true;
+    return false;
+  }
+
+  mapData = (unsigned char *)data;
+  mapStart = start;
+  mapLen = last - start;
+
+  if (advice != MADV_NORMAL) madvise(mapData, mapLen, advice);
+  return true;
+}
+
+void MMapFileIO::noteAccess(const IORequest &req) const {
+  if (req.offset == lastEnd) {
+    ++sequentialReads;
+    randomReads = 0;
+  } else {
+    ++randomReads;
+    sequentialReads = 0;
+  }
+  lastEnd = req.offset + req.dataLen;
+
+  int newAdvice = advice;
+  if (sequentialReads >= AdviceTrigger)
+    newAdvice = MADV_SEQUENTIAL;
+  else if (randomReads >= AdviceTrigger)
+    newAdvice = MADV_RANDOM;
+
+  if (newAdvice != advice) {
+    advice = newAdvice;
+    if (mapData) madvise(mapData, mapLen, advice);
+  }
+}
+
+ssize_t MMapFileIO::read(const IORequest &req) const {
+  rAssert(fd >= 0);
+
+  noteAccess(req);
+
+  off_t size = getSize();
+  if (!mapFailed && size >= MinMapSize && req.offset < size) {
+    off_t end = req.offset + req.dataLen;
+    if (end > size) end = size;
+
+    if (mapWindow(req.offset, end, size)) {
+      VLOG(2) << "Read " << req.dataLen << " bytes from offset " << req.offset
+              << " (mapped)";
+      if (copyMapped(req.data, mapData + (req.offset - mapStart),
+                     end - req.offset))
+        return end - req.offset;
+
+      LOG(WARNING) << "mapping of " << name
+                   << " lost, file truncated by another process?";
+      unmap();
+      mapFailed = true;
+      knownSize = false;
+    }
+  }
+
+  return RawFileIO::read(req);
+}
+
+int MMapFileIO::truncate(off_t size) {
+  // don't keep pages which may be about to go away.
+  unmap();
+  return RawFileIO::truncate(size);
+}
+
+void MMapFileIO::invalidateCache() {
+  RawFileIO::invalidateCache();
+  unmap();
+  mapFailed = false;
+}
+
+}  // namespace encfs
@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MMapFileIO_incl_
+#define _MMapFileIO_incl_
+
+#include "fs/RawFileIO.h"
+
+namespace encfs {
+
+/*
+    RawFileIO variant which reads through a memory mapping of the backing
+    file (--mmap), for read-mostly volumes.  Reads are copied straight from
+    the page cache, without a system call per read.
+
+    - One window of the file is mapped at a time, WindowSize bytes aligned to
+      a multiple of WindowSize, and never past the end of the file as it was
+      when mapped.  Files smaller then MinMapSize, and reads past the window,
+      use pread.
+    - Sequential and random access is detected, and the kernel is told
+      about it with madvise so that it can adjust read-ahead.
+    - Writes still use pwrite, which the shared mapping sees.
+    - If the file is truncated by another process, touching the lost pages
+      raises SIGBUS.  That is caught while copying from the mapping, and the
+      file falls back to pread until the cache is invalidated.
+*/
+class MMapFileIO : public RawFileIO {
+ public:
+  static const int WindowSize = 1024 * 1024;
+  static const int MinMapSize = 64 * 1024;
+
+  MMapFileIO(const std::string &fileName);
+  virtual ~MMapFileIO();
+
+  virtual Interface interface() const;
+
+  virtual ssize_t read(const IORequest &req) const;
+
+  virtual int truncate(off_t size);
+
+  virtual void invalidateCache();
+
+ private:
+  bool mapWindow(off_t offset, off_t end, off_t size) const;
+  void unmap() const;
+  void noteAccess(const IORequest &req) const;
+
+  mutable unsigned char *mapData;
+  mutable off_t mapStart;
+  mutable size_t mapLen;
+  mutable bool mapFailed;  // use pread until the next invalidation
+
+  // access pattern detection
+  mutable off_t lastEnd;
+  mutable int sequentialReads;
+  mutable int randomReads;
+  mutable int advice;
+};
+
+}  // namespace encfs
+
+#endif
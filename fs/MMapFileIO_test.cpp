@@ -0,0 +1,179 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fs/testing.h"
+#include "fs/CipherFileIO.h"
+#include "fs/FSConfig.h"
+#include "fs/MemFileIO.h"
+#include "fs/MMapFileIO.h"
+
+using namespace encfs;
+using std::string;
+using std::vector;
+
+namespace {
+
+class MMapFileIOTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-mmap-XXXXXX";
+    int fd = mkstemp(tmpl);
+    ASSERT_LE(0, fd);
+    close(fd);
+    fileName = tmpl;
+  }
+
+  virtual void TearDown() { unlink(fileName.c_str()); }
+
+  // Fills the file with len bytes of a known pattern.
+  void fill(int len) {
+    data.resize(len);
+    for (int i = 0; i < len; ++i) data[i] = (i * 7 + i / 251) & 0xff;
+
+    int fd = ::open(fileName.c_str(), O_WRONLY | O_TRUNC);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(len, ::write(fd, &data[0], len));
+    close(fd);
+  }
+
+  ssize_t readAt(FileIO *io, off_t offset, int len, vector<byte> *out) {
+    out->resize(len);
+    IORequest req;
+    req.offset = offset;
+    req.data = &(*out)[0];
+    req.dataLen = len;
+    return io->read(req);
+  }
+
+  string fileName;
+  vector<byte> data;
+};
+
+TEST_F(MMapFileIOTest, CompareWithMemory) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("Null"), 512);
+
+  shared_ptr<MMapFileIO> test(new MMapFileIO(fileName));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  shared_ptr<MemFileIO> dup(new MemFileIO(0));
+  comparisonTest(cfg, test.get(), dup.get());
+}
+
+TEST_F(MMapFileIOTest, CipherCompareWithMemory) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("Null"), 512);
+  cfg->config->set_unique_iv(true);
+
+  shared_ptr<MMapFileIO> raw(new MMapFileIO(fileName));
+  shared_ptr<CipherFileIO> test(new CipherFileIO(raw, cfg));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  shared_ptr<MemFileIO> dup(new MemFileIO(0));
+  comparisonTest(cfg, test.get(), dup.get());
+}
+
+TEST_F(MMapFileIOTest, MappedReads) {
+  const int len = 3 * MMapFileIO::WindowSize + 1234;
+  fill(len);
+
+  MMapFileIO io(fileName);
+  ASSERT_LE(0, io.open(O_RDONLY));
+
+  vector<byte> buf;
+  // sequential, crossing window boundaries.
+  for (off_t offset = 0; offset < len; offset += 5000) {
+    int want = std::min(5000, (int)(len - offset));
+    ASSERT_EQ(want, readAt(&io, offset, 5000, &buf));
+    ASSERT_EQ(0, memcmp(&data[offset], &buf[0], want)) << offset;
+  }
+
+  // random.
+  srand(42);
+  for (int i = 0; i < 200; ++i) {
+    off_t offset = rand() % len;
+    int size = 1 + rand() % 8192;
+    int want = std::min(size, (int)(len - offset));
+    ASSERT_EQ(want, readAt(&io, offset, size, &buf));
+    ASSERT_EQ(0, memcmp(&data[offset], &buf[0], want)) << offset;
+  }
+
+  EXPECT_EQ(0, readAt(&io, len, 100, &buf));
+}
+
+TEST_F(MMapFileIOTest, WritesVisible) {
+  const int len = MMapFileIO::MinMapSize * 2;
+  fill(len);
+
+  MMapFileIO io(fileName);
+  ASSERT_LE(0, io.open(O_RDWR));
+
+  vector<byte> buf;
+  ASSERT_EQ(len, readAt(&io, 0, len, &buf));
+
+  byte patch[100];
+  memset(patch, 0xAB, sizeof(patch));
+  IORequest req;
+  req.offset = 1000;
+  req.data = patch;
+  req.dataLen = sizeof(patch);
+  ASSERT_TRUE(io.write(req));
+
+  ASSERT_EQ(100, readAt(&io, 1000, 100, &buf));
+  EXPECT_EQ(0, memcmp(patch, &buf[0], sizeof(patch)));
+
+  // extend past the mapped window.
+  req.offset = len;
+  ASSERT_TRUE(io.write(req));
+  ASSERT_EQ(100, readAt(&io, len, 100, &buf));
+  EXPECT_EQ(0, memcmp(patch, &buf[0], sizeof(patch)));
+}
+
+TEST_F(MMapFileIOTest, TruncatedElsewhere) {
+  const int len = MMapFileIO::WindowSize;
+  fill(len);
+
+  MMapFileIO io(fileName);
+  ASSERT_LE(0, io.open(O_RDONLY));
+
+  vector<byte> buf;
+  ASSERT_EQ(4096, readAt(&io, 0, 4096, &buf));
+
+  // Shrink the file behind our back.  Pages past the end of the file can no
+  // longer be read through the mapping.
+  ASSERT_EQ(0, ::truncate(fileName.c_str(), 8192));
+
+  ssize_t res = readAt(&io, len / 2, 4096, &buf);
+  EXPECT_GE(0, res);
+
+  ASSERT_EQ(4096, readAt(&io, 4096, 4096, &buf));
+  EXPECT_EQ(0, memcmp(&data[4096], &buf[0], 4096));
+}
+
+}  // namespace
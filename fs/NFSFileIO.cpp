@@ -0,0 +1,283 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef linux
+#define _XOPEN_SOURCE 500  // pick up pread , pwrite
+#endif
+#include <unistd.h>
+
+#include "base/Error.h"
+#include "fs/NFSFileIO.h"
+
+#include <glog/logging.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cstring>
+
+#include <cerrno>
+
+namespace encfs {
+
+static Interface NFSFileIO_iface = makeInterface("FileIO/NFS", 1, 0, 0);
+
+NFSFileIO::NFSFileIO(const std::string &fileName)
+    : RawFileIO(fileName),
+      readStart(0),
+      readLen(-1),
+      writeStart(0),
+      dirty(false),
+      writeFailed(false) {}
+
+NFSFileIO::~NFSFileIO() {
+  LOG_IF(ERROR, !flushWrites()) << "lost buffered writes to " << name;
+}
+
+Interface NFSFileIO::interface() const { return NFSFileIO_iface; }
+
+int NFSFileIO::open(int flags) {
+  // callers may use the descriptor directly (eg. for fsync).
+  if (!flushWrites()) return -EIO;
+
+  int oldFd = fd;
+  int res = RawFileIO::open(flags);
+
+  if (res >= 0 && fd != oldFd) {
+    // New descriptor, so revalidate (close-to-open consistency).
+    readLen = -1;
+
+    struct stat stbuf;
+    if (fstat(fd, &stbuf) == 0) {
+      fileSize = stbuf.st_size;
+      knownSize = true;
+    } else
+      knownSize = false;
+  }
+
+  return res;
+}
+
+int NFSFileIO::getAttr(struct stat *stbuf) const {
+  int res = statFile(stbuf);
+  if (res < 0) {
+    LOG(INFO) << "getAttr error on " << name << ": " << strerror(-res);
+    return res;
+  }
+
+  if (S_ISREG(stbuf->st_mode) && (knownSize || !pending.empty()))
+    stbuf->st_size = getSize();
+
+  return 0;
+}
+
+off_t NFSFileIO::getSize() const {
+  if (!knownSize) {
+    struct stat stbuf;
+    if (statFile(&stbuf) != 0) return -1;
+
+    fileSize = stbuf.st_size;
+    knownSize = true;
+  }
+
+  off_t pendingEnd = writeStart + pending.size();
+  if (!pending.empty() && pendingEnd > fileSize) return pendingEnd;
+  return fileSize;
+}
+
+ssize_t NFSFileIO::readBacking(const IORequest &req) const {
+  off_t alignedStart = req.offset - (req.offset % AggregateSize);
+  if (req.dataLen >= AggregateSize ||
+      req.offset + req.dataLen > alignedStart + AggregateSize)
+    return RawFileIO::read(req);
+
+  if (readLen < 0 || readStart != alignedStart) {
+    readBuf.resize(AggregateSize);
+
+    IORequest tmp;
+    tmp.offset = alignedStart;
+    tmp.data = &readBuf[0];
+    tmp.dataLen = AggregateSize;
+    ssize_t res = RawFileIO::read(tmp);
+    if (res < 0) {
+      readLen = -1;
+      return res;
+    }
+
+    readStart = alignedStart;
+    readLen = res;
+  }
+
+  int skip = req.offset - readStart;
+  int len = readLen - skip;
+  if (len < 0) len = 0;
+  if (len > req.dataLen) len = req.dataLen;
+
+  memcpy(req.data, &readBuf[skip], len);
+  return len;
+}
+
+ssize_t NFSFileIO::read(const IORequest &req) const {
+  ssize_t res = readBacking(req);
+  if (res < 0 || pending.empty()) return res;
+
+  // Merge in buffered writes.  Anything between the end of the backing file
+  // and the buffered data is a hole.
+  off_t reqEnd = req.offset + req.dataLen;
+  off_t pendingEnd = writeStart + pending.size();
+  if (pendingEnd <= req.offset) return res;
+
+  off_t end = (reqEnd < pendingEnd) ? reqEnd : pendingEnd;
+  if (req.offset + res < end)
+    memset(req.data + res, 0, end - (req.offset + res));
+
+  off_t start = (req.offset > writeStart) ? req.offset : writeStart;
+  if (start < end)
+    memcpy(req.data + (start - req.offset), &pending[start - writeStart],
+           end - start);
+
+  if (end - req.offset > res) res = end - req.offset;
+  return res;
+}
+
+void NFSFileIO::updateReadBuffer(const IORequest &req) {
+  if (readLen < 0) return;
+
+  off_t bufEnd = readStart + AggregateSize;
+  off_t reqEnd = req.offset + req.dataLen;
+  if (reqEnd <= readStart || req.offset >= bufEnd) return;
+
+  if (req.offset > readStart + readLen) {
+    // would leave a gap in the buffer.
+    readLen = -1;
+    return;
+  }
+
+  off_t start = (req.offset > readStart) ? req.offset : readStart;
+  off_t end = (reqEnd < bufEnd) ? reqEnd : bufEnd;
+  memcpy(&readBuf[start - readStart], req.data + (start - req.offset),
+         end - start);
+
+  if (end - readStart > readLen) readLen = end - readStart;
+}
+
+bool NFSFileIO::writeOut(unsigned char *data, int len, off_t offset) {
+  IORequest req;
+  req.offset = offset;
+  req.data = data;
+  req.dataLen = len;
+  return RawFileIO::write(req);
+}
+
+bool NFSFileIO::flushWrites() {
+  if (pending.empty()) return !writeFailed;
+
+  if (!writeOut(&pending[0], pending.size(), writeStart)) writeFailed = true;
+  pending.clear();
+  return !writeFailed;
+}
+
+bool NFSFileIO::write(const IORequest &req) {
+  rAssert(fd >= 0);
+  rAssert(true == canWrite);
+  if (writeFailed) return false;
+
+  updateReadBuffer(req);
+  dirty = true;
+
+  // only contiguous or overlapping writes are merged.
+  off_t pendingEnd = writeStart + pending.size();
+  if (!pending.empty() &&
+      (req.offset < writeStart || req.offset > pendingEnd)) {
+    if (!flushWrites()) return false;
+  }
+
+  if (pending.empty()) {
+    if (req.dataLen >= AggregateSize) return RawFileIO::write(req);
+    writeStart = req.offset;
+  }
+
+  off_t reqEnd = req.offset + req.dataLen;
+  if (reqEnd - writeStart > (off_t)pending.size())
+    pending.resize(reqEnd - writeStart);
+  memcpy(&pending[req.offset - writeStart], req.data, req.dataLen);
+
+  if (knownSize && reqEnd > fileSize) fileSize = reqEnd;
+
+  // write out whole aligned chunks.
+  while (true) {
+    off_t boundary = writeStart - (writeStart % AggregateSize) + AggregateSize;
+    if (writeStart + (off_t)pending.size() < boundary) break;
+
+    int len = boundary - writeStart;
+    bool ok = writeOut(&pending[0], len, writeStart);
+    pending.erase(pending.begin(), pending.begin() + len);
+    writeStart = boundary;
+    if (!ok) {
+      writeFailed = true;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int NFSFileIO::truncate(off_t size) {
+  if (!flushWrites()) return -EIO;
+  readLen = -1;
+
+  // Unlike RawFileIO, don't force a data sync here.  That is left to
+  // fsync(), and the close-to-open commit done by flush().
+  int res;
+  if (fd >= 0 && canWrite)
+    res = ::ftruncate(fd, size);
+  else
+    res = ::truncate(name.c_str(), size);
+
+  if (res < 0) {
+    int eno = errno;
+    LOG(INFO) << "truncate failed for " << name << " (" << fd << ") size "
+              << size << ", error " << strerror(eno);
+    knownSize = false;
+    return -eno;
+  }
+
+  dirty = true;
+  fileSize = size;
+  knownSize = true;
+  return 0;
+}
+
+int NFSFileIO::flush() {
+  if (!flushWrites()) return -EIO;
+
+  // nothing to commit for files which were only read.
+  if (!dirty) return 0;
+  dirty = false;
+
+  return RawFileIO::flush();
+}
+
+void NFSFileIO::invalidateCache() {
+  RawFileIO::invalidateCache();
+  readLen = -1;
+}
+
+}  // namespace encfs
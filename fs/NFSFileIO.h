@@ -0,0 +1,93 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NFSFileIO_incl_
+#define _NFSFileIO_incl_
+
+#include "fs/RawFileIO.h"
+
+#include <vector>
+
+namespace encfs {
+
+/*
+    RawFileIO variant for network backing stores (--nfs), where every system
+    call is a round trip to the server.
+
+    - Attributes come from the open descriptor rather then a path lookup.
+      Following NFS close-to-open semantics, the file size is fetched when a
+      descriptor is opened and is tracked locally from then on.
+    - Small reads are turned into aligned reads of AggregateSize bytes, which
+      also covers the separate header read done by CipherFileIO.
+    - Contiguous writes are collected and written out in aligned chunks.
+      Buffered data is written out before the descriptor is handed out by
+      open(), on flush(), truncate() and destruction.  Once buffered data
+      fails to be written out, the buffer is lost, so every later write,
+      open, truncate and flush fails with EIO.
+    - flush() only does the close-to-open commit if the file was modified,
+      and truncate() doesn't force a data sync.
+*/
+class NFSFileIO : public RawFileIO {
+ public:
+  static const int AggregateSize = 128 * 1024;
+
+  NFSFileIO(const std::string &fileName);
+  virtual ~NFSFileIO();
+
+  virtual Interface interface() const;
+
+  virtual int open(int flags);
+
+  virtual int getAttr(struct stat *stbuf) const;
+  virtual off_t getSize() const;
+
+  virtual ssize_t read(const IORequest &req) const;
+  virtual bool write(const IORequest &req);
+
+  virtual int truncate(off_t size);
+
+  virtual int flush();
+  virtual void invalidateCache();
+
+ private:
+  ssize_t readBacking(const IORequest &req) const;
+  void updateReadBuffer(const IORequest &req);
+  bool writeOut(unsigned char *data, int len, off_t offset);
+  bool flushWrites();
+
+  // aligned read buffer, readLen < 0 if empty.
+  mutable std::vector<unsigned char> readBuf;
+  mutable off_t readStart;
+  mutable int readLen;
+
+  // pending writes, covering [writeStart, writeStart + pending.size())
+  std::vector<unsigned char> pending;
+  off_t writeStart;
+
+  // modified since the last flush()
+  bool dirty;
+
+  // buffered data was lost, see above.
+  bool writeFailed;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,142 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fs/testing.h"
+#include "fs/CipherFileIO.h"
+#include "fs/FSConfig.h"
+#include "fs/MemFileIO.h"
+#include "fs/NFSFileIO.h"
+#include "fs/RawFileIO.h"
+
+using namespace encfs;
+using std::string;
+
+namespace {
+
+class NFSFileIOTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-nfs-XXXXXX";
+    int fd = mkstemp(tmpl);
+    ASSERT_LE(0, fd);
+    close(fd);
+    fileName = tmpl;
+  }
+
+  virtual void TearDown() { unlink(fileName.c_str()); }
+
+  string fileName;
+};
+
+TEST_F(NFSFileIOTest, CompareWithMemory) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("Null"), 512);
+
+  shared_ptr<NFSFileIO> test(new NFSFileIO(fileName));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  shared_ptr<MemFileIO> dup(new MemFileIO(0));
+  comparisonTest(cfg, test.get(), dup.get());
+}
+
+TEST_F(NFSFileIOTest, CipherCompareWithMemory) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("Null"), 512);
+  cfg->config->set_unique_iv(true);
+
+  shared_ptr<NFSFileIO> raw(new NFSFileIO(fileName));
+  shared_ptr<CipherFileIO> test(new CipherFileIO(raw, cfg));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  shared_ptr<MemFileIO> dup(new MemFileIO(0));
+  comparisonTest(cfg, test.get(), dup.get());
+}
+
+TEST_F(NFSFileIOTest, WritesVisibleAfterFlush) {
+  NFSFileIO test(fileName);
+  ASSERT_LE(0, test.open(O_RDWR));
+
+  // sequential small writes, crossing an aggregation boundary.
+  const int count = (NFSFileIO::AggregateSize / 1000) + 10;
+  std::vector<unsigned char> buf(1000);
+  IORequest req;
+  req.data = &buf[0];
+  req.dataLen = buf.size();
+  for (int i = 0; i < count; ++i) {
+    memset(&buf[0], i, buf.size());
+    req.offset = i * buf.size();
+    ASSERT_TRUE(test.write(req));
+  }
+
+  off_t size = count * buf.size();
+  EXPECT_EQ(size, test.getSize());
+
+  struct stat stbuf;
+  ASSERT_EQ(0, test.getAttr(&stbuf));
+  EXPECT_EQ(size, stbuf.st_size);
+
+  ASSERT_EQ(0, test.flush());
+
+  RawFileIO check(fileName);
+  ASSERT_LE(0, check.open(O_RDONLY));
+  EXPECT_EQ(size, check.getSize());
+
+  for (int i = 0; i < count; ++i) {
+    req.offset = i * buf.size();
+    ASSERT_EQ((ssize_t)buf.size(), check.read(req));
+    ASSERT_EQ(i & 0xff, buf[0]);
+    ASSERT_EQ(i & 0xff, buf[buf.size() - 1]);
+  }
+}
+
+TEST_F(NFSFileIOTest, HoleBeforeBufferedWrite) {
+  NFSFileIO test(fileName);
+  ASSERT_LE(0, test.open(O_RDWR));
+
+  unsigned char data[100];
+  memset(data, 0xAA, sizeof(data));
+  IORequest req;
+  req.offset = 1000;
+  req.data = data;
+  req.dataLen = sizeof(data);
+  ASSERT_TRUE(test.write(req));
+  EXPECT_EQ(1100, test.getSize());
+
+  unsigned char buf[2000];
+  memset(buf, 0xFF, sizeof(buf));
+  req.offset = 0;
+  req.data = buf;
+  req.dataLen = sizeof(buf);
+  ASSERT_EQ(1100, test.read(req));
+  EXPECT_EQ(0, buf[0]);
+  EXPECT_EQ(0, buf[999]);
+  EXPECT_EQ(0xAA, buf[1000]);
+  EXPECT_EQ(0xAA, buf[1099]);
+}
+
+}  // namespace
@@ -0,0 +1,113 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef linux
+#define _XOPEN_SOURCE 500  // pick up pread
+#endif
+#include <unistd.h>
+
+#include "fs/PackFileIO.h"
+
+#include <glog/logging.h>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+namespace encfs {
+
+static Interface PackFileIO_iface = makeInterface("FileIO/Pack", 1, 0, 0);
+
+PackFileIO::PackFileIO(const std::string &fileName,
+                       const std::string &dataPath_, off_t offset_,
+                       const struct stat &attr_)
+    : name(fileName),
+      dataPath(dataPath_),
+      offset(offset_),
+      attr(attr_),
+      fd(-1) {}
+
+PackFileIO::~PackFileIO() {
+  if (fd != -1) ::close(fd);
+
+  name.assign(name.length(), '\0');
+}
+
+Interface PackFileIO::interface() const { return PackFileIO_iface; }
+
+void PackFileIO::setFileName(const char *fileName) { name = fileName; }
+
+const char *PackFileIO::getFileName() const { return name.c_str(); }
+
+int PackFileIO::open(int flags) {
+  if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC)) return -EROFS;
+
+  if (fd < 0) {
+    fd = ::open(dataPath.c_str(), O_RDONLY);
+    if (fd < 0) {
+      int eno = errno;
+      VLOG(1) << "unable to open pack " << dataPath << ": " << strerror(eno);
+      return -eno;
+    }
+  }
+
+  return fd;
+}
+
+int PackFileIO::getAttr(struct stat *stbuf) const {
+  *stbuf = attr;
+  return 0;
+}
+
+off_t PackFileIO::getSize() const { return attr.st_size; }
+
+ssize_t PackFileIO::read(const IORequest &req) const {
+  if (fd < 0) return -EBADF;
+
+  if (req.offset >= attr.st_size) return 0;
+
+  ssize_t len = req.dataLen;
+  if (req.offset + len > attr.st_size) len = attr.st_size - req.offset;
+
+  VLOG(2) << "Read " << len << " bytes from packed offset " << req.offset;
+  ssize_t readSize = pread(fd, req.data, len, offset + req.offset);
+
+  if (readSize < 0) {
+    LOG(INFO) << "read failed at offset " << req.offset << " for " << len
+              << " bytes: " << strerror(errno);
+  }
+
+  return readSize;
+}
+
+bool PackFileIO::write(const IORequest &req) {
+  (void)req;
+  return false;
+}
+
+int PackFileIO::truncate(off_t size) {
+  (void)size;
+  return -EROFS;
+}
+
+bool PackFileIO::isWritable() const { return false; }
+
+}  // namespace encfs
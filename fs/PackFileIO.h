@@ -0,0 +1,74 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PackFileIO_incl_
+#define _PackFileIO_incl_
+
+#include "fs/FileIO.h"
+
+#include <sys/stat.h>
+#include <string>
+
+namespace encfs {
+
+/*
+    Read-only access to a file kept in a pack (see PackStore).  The file's
+    backing bytes are a region of the pack data file, so this sits at the
+    bottom of the FileIO stack in place of RawFileIO.
+
+    Any attempt to open the file for writing fails with EROFS, which is the
+    signal to promote the file to a standalone backing file.
+*/
+class PackFileIO : public FileIO {
+ public:
+  // attr holds the backing file attributes, including its (raw) size.
+  PackFileIO(const std::string &fileName, const std::string &dataPath,
+             off_t offset, const struct stat &attr);
+  virtual ~PackFileIO();
+
+  virtual Interface interface() const;
+
+  virtual void setFileName(const char *fileName);
+  virtual const char *getFileName() const;
+
+  virtual int open(int flags);
+
+  virtual int getAttr(struct stat *stbuf) const;
+  virtual off_t getSize() const;
+
+  virtual ssize_t read(const IORequest &req) const;
+  virtual bool write(const IORequest &req);
+
+  virtual int truncate(off_t size);
+
+  virtual bool isWritable() const;
+
+ private:
+  std::string name;
+  std::string dataPath;
+  off_t offset;
+  struct stat attr;
+
+  int fd;
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,560 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef linux
+#define _XOPEN_SOURCE 500  // pick up pread, pwrite
+#endif
+#include <unistd.h>
+
+#include "fs/PackStore.h"
+
+#include "base/config.h"
+#include "fs/FileIO.h"
+#include "fs/PackFileIO.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_ATTR_XATTR_H
+#include <attr/xattr.h>
+#elif defined(HAVE_SYS_XATTR_H)
+#include <sys/xattr.h>
+#endif
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace encfs {
+
+const char *PackStore::IndexName = ".encfs-pack";
+
+static const char IndexMagic[] = "EPX1";
+static const int HeaderSize = 16;
+// fixed part of an index entry, after the name length and name.
+static const int EntrySize = 8 + 8 + 4 + 4 + 4 + 8;
+
+static const size_t MaxCachedPacks = 1024;
+static const size_t CopyBufferSize = 64 * 1024;
+
+static void putBE(unsigned char *out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i, value >>= 8) out[i] = value & 0xff;
+}
+
+static uint64_t getBE(const unsigned char *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) value = (value << 8) | in[i];
+  return value;
+}
+
+// cache key for a directory: the path without trailing slashes.
+static string dirKey(const string &path) {
+  string::size_type end = path.find_last_not_of('/');
+  if (end == string::npos) return string("/");
+  return path.substr(0, end + 1);
+}
+
+static bool splitPath(const string &path, string *dir, string *name) {
+  string::size_type pos = path.rfind('/');
+  if (pos == string::npos || pos + 1 == path.length()) return false;
+
+  *dir = dirKey(path.substr(0, pos + 1));
+  *name = path.substr(pos + 1);
+  return true;
+}
+
+// Copies size bytes.  Returns 0 or -errno.
+static int copyRange(int from, off_t fromOffset, off_t size, int to,
+                     off_t toOffset) {
+  vector<char> buf(CopyBufferSize);
+  while (size > 0) {
+    size_t len = size < (off_t)buf.size() ? size : buf.size();
+    ssize_t got = ::pread(from, &buf[0], len, fromOffset);
+    if (got < 0) return -errno;
+    if (got == 0) return -EIO;  // shorter then recorded
+
+    for (ssize_t done = 0; done < got;) {
+      ssize_t put = ::pwrite(to, &buf[done], got - done, toOffset + done);
+      if (put < 0) return -errno;
+      done += put;
+    }
+
+    fromOffset += got;
+    toOffset += got;
+    size -= got;
+  }
+  return 0;
+}
+
+// The index has no room for extended attributes, so files which have any
+// aren't packed.
+static bool hasXattrs(const string &path) {
+#if defined(HAVE_ATTR_XATTR_H) || defined(HAVE_SYS_XATTR_H)
+#ifdef XATTR_ADD_OPT
+  return ::listxattr(path.c_str(), NULL, 0, XATTR_NOFOLLOW) > 0;
+#else
+  return ::llistxattr(path.c_str(), NULL, 0) > 0;
+#endif
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+PackStore::PackStore() {}
+
+PackStore::~PackStore() {}
+
+bool PackStore::IsReserved(const char *name) {
+  return strncmp(name, IndexName, strlen(IndexName)) == 0;
+}
+
+string PackStore::DataPath(const string &cipherDir, uint32_t generation) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%u", generation);
+  return cipherDir + '/' + IndexName + suffix;
+}
+
+bool PackStore::ReadIndex(const string &cipherDir, Pack *pack) {
+  int fd = ::open((cipherDir + '/' + IndexName).c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  vector<unsigned char> buf;
+  bool ok = ::fstat(fd, &st) == 0 && st.st_size >= HeaderSize;
+  if (ok) {
+    buf.resize(st.st_size);
+    ok = ::read(fd, &buf[0], buf.size()) == (ssize_t)buf.size();
+  }
+  ::close(fd);
+
+  ok = ok && memcmp(&buf[0], IndexMagic, 4) == 0;
+  if (!ok) return false;
+
+  pack->dev = st.st_dev;
+  pack->ino = st.st_ino;
+  pack->size = st.st_size;
+  pack->mtime = st.st_mtime;
+  pack->generation = getBE(&buf[4], 4);
+  pack->entries.clear();
+
+  uint64_t count = getBE(&buf[8], 8);
+  size_t pos = HeaderSize;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (pos + 2 > buf.size()) return false;
+    size_t nameLen = getBE(&buf[pos], 2);
+    pos += 2;
+    if (pos + nameLen + EntrySize > buf.size()) return false;
+
+    string name((const char *)&buf[pos], nameLen);
+    pos += nameLen;
+
+    Entry entry;
+    entry.offset = getBE(&buf[pos], 8);
+    entry.size = getBE(&buf[pos + 8], 8);
+    entry.mode = getBE(&buf[pos + 16], 4);
+    entry.uid = getBE(&buf[pos + 20], 4);
+    entry.gid = getBE(&buf[pos + 24], 4);
+    entry.mtime = getBE(&buf[pos + 28], 8);
+    pos += EntrySize;
+
+    pack->entries[name] = entry;
+  }
+
+  return true;
+}
+
+int PackStore::WriteIndex(const string &cipherDir, Pack *pack) {
+  string indexPath = cipherDir + '/' + IndexName;
+
+  // an empty pack is no pack at all.
+  if (pack->entries.empty()) {
+    ::unlink(indexPath.c_str());
+    ::unlink(DataPath(cipherDir, pack->generation).c_str());
+    return 0;
+  }
+
+  vector<unsigned char> buf(HeaderSize);
+  memcpy(&buf[0], IndexMagic, 4);
+  putBE(&buf[4], pack->generation, 4);
+  putBE(&buf[8], pack->entries.size(), 8);
+
+  map<string, Entry>::const_iterator it;
+  for (it = pack->entries.begin(); it != pack->entries.end(); ++it) {
+    size_t pos = buf.size();
+    buf.resize(pos + 2 + it->first.length() + EntrySize);
+    putBE(&buf[pos], it->first.length(), 2);
+    memcpy(&buf[pos + 2], it->first.data(), it->first.length());
+    pos += 2 + it->first.length();
+
+    const Entry &entry = it->second;
+    putBE(&buf[pos], entry.offset, 8);
+    putBE(&buf[pos + 8], entry.size, 8);
+    putBE(&buf[pos + 16], entry.mode, 4);
+    putBE(&buf[pos + 20], entry.uid, 4);
+    putBE(&buf[pos + 24], entry.gid, 4);
+    putBE(&buf[pos + 28], entry.mtime, 8);
+  }
+
+  // replace the index in one step, so that it is always complete.
+  string tmpPath = indexPath + ".new";
+  int fd = ::open(tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  if (fd < 0) return -errno;
+
+  int res = 0;
+  if (::write(fd, &buf[0], buf.size()) != (ssize_t)buf.size() ||
+      ::fsync(fd) != 0)
+    res = errno ? -errno : -EIO;
+
+  struct stat st;
+  if (res == 0 && ::fstat(fd, &st) != 0) res = -errno;
+  ::close(fd);
+
+  if (res == 0 && ::rename(tmpPath.c_str(), indexPath.c_str()) != 0)
+    res = -errno;
+
+  if (res != 0) {
+    LOG(ERROR) << "unable to write pack index in " << cipherDir << ": "
+               << strerror(-res);
+    ::unlink(tmpPath.c_str());
+    return res;
+  }
+
+  pack->dev = st.st_dev;
+  pack->ino = st.st_ino;
+  pack->size = st.st_size;
+  pack->mtime = st.st_mtime;
+  return 0;
+}
+
+void PackStore::FillStat(const string &cipherPath, const Pack &pack,
+                         const Entry &entry, struct stat *stbuf) {
+  memset(stbuf, 0, sizeof(struct stat));
+
+  // packed files have no inode of their own.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < cipherPath.length(); ++i)
+    hash = (hash ^ (unsigned char)cipherPath[i]) * 1099511628211ULL;
+
+  stbuf->st_dev = pack.dev;
+  stbuf->st_ino = hash;
+  stbuf->st_mode = entry.mode;
+  stbuf->st_nlink = 1;
+  stbuf->st_uid = entry.uid;
+  stbuf->st_gid = entry.gid;
+  stbuf->st_size = entry.size;
+  stbuf->st_blksize = 4096;
+  stbuf->st_blocks = (entry.size + 511) / 512;
+  stbuf->st_atime = entry.mtime;
+  stbuf->st_mtime = entry.mtime;
+  stbuf->st_ctime = entry.mtime;
+}
+
+shared_ptr<PackStore::Pack> PackStore::load(const string &cipherDir) {
+  struct stat st;
+  if (::stat((cipherDir + '/' + IndexName).c_str(), &st) != 0) {
+    packs.erase(cipherDir);
+    return shared_ptr<Pack>();
+  }
+
+  unordered_map<string, shared_ptr<Pack> >::iterator it =
+      packs.find(cipherDir);
+  if (it != packs.end() && it->second->dev == st.st_dev &&
+      it->second->ino == st.st_ino && it->second->size == st.st_size &&
+      it->second->mtime == st.st_mtime)
+    return it->second;
+
+  shared_ptr<Pack> pack(new Pack);
+  if (!ReadIndex(cipherDir, pack.get())) {
+    LOG(ERROR) << "unreadable pack index in " << cipherDir;
+    packs.erase(cipherDir);
+    return shared_ptr<Pack>();
+  }
+
+  if (packs.size() >= MaxCachedPacks) packs.clear();
+  packs[cipherDir] = pack;
+  return pack;
+}
+
+int PackStore::update(const string &cipherDir, const shared_ptr<Pack> &pack) {
+  int res = WriteIndex(cipherDir, pack.get());
+  // on failure, reread whatever is on disk next time.
+  if (res != 0 || pack->entries.empty()) packs.erase(cipherDir);
+  return res;
+}
+
+int PackStore::stat(const string &cipherPath, struct stat *stbuf) {
+  string dir, name;
+  if (!splitPath(cipherPath, &dir, &name)) return -ENOENT;
+
+  Lock _lock(mutex);
+
+  shared_ptr<Pack> pack = load(dir);
+  if (!pack) return -ENOENT;
+
+  map<string, Entry>::const_iterator it = pack->entries.find(name);
+  if (it == pack->entries.end()) return -ENOENT;
+
+  FillStat(cipherPath, *pack, it->second, stbuf);
+  return 0;
+}
+
+shared_ptr<FileIO> PackStore::open(const string &cipherPath) {
+  string dir, name;
+  if (!splitPath(cipherPath, &dir, &name)) return shared_ptr<FileIO>();
+
+  Lock _lock(mutex);
+
+  shared_ptr<Pack> pack = load(dir);
+  if (!pack) return shared_ptr<FileIO>();
+
+  map<string, Entry>::const_iterator it = pack->entries.find(name);
+  if (it == pack->entries.end()) return shared_ptr<FileIO>();
+
+  struct stat st;
+  FillStat(cipherPath, *pack, it->second, &st);
+  return shared_ptr<FileIO>(new PackFileIO(
+      cipherPath, DataPath(dir, pack->generation), it->second.offset, st));
+}
+
+vector<string> PackStore::names(const string &cipherDir) {
+  vector<string> result;
+
+  Lock _lock(mutex);
+
+  shared_ptr<Pack> pack = load(dirKey(cipherDir));
+  if (pack) {
+    map<string, Entry>::const_iterator it;
+    for (it = pack->entries.begin(); it != pack->entries.end(); ++it)
+      result.push_back(it->first);
+  }
+
+  return result;
+}
+
+bool PackStore::hasPack(const string &cipherDir) {
+  Lock _lock(mutex);
+  return bool(load(dirKey(cipherDir)));
+}
+
+int PackStore::promoteEntry(const string &cipherDir, const string &name,
+                            const shared_ptr<Pack> &pack) {
+  map<string, Entry>::iterator it = pack->entries.find(name);
+  if (it == pack->entries.end()) return 0;
+  const Entry entry = it->second;
+
+  string path = cipherDir + '/' + name;
+  VLOG(1) << "promoting packed file " << path;
+
+  int fd = ::open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+  if (fd < 0 && errno != EEXIST) {
+    int eno = errno;
+    LOG(WARNING) << "unable to promote " << path << ": " << strerror(eno);
+    return -eno;
+  }
+
+  if (fd < 0) {
+    // a standalone file always takes precedence over the packed copy.
+    LOG(WARNING) << "dropping stale packed copy of " << path;
+  } else {
+    int res = 0;
+    int in = ::open(DataPath(cipherDir, pack->generation).c_str(), O_RDONLY);
+    if (in < 0)
+      res = -errno;
+    else {
+      res = copyRange(in, entry.offset, entry.size, fd, 0);
+      ::close(in);
+    }
+
+    if (res == 0 && ::fdatasync(fd) != 0) res = -errno;
+
+    // ownership can only be kept when running as root.
+    if (res == 0 && ::fchown(fd, entry.uid, entry.gid) != 0)
+      VLOG(1) << "unable to keep owner of " << path << ": " << strerror(errno);
+    if (res == 0 && ::fchmod(fd, entry.mode & 07777) != 0) res = -errno;
+    ::close(fd);
+
+    if (res == 0) {
+      struct utimbuf ut;
+      ut.actime = entry.mtime;
+      ut.modtime = entry.mtime;
+      ::utime(path.c_str(), &ut);
+    } else {
+      LOG(WARNING) << "unable to promote " << path << ": " << strerror(-res);
+      ::unlink(path.c_str());
+      return res;
+    }
+  }
+
+  pack->entries.erase(name);
+  return 1;
+}
+
+int PackStore::promote(const string &cipherPath) {
+  string dir, name;
+  if (!splitPath(cipherPath, &dir, &name)) return 0;
+
+  Lock _lock(mutex);
+
+  shared_ptr<Pack> pack = load(dir);
+  if (!pack) return 0;
+
+  int res = promoteEntry(dir, name, pack);
+  if (res > 0) {
+    int updated = update(dir, pack);
+    if (updated < 0) return updated;
+  }
+  return res;
+}
+
+int PackStore::remove(const string &cipherPath) {
+  string dir, name;
+  if (!splitPath(cipherPath, &dir, &name)) return -ENOENT;
+
+  Lock _lock(mutex);
+
+  shared_ptr<Pack> pack = load(dir);
+  if (!pack || pack->entries.erase(name) == 0) return -ENOENT;
+
+  return update(dir, pack);
+}
+
+int PackStore::PackDirectory(const string &cipherDir_, off_t maxSize,
+                             int *packed) {
+  string cipherDir = dirKey(cipherDir_);
+  *packed = 0;
+
+  Pack old;
+  old.generation = 0;
+  struct stat st;
+  if (::lstat((cipherDir + '/' + IndexName).c_str(), &st) == 0 &&
+      !ReadIndex(cipherDir, &old)) {
+    LOG(ERROR) << "unreadable pack index in " << cipherDir;
+    return -EIO;
+  }
+
+  DIR *dir = ::opendir(cipherDir.c_str());
+  if (dir == NULL) return -errno;
+
+  bool changed = false;
+  vector<pair<string, struct stat> > candidates;
+  vector<string> packFiles;
+  struct dirent *de;
+  while ((de = ::readdir(dir)) != NULL) {
+    string name = de->d_name;
+    if (name[0] == '.') {
+      if (IsReserved(name.c_str()) && name != IndexName)
+        packFiles.push_back(name);
+      continue;
+    }
+
+    string path = cipherDir + '/' + name;
+    if (::lstat(path.c_str(), &st) != 0) continue;
+
+    // left behind by an interrupted run, the standalone file wins.
+    if (old.entries.erase(name)) changed = true;
+
+    if (S_ISREG(st.st_mode) && st.st_nlink == 1 && st.st_size <= maxSize &&
+        !hasXattrs(path))
+      candidates.push_back(std::make_pair(name, st));
+  }
+  ::closedir(dir);
+
+  if (candidates.empty() && !changed) return 0;
+
+  Pack pack;
+  pack.generation = old.generation + 1;
+  string dataPath = DataPath(cipherDir, pack.generation);
+  int out = ::open(dataPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+  if (out < 0) return -errno;
+
+  int res = 0;
+  uint64_t offset = 0;
+  if (!old.entries.empty()) {
+    int in = ::open(DataPath(cipherDir, old.generation).c_str(), O_RDONLY);
+    if (in < 0) res = -errno;
+
+    map<string, Entry>::const_iterator it;
+    for (it = old.entries.begin(); res == 0 && it != old.entries.end();
+         ++it) {
+      Entry entry = it->second;
+      res = copyRange(in, entry.offset, entry.size, out, offset);
+      entry.offset = offset;
+      offset += entry.size;
+      pack.entries[it->first] = entry;
+    }
+    if (in >= 0) ::close(in);
+  }
+
+  for (size_t i = 0; res == 0 && i < candidates.size(); ++i) {
+    const string &name = candidates[i].first;
+    const struct stat &fst = candidates[i].second;
+
+    int in = ::open((cipherDir + '/' + name).c_str(), O_RDONLY | O_NOFOLLOW);
+    if (in < 0) {
+      res = -errno;
+      break;
+    }
+    res = copyRange(in, 0, fst.st_size, out, offset);
+    ::close(in);
+
+    Entry entry;
+    entry.offset = offset;
+    entry.size = fst.st_size;
+    entry.mode = fst.st_mode;
+    entry.uid = fst.st_uid;
+    entry.gid = fst.st_gid;
+    entry.mtime = fst.st_mtime;
+    offset += entry.size;
+    pack.entries[name] = entry;
+  }
+
+  if (res == 0 && ::fsync(out) != 0) res = -errno;
+  ::close(out);
+
+  if (res == 0) res = WriteIndex(cipherDir, &pack);
+  if (res != 0) {
+    LOG(ERROR) << "unable to pack " << cipherDir << ": " << strerror(-res);
+    ::unlink(dataPath.c_str());
+    return res;
+  }
+
+  // the files are in the pack now, and older data files are unused.
+  for (size_t i = 0; i < candidates.size(); ++i)
+    ::unlink((cipherDir + '/' + candidates[i].first).c_str());
+  for (size_t i = 0; i < packFiles.size(); ++i) {
+    string path = cipherDir + '/' + packFiles[i];
+    if (path != dataPath) ::unlink(path.c_str());
+  }
+
+  *packed = candidates.size();
+  return 0;
+}
+
+}  // namespace encfs
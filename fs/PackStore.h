@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PackStore_incl_
+#define _PackStore_incl_
+
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+using std::tr1::unordered_map;
+#else
+#include <unordered_map>
+using std::unordered_map;
+#endif
+
+namespace encfs {
+
+class FileIO;
+
+/*
+    Small-file packs, for volumes created or converted with packed_files.
+
+    "encfsctl pack" moves small backing files of a directory into a pack: a
+    data file holding the backing (already encrypted) bytes of each file end
+    to end, and an index mapping the encrypted names to their region of the
+    data file along with their owner, mode and modification time.  Many tiny
+    files then cost two backing files instead of one each.
+
+    A mounted filesystem only ever takes files out of a pack.  Packed files
+    are read in place through PackFileIO.  Anything which would change a
+    packed file first promotes it back to a standalone backing file, and the
+    pack index is rewritten without it.  Space in the data file isn't
+    reclaimed until the directory is packed again.
+
+    Since the bytes are copied as they are, the encryption of a packed file
+    doesn't change, including any header tied to its path through
+    external_iv.
+
+    The pack files start with '.', which encoded names never do.  All paths
+    are backing paths without a trailing '/'.
+*/
+class PackStore {
+ public:
+  static const char *IndexName;
+
+  PackStore();
+  ~PackStore();
+
+  // True for the names of the pack index and data files.
+  static bool IsReserved(const char *name);
+
+  // Attributes of the packed file at cipherPath.  Returns 0, or -ENOENT if
+  // it isn't packed.
+  int stat(const std::string &cipherPath, struct stat *stbuf);
+
+  // Read-only FileIO for the packed file at cipherPath, or an empty pointer
+  // if it isn't packed.
+  shared_ptr<FileIO> open(const std::string &cipherPath);
+
+  // Encrypted names of the files packed in cipherDir.
+  std::vector<std::string> names(const std::string &cipherDir);
+  bool hasPack(const std::string &cipherDir);
+
+  // Moves a packed file out to a standalone backing file.  Returns 1 if the
+  // file was moved, 0 if it wasn't packed, or -errno.
+  int promote(const std::string &cipherPath);
+
+  // Drops a packed file.  Returns 0, or -ENOENT if it isn't packed.
+  int remove(const std::string &cipherPath);
+
+  /*
+      Packs the regular files of cipherDir which are no larger then maxSize
+      and have no other links or extended attributes, along with anything
+      already packed there.
+      Must not be used on a directory of a mounted filesystem.  Sets packed
+      to the number of files added.  Returns 0 or -errno.
+  */
+  static int PackDirectory(const std::string &cipherDir, off_t maxSize,
+                           int *packed);
+
+ private:
+  struct Entry {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t mtime;
+  };
+
+  struct Pack {
+    // identifies the version of the index which was read.
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+
+    uint32_t generation;
+    std::map<std::string, Entry> entries;
+  };
+
+  static bool ReadIndex(const std::string &cipherDir, Pack *pack);
+  static int WriteIndex(const std::string &cipherDir, Pack *pack);
+  static std::string DataPath(const std::string &cipherDir,
+                              uint32_t generation);
+  static void FillStat(const std::string &cipherPath, const Pack &pack,
+                       const Entry &entry, struct stat *stbuf);
+
+  // Current pack of a directory, if any.  Expects the mutex to be held.
+  shared_ptr<Pack> load(const std::string &cipherDir);
+  // Writes out a changed pack.  Expects the mutex to be held.
+  int update(const std::string &cipherDir, const shared_ptr<Pack> &pack);
+  int promoteEntry(const std::string &cipherDir, const std::string &name,
+                   const shared_ptr<Pack> &pack);
+
+  Mutex mutex;
+  unordered_map<std::string, shared_ptr<Pack> > packs;
+
+  PackStore(const PackStore &);
+  PackStore &operator=(const PackStore &);
+};
+
+}  // namespace encfs
+
+#endif
@@ -0,0 +1,184 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+
+#include "fs/testing.h"
+#include "fs/BlockNameIO.h"
+#include "fs/DirNode.h"
+#include "fs/FileNode.h"
+#include "fs/PackStore.h"
+
+using namespace encfs;
+using std::set;
+using std::string;
+
+namespace {
+
+const int FileCount = 5;
+
+class PackStoreTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-pack-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+
+    cfg = makeConfig(CipherV1::New("AES", 128), 512);
+    cfg->nameCoding = NameIO::New(BlockNameIO::CurrentInterface(), cfg->cipher);
+    cfg->nameCoding->setChainedNameIV(true);
+    cfg->config->set_unique_iv(true);
+    cfg->config->set_chained_iv(true);
+    cfg->config->set_external_iv(true);
+  }
+
+  virtual void TearDown() {
+    string cmd = "rm -rf " + rootDir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+  }
+
+  static string fileName(const char *dir, int i) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/file%d", dir, i);
+    return name;
+  }
+
+  static bool exists(const string &path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+  }
+
+  static set<string> list(DirNode *dn, const char *dir) {
+    set<string> names;
+    DirTraverse dt = dn->openDir(dir);
+    EXPECT_TRUE(dt.valid());
+    for (string name = dt.nextPlaintextName(); !name.empty();
+         name = dt.nextPlaintextName())
+      names.insert(name);
+    return names;
+  }
+
+  static void writeFile(DirNode *dn, const string &name, const string &data) {
+    shared_ptr<FileNode> node = dn->lookupNode(name.c_str(), "test");
+    ASSERT_EQ(0, node->mknod(S_IFREG | 0640, 0));
+    ASSERT_LE(0, node->open(O_RDWR));
+    // written in place, so don't hand over the caller's copy.
+    string buf = data;
+    ASSERT_TRUE(node->write(0, (unsigned char *)&buf[0], buf.size()));
+  }
+
+  static string readFile(DirNode *dn, const string &name) {
+    int res = 0;
+    shared_ptr<FileNode> node = dn->openNode(name.c_str(), "test", O_RDONLY,
+                                             &res);
+    EXPECT_LE(0, res);
+    if (!node) return string();
+
+    char buf[8192];
+    ssize_t len = node->read(0, (unsigned char *)buf, sizeof(buf));
+    EXPECT_LE(0, len);
+    return string(buf, len < 0 ? 0 : len);
+  }
+
+  string rootDir;
+  FSConfigPtr cfg;
+};
+
+TEST_F(PackStoreTest, ReservedNames) {
+  EXPECT_TRUE(PackStore::IsReserved(PackStore::IndexName));
+  EXPECT_TRUE(PackStore::IsReserved(".encfs-pack.12"));
+  EXPECT_FALSE(PackStore::IsReserved(".encfs-shards"));
+  EXPECT_FALSE(PackStore::IsReserved("encfs-pack"));
+}
+
+TEST_F(PackStoreTest, PackedDirectory) {
+  string big(4000, 'x');
+  {
+    DirNode dn(NULL, rootDir, cfg);
+    ASSERT_EQ(0, dn.mkdir("/d", 0700));
+    for (int i = 0; i < FileCount; ++i)
+      writeFile(&dn, fileName("/d", i), fileName("contents of ", i));
+    writeFile(&dn, "/d/big", big);
+
+    int packed = 0;
+    ASSERT_EQ(0, PackStore::PackDirectory(dn.cipherPath("/d"), 1024, &packed));
+    EXPECT_EQ(FileCount, packed);
+    EXPECT_FALSE(exists(dn.cipherPath("/d/file0")));
+    EXPECT_TRUE(exists(dn.cipherPath("/d/big")));
+  }
+
+  cfg->config->set_packed_files(true);
+  DirNode dn(NULL, rootDir, cfg);
+
+  set<string> names = list(&dn, "/d");
+  EXPECT_EQ((size_t)FileCount + 3, names.size());
+  EXPECT_TRUE(names.count("file0"));
+  EXPECT_TRUE(names.count("big"));
+
+  struct stat st;
+  string cipherName;
+  ASSERT_EQ(0, dn.getAttr("/d/file1", &st, &cipherName));
+  EXPECT_TRUE(S_ISREG(st.st_mode));
+  EXPECT_EQ(0640, (int)(st.st_mode & 07777));
+  EXPECT_EQ(fileName("contents of ", 1).size(), (size_t)st.st_size);
+
+  EXPECT_TRUE(dn.isPacked("/d/file1"));
+  EXPECT_EQ(fileName("contents of ", 1), readFile(&dn, "/d/file1"));
+  EXPECT_TRUE(big == readFile(&dn, "/d/big"));
+
+  // writers get a standalone file.
+  int res = 0;
+  shared_ptr<FileNode> node = dn.openNode("/d/file2", "test", O_RDWR, &res);
+  ASSERT_LE(0, res);
+  EXPECT_FALSE(node->isPacked());
+  EXPECT_TRUE(exists(dn.cipherPath("/d/file2")));
+  ASSERT_TRUE(node->write(0, (unsigned char *)"new", 3));
+  node.reset();
+  EXPECT_EQ("newtents of /file2", readFile(&dn, "/d/file2"));
+
+  // with external IVs, the file header changes along with the name.
+  ASSERT_EQ(0, dn.rename("/d/file3", "/d/moved"));
+  EXPECT_FALSE(dn.isPacked("/d/moved"));
+  EXPECT_EQ(fileName("contents of ", 3), readFile(&dn, "/d/moved"));
+
+  ASSERT_EQ(0, dn.unlink("/d/file4"));
+  EXPECT_EQ(-ENOENT, dn.getAttr("/d/file4", &st, &cipherName));
+  EXPECT_FALSE(list(&dn, "/d").count("file4"));
+
+  // the pack goes away once it is empty.
+  EXPECT_EQ(1, dn.unpack("/d/file0"));
+  EXPECT_EQ(0, dn.unpack("/d/file0"));
+  EXPECT_EQ(-ENOTEMPTY, dn.rmdir("/d"));
+  EXPECT_EQ(1, dn.unpack("/d/file1"));
+  EXPECT_FALSE(exists(dn.cipherPath("/d") + "/" + PackStore::IndexName));
+  EXPECT_EQ(fileName("contents of ", 1), readFile(&dn, "/d/file1"));
+  EXPECT_EQ((size_t)FileCount + 2, list(&dn, "/d").size());
+}
+
+}  // namespace
@@ -0,0 +1,371 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/PlainDigest.h"
+
+#include "base/sha256.h"
+#include "base/WorkerPool.h"
+#include "cipher/CipherV1.h"
+
+#include <glog/logging.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+using std::string;
+using std::vector;
+
+namespace encfs {
+
+const char *PlainDigest::AttrName = "user.encfs.sha256";
+
+static const char CacheMagic[4] = {'E', 'P', 'D', '1'};
+static const int HeaderSize = 56;
+
+// Number of inodes whose changes are tracked.  Forgetting one only means its
+// next digest is computed from the start.
+static const size_t MaxTracked = 64 * 1024;
+
+static void putBE(unsigned char *out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i, value >>= 8) out[i] = value & 0xff;
+}
+
+static uint64_t getBE(const unsigned char *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) value = (value << 8) | in[i];
+  return value;
+}
+
+bool PlainDigest::Stamp::operator==(const Stamp &other) const {
+  return inode == other.inode && size == other.size && mtime == other.mtime &&
+         mtimeNsec == other.mtimeNsec;
+}
+
+PlainDigest::Stamp PlainDigest::MakeStamp(const struct stat &st) {
+  Stamp stamp;
+  stamp.inode = st.st_ino;
+  stamp.size = st.st_size;
+  stamp.mtime = st.st_mtime;
+#ifdef linux
+  stamp.mtimeNsec = st.st_mtim.tv_nsec;
+#else
+  stamp.mtimeNsec = 0;
+#endif
+  return stamp;
+}
+
+PlainDigest::PlainDigest(const string &cacheDir,
+                         const shared_ptr<CipherV1> &cipher_,
+                         bool trackChanges_)
+    : dir(cacheDir), trackChanges(trackChanges_), changeCount(0) {
+  // the cache is only used with our mutex held, so keep a private copy of
+  // the cipher rather than share the volume's.
+  cipher = cipher_->clone();
+  if (!cipher) cipher = cipher_;
+
+  // Tag the cache with the key, so that a stale cache isn't used after the
+  // volume is mounted with a different key.
+  const char tagData[] = "encfs plaintext digest";
+  keyTag = cipher->MAC_64((const byte *)tagData, sizeof(tagData) - 1);
+}
+
+PlainDigest::~PlainDigest() {}
+
+int PlainDigest::FormatAttr(const unsigned char *digest, char *buf,
+                            size_t size) {
+  if (size == 0) return HexSize;
+  if (size < (size_t)HexSize) return -ERANGE;
+
+  static const char hex[] = "0123456789abcdef";
+  for (int i = 0; i < SHA256::DigestSize; ++i) {
+    buf[i * 2] = hex[digest[i] >> 4];
+    buf[i * 2 + 1] = hex[digest[i] & 0xf];
+  }
+  return HexSize;
+}
+
+void PlainDigest::changed(ino_t inode, off_t offset) {
+  Lock _lock(mutex);
+  ++changeCount;
+
+  unordered_map<ino_t, Changes>::iterator it = changes.find(inode);
+  if (it != changes.end() && offset < it->second.from)
+    it->second.from = offset;
+}
+
+string PlainDigest::cachePath(const struct stat &st) const {
+  char name[64];
+  snprintf(name, sizeof(name), "%llx-%llx", (unsigned long long)st.st_dev,
+           (unsigned long long)st.st_ino);
+
+  string path = dir;
+  if (path.empty() || path[path.length() - 1] != '/') path.append(1, '/');
+  return path + name;
+}
+
+bool PlainDigest::load(const string &file, Entry *entry) const {
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  unsigned char header[HeaderSize];
+  bool ok = fstat(fd, &st) == 0 &&
+            st.st_size >= HeaderSize + SHA256::DigestSize &&
+            (st.st_size - HeaderSize) % SHA256::StateSize == 0 &&
+            ::read(fd, header, HeaderSize) == HeaderSize &&
+            memcmp(header, CacheMagic, sizeof(CacheMagic)) == 0 &&
+            (int)getBE(header + 4, 4) == LeafSize &&
+            getBE(header + 8, 8) == keyTag;
+
+  vector<unsigned char> body;
+  if (ok) {
+    body.resize(st.st_size - HeaderSize);
+    ok = ::read(fd, &body[0], body.size()) == (ssize_t)body.size();
+  }
+  ::close(fd);
+
+  if (ok) {
+    uint64_t iv = cipher->MAC_64(header, HeaderSize - 8);
+    ok = cipher->streamDecode(&body[0], body.size(), iv) &&
+         cipher->MAC_64(&body[0], body.size()) == getBE(header + 48, 8);
+    LOG_IF(WARNING, !ok) << "ignoring damaged digest cache " << file;
+  }
+
+  if (!ok) return false;
+
+  entry->stamp.inode = getBE(header + 16, 8);
+  entry->stamp.size = getBE(header + 24, 8);
+  entry->stamp.mtime = getBE(header + 32, 8);
+  entry->stamp.mtimeNsec = getBE(header + 40, 8);
+  entry->digest.assign(body.begin(), body.begin() + SHA256::DigestSize);
+  entry->states.assign(body.begin() + SHA256::DigestSize, body.end());
+  return true;
+}
+
+void PlainDigest::save(const string &file, const Entry &entry) const {
+  unsigned char header[HeaderSize];
+  memcpy(header, CacheMagic, sizeof(CacheMagic));
+  putBE(header + 4, LeafSize, 4);
+  putBE(header + 8, keyTag, 8);
+  putBE(header + 16, entry.stamp.inode, 8);
+  putBE(header + 24, entry.stamp.size, 8);
+  putBE(header + 32, entry.stamp.mtime, 8);
+  putBE(header + 40, entry.stamp.mtimeNsec, 8);
+
+  vector<unsigned char> body(entry.digest);
+  body.insert(body.end(), entry.states.begin(), entry.states.end());
+  putBE(header + 48, cipher->MAC_64(&body[0], body.size()), 8);
+
+  // the IV depends on the inode and stamp, so that it changes along with
+  // the contents.
+  uint64_t iv = cipher->MAC_64(header, HeaderSize - 8);
+  if (!cipher->streamEncode(&body[0], body.size(), iv)) {
+    LOG(WARNING) << "unable to encode digest cache " << file;
+    return;
+  }
+
+  // write to a temporary and rename, so readers never see a partial file.
+  string tmpName = file + ".tmp";
+  int fd = ::open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    LOG(WARNING) << "unable to write digest cache " << tmpName << ": "
+                 << strerror(errno);
+    return;
+  }
+
+  bool ok = ::write(fd, header, HeaderSize) == HeaderSize &&
+            ::write(fd, &body[0], body.size()) == (ssize_t)body.size();
+  ok = (::close(fd) == 0) && ok;
+  if (!ok || ::rename(tmpName.c_str(), file.c_str()) != 0) {
+    LOG(WARNING) << "unable to save digest cache " << file << ": "
+                 << strerror(errno);
+    ::unlink(tmpName.c_str());
+  }
+}
+
+static ssize_t readLeaf(const PlainDigest::Reader &reader, int lane,
+                        off_t offset, unsigned char *buf) {
+  ssize_t total = 0;
+  while (total < PlainDigest::LeafSize) {
+    ssize_t res = reader(lane, offset + total, buf + total,
+                         PlainDigest::LeafSize - total);
+    if (res < 0) return res;
+    if (res == 0) break;
+    total += res;
+  }
+  return total;
+}
+
+int PlainDigest::compute(int firstLeaf, int lanes, const Reader &reader,
+                         Entry *entry) const {
+  SHA256 sha;
+  if (firstLeaf > 0)
+    sha.restoreState(&entry->states[firstLeaf * SHA256::StateSize],
+                     (uint64_t)firstLeaf * LeafSize);
+  entry->states.resize(firstLeaf * SHA256::StateSize);
+
+  // Two sets of leaf buffers: while one set is being hashed on this thread,
+  // the next leaves are read into the other by the worker pool.
+  vector<unsigned char> buffers[2];
+  vector<ssize_t> lengths[2];
+  for (int i = 0; i < 2; ++i) {
+    buffers[i].resize((size_t)lanes * LeafSize);
+    lengths[i].resize(lanes);
+  }
+
+  shared_ptr<WorkerPool> pool = WorkerPool::Default();
+  off_t offset = (off_t)firstLeaf * LeafSize;
+  int hashSet = -1;
+  int readSet = 0;
+  bool readDone = false;
+  bool hashDone = false;
+  int res = 0;
+
+  while (!hashDone) {
+    pool->parallelFor(lanes + 1, [&](int task) {
+      if (task > 0) {
+        if (!readDone) {
+          int lane = task - 1;
+          lengths[readSet][lane] =
+              readLeaf(reader, lane, offset + (off_t)lane * LeafSize,
+                       &buffers[readSet][(size_t)lane * LeafSize]);
+        }
+        return;
+      }
+
+      for (int lane = 0; hashSet >= 0 && !hashDone && lane < lanes; ++lane) {
+        ssize_t len = lengths[hashSet][lane];
+        if (len < 0) {
+          res = len;
+          hashDone = true;
+          break;
+        }
+
+        size_t pos = entry->states.size();
+        entry->states.resize(pos + SHA256::StateSize);
+        sha.saveState(&entry->states[pos]);
+
+        sha.update(&buffers[hashSet][(size_t)lane * LeafSize], len);
+        if (len < LeafSize) hashDone = true;
+      }
+    });
+
+    if (readDone) {
+      hashSet = -1;
+      continue;
+    }
+
+    for (int lane = 0; lane < lanes; ++lane)
+      if (lengths[readSet][lane] < LeafSize) readDone = true;
+
+    offset += (off_t)lanes * LeafSize;
+    hashSet = readSet;
+    readSet = 1 - readSet;
+  }
+
+  if (res < 0) return res;
+
+  entry->digest.resize(SHA256::DigestSize);
+  sha.final(&entry->digest[0]);
+  return 0;
+}
+
+int PlainDigest::digest(const string &cipherPath, int lanes,
+                        const Reader &reader, unsigned char *out) {
+  if (lanes < 1) lanes = 1;
+  if (lanes > MaxLanes) lanes = MaxLanes;
+
+  Entry entry;
+  struct stat st;
+  string file;
+  int firstLeaf = 0;
+  uint64_t startCount;
+  {
+    Lock _lock(mutex);
+    startCount = changeCount;
+
+    // packed files have no backing inode of their own, and aren't cached.
+    if (!dir.empty() && ::stat(cipherPath.c_str(), &st) == 0 &&
+        S_ISREG(st.st_mode))
+      file = cachePath(st);
+
+    if (!file.empty() && load(file, &entry)) {
+      if (entry.stamp == MakeStamp(st)) {
+        memcpy(out, &entry.digest[0], SHA256::DigestSize);
+        return 0;
+      }
+
+      // Resume from the leaf holding the first change.  Data past the old
+      // end of file can only be in the last leaf there is a state for.
+      unordered_map<ino_t, Changes>::const_iterator it =
+          changes.find(st.st_ino);
+      if (trackChanges && it != changes.end() &&
+          it->second.base == entry.stamp) {
+        off_t stored = entry.states.size() / SHA256::StateSize;
+        off_t leaf = it->second.from / LeafSize;
+        firstLeaf = (int)((leaf < stored - 1) ? leaf : stored - 1);
+      }
+    }
+  }
+
+  for (;;) {
+    VLOG(1) << "hashing " << cipherPath << " from leaf " << firstLeaf;
+    int res = compute(firstLeaf, lanes, reader, &entry);
+    if (res < 0) return res;
+
+    // a resumed hash is only good if nothing changed while it ran.
+    Lock _lock(mutex);
+    if (firstLeaf == 0 || changeCount == startCount) break;
+
+    firstLeaf = 0;
+    startCount = changeCount;
+  }
+
+  memcpy(out, &entry.digest[0], SHA256::DigestSize);
+  if (file.empty()) return 0;
+
+  // Don't save a digest for a file which changed while we were reading it.
+  struct stat after;
+  Stamp stamp = MakeStamp(st);
+  if (::stat(cipherPath.c_str(), &after) != 0 || !(MakeStamp(after) == stamp))
+    return 0;
+
+  Lock _lock(mutex);
+  entry.stamp = stamp;
+  save(file, entry);
+
+  if (trackChanges && changeCount == startCount) {
+    if (changes.size() >= MaxTracked && !changes.count(st.st_ino))
+      changes.clear();
+
+    Changes &tracked = changes[st.st_ino];
+    tracked.base = stamp;
+    tracked.from = std::numeric_limits<off_t>::max();
+  }
+
+  return 0;
+}
+
+}  // namespace encfs
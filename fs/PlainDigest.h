@@ -0,0 +1,140 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PlainDigest_incl_
+#define _PlainDigest_incl_
+
+#include "base/config.h"
+#include "base/Mutex.h"
+#include "base/shared_ptr.h"
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+using std::tr1::unordered_map;
+#else
+#include <unordered_map>
+using std::unordered_map;
+#endif
+
+struct stat;
+
+namespace encfs {
+
+class CipherV1;
+
+/*
+    SHA-256 of a file's plaintext, computed inside encfs.
+
+    Exposed through the extended attribute "user.encfs.sha256" as 64 hex
+    digits, the same as sha256sum prints.  The plaintext is read LeafSize
+    bytes at a time, with the next few leaves being read (and so decoded) in
+    parallel while the current ones are hashed.
+
+    If a cache directory is given, the result is kept there along with the
+    hash state at the start of every leaf, one encrypted file per backing
+    inode, and reused while the backing file's size and mtime are unchanged.
+    Writes and truncates through this mount record the lowest offset they
+    touched, so that after a change the hash only has to be resumed from the
+    leaf holding that offset, rather than restarted.  This relies on encfs
+    being the only writer, so it isn't done for shared volumes.
+*/
+class PlainDigest {
+ public:
+  static const char *AttrName;
+  static const int LeafSize = 1024 * 1024;
+  static const int HexSize = 64;
+  static const int MaxLanes = 4;
+
+  // Reads plaintext for one of the parallel lanes.  Returns the number of
+  // bytes read, which is only short at the end of the file, or -errno.
+  typedef std::function<ssize_t(int lane, off_t offset, unsigned char *buf,
+                                ssize_t size)> Reader;
+
+  // cacheDir may be empty, to disable caching.
+  PlainDigest(const std::string &cacheDir, const shared_ptr<CipherV1> &cipher,
+              bool trackChanges);
+  ~PlainDigest();
+
+  // Computes the digest of the file with backing path cipherPath into out
+  // (SHA256::DigestSize bytes).  Returns 0 or -errno.
+  int digest(const std::string &cipherPath, int lanes, const Reader &reader,
+             unsigned char *out);
+
+  // getxattr style: formats the digest as hex into buf, and returns the
+  // length, or -ERANGE if size is too small.  If size is 0, just returns the
+  // length.
+  static int FormatAttr(const unsigned char *digest, char *buf, size_t size);
+
+  // To be called before the plaintext of the backing inode is changed from
+  // offset onwards.
+  void changed(ino_t inode, off_t offset);
+
+ private:
+  struct Stamp {
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t mtimeNsec;
+
+    bool operator==(const Stamp &other) const;
+  };
+
+  // Saved result.  states[i] is the hash state at the start of leaf i.
+  struct Entry {
+    Stamp stamp;
+    std::vector<unsigned char> digest;
+    std::vector<unsigned char> states;
+  };
+
+  // Changes since the entry with stamp base was saved.
+  struct Changes {
+    Stamp base;
+    off_t from;
+  };
+
+  static Stamp MakeStamp(const struct stat &st);
+  std::string cachePath(const struct stat &st) const;
+  bool load(const std::string &file, Entry *entry) const;
+  void save(const std::string &file, const Entry &entry) const;
+
+  int compute(int firstLeaf, int lanes, const Reader &reader,
+              Entry *entry) const;
+
+  std::string dir;
+  shared_ptr<CipherV1> cipher;
+  uint64_t keyTag;
+  bool trackChanges;
+
+  // counts calls to changed(), to tell whether any happened during a digest.
+  uint64_t changeCount;
+  unordered_map<ino_t, Changes> changes;
+
+  mutable Mutex mutex;
+};
+
+}  // namespace encfs
+
+#endif
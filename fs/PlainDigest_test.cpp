@@ -0,0 +1,291 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/sha256.h"
+#include "cipher/CipherV1.h"
+#include "fs/PlainDigest.h"
+
+using namespace encfs;
+using std::string;
+using std::vector;
+
+namespace {
+
+string hexDigest(const unsigned char *digest) {
+  char buf[PlainDigest::HexSize];
+  EXPECT_EQ((int)PlainDigest::HexSize,
+            PlainDigest::FormatAttr(digest, buf, sizeof(buf)));
+  return string(buf, sizeof(buf));
+}
+
+string sha256(const string &data) {
+  SHA256 sha;
+  sha.update((const byte *)data.data(), data.length());
+  unsigned char digest[SHA256::DigestSize];
+  sha.final(digest);
+  return hexDigest(digest);
+}
+
+TEST(SHA256Test, KnownVectors) {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            sha256(""));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            sha256("abc"));
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"));
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            sha256(string(1000000, 'a')));
+}
+
+TEST(SHA256Test, UnalignedUpdates) {
+  string data;
+  for (int i = 0; i < 1000; ++i) data.append(1, (char)(i * 7));
+
+  SHA256 sha;
+  for (size_t pos = 0, step = 1; pos < data.length(); pos += step, ++step) {
+    size_t len = std::min(step, data.length() - pos);
+    sha.update((const byte *)data.data() + pos, len);
+  }
+  unsigned char digest[SHA256::DigestSize];
+  sha.final(digest);
+  EXPECT_EQ(sha256(data), hexDigest(digest));
+}
+
+TEST(SHA256Test, ResumeFromState) {
+  string data(3 * SHA256::BlockSize + 10, 'x');
+
+  SHA256 first;
+  first.update((const byte *)data.data(), 2 * SHA256::BlockSize);
+  unsigned char state[SHA256::StateSize];
+  ASSERT_TRUE(first.saveState(state));
+
+  first.update((const byte *)data.data(), 1);
+  EXPECT_FALSE(first.saveState(state));
+
+  SHA256 second;
+  second.restoreState(state, 2 * SHA256::BlockSize);
+  second.update((const byte *)data.data() + 2 * SHA256::BlockSize,
+                data.length() - 2 * SHA256::BlockSize);
+  unsigned char digest[SHA256::DigestSize];
+  second.final(digest);
+  EXPECT_EQ(sha256(data), hexDigest(digest));
+}
+
+TEST(PlainDigestAttrTest, FormatAttr) {
+  unsigned char digest[SHA256::DigestSize];
+  memset(digest, 0xa5, sizeof(digest));
+
+  char buf[PlainDigest::HexSize];
+  EXPECT_EQ((int)PlainDigest::HexSize,
+            PlainDigest::FormatAttr(digest, NULL, 0));
+  EXPECT_EQ(-ERANGE, PlainDigest::FormatAttr(digest, buf, sizeof(buf) - 1));
+  string hex;
+  for (int i = 0; i < SHA256::DigestSize; ++i) hex.append("a5");
+  EXPECT_EQ(hex, hexDigest(digest));
+}
+
+class PlainDigestTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-digest-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+    rootDir = tmpl;
+    cacheDir = rootDir + "/cache";
+    fileName = rootDir + "/file";
+    ASSERT_EQ(0, mkdir(cacheDir.c_str(), 0700));
+
+    cipher = CipherV1::New("AES", 256);
+    ASSERT_TRUE(cipher.get() != NULL);
+    cipher->setKey(cipher->newRandomKey());
+
+    reads = 0;
+    firstRead = -1;
+  }
+
+  virtual void TearDown() {
+    DIR *dir = opendir(cacheDir.c_str());
+    if (dir != NULL) {
+      struct dirent *de;
+      while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.')
+          unlink((cacheDir + "/" + de->d_name).c_str());
+      }
+      closedir(dir);
+    }
+    rmdir(cacheDir.c_str());
+    unlink(fileName.c_str());
+    rmdir(rootDir.c_str());
+  }
+
+  // Stands in for the plaintext, with the backing file only being used for
+  // its attributes.
+  void setData(size_t len, char fill) {
+    data.resize(len);
+    for (size_t i = 0; i < len; ++i) data[i] = fill + (char)(i / 4096);
+
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT_LE(0, fd);
+    if (len > 0) ASSERT_EQ((ssize_t)len, write(fd, &data[0], len));
+    close(fd);
+  }
+
+  void changeData(off_t offset, char fill, PlainDigest *digest) {
+    struct stat st;
+    ASSERT_EQ(0, stat(fileName.c_str(), &st));
+    digest->changed(st.st_ino, offset);
+
+    data[offset] = fill;
+    int fd = open(fileName.c_str(), O_WRONLY);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(1, pwrite(fd, &fill, 1, offset));
+    close(fd);
+
+    // make sure the mtime moves on even with coarse timestamps.
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = st.st_mtime + 10;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    ASSERT_EQ(0, utimensat(AT_FDCWD, fileName.c_str(), times, 0));
+  }
+
+  string digestOf(PlainDigest *digest, int lanes) {
+    PlainDigest::Reader reader = [this](int lane, off_t offset,
+                                        unsigned char *buf, ssize_t size) {
+      (void)lane;
+      if (offset >= (off_t)data.size()) return (ssize_t)0;
+      ssize_t len = std::min(size, (ssize_t)(data.size() - offset));
+      memcpy(buf, &data[offset], len);
+
+      Lock _lock(readMutex);
+      ++reads;
+      if (firstRead < 0 || offset < firstRead) firstRead = offset;
+      return len;
+    };
+
+    unsigned char out[SHA256::DigestSize];
+    EXPECT_EQ(0, digest->digest(fileName, lanes, reader, out));
+    return hexDigest(out);
+  }
+
+  string expected() const {
+    return sha256(string(data.begin(), data.end()));
+  }
+
+  string rootDir;
+  string cacheDir;
+  string fileName;
+  shared_ptr<CipherV1> cipher;
+  vector<char> data;
+
+  Mutex readMutex;
+  int reads;
+  off_t firstRead;
+};
+
+TEST_F(PlainDigestTest, MatchesSHA256) {
+  PlainDigest digest("", cipher, true);
+
+  const size_t sizes[] = {0, 1, PlainDigest::LeafSize,
+                          3 * PlainDigest::LeafSize + 5};
+  for (int lanes = 1; lanes <= PlainDigest::MaxLanes; ++lanes) {
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      setData(sizes[i], 'a');
+      EXPECT_EQ(expected(), digestOf(&digest, lanes))
+          << "size " << sizes[i] << ", lanes " << lanes;
+    }
+  }
+}
+
+TEST_F(PlainDigestTest, CachedWhileUnchanged) {
+  PlainDigest digest(cacheDir, cipher, true);
+  setData(2 * PlainDigest::LeafSize, 'a');
+
+  EXPECT_EQ(expected(), digestOf(&digest, 2));
+  EXPECT_LT(0, reads);
+
+  reads = 0;
+  EXPECT_EQ(expected(), digestOf(&digest, 2));
+  EXPECT_EQ(0, reads);
+
+  // a new instance, as after a remount, uses the saved digest too.
+  PlainDigest again(cacheDir, cipher, true);
+  EXPECT_EQ(expected(), digestOf(&again, 2));
+  EXPECT_EQ(0, reads);
+
+  // but not with another key.
+  shared_ptr<CipherV1> other = CipherV1::New("AES", 256);
+  other->setKey(other->newRandomKey());
+  PlainDigest otherKey(cacheDir, other, true);
+  EXPECT_EQ(expected(), digestOf(&otherKey, 2));
+  EXPECT_LT(0, reads);
+}
+
+TEST_F(PlainDigestTest, ResumesAfterChange) {
+  PlainDigest digest(cacheDir, cipher, true);
+  setData(4 * PlainDigest::LeafSize + 100, 'a');
+  EXPECT_EQ(expected(), digestOf(&digest, 3));
+
+  changeData(2 * PlainDigest::LeafSize + 10, 'z', &digest);
+  firstRead = -1;
+  EXPECT_EQ(expected(), digestOf(&digest, 3));
+  EXPECT_EQ(2 * PlainDigest::LeafSize, firstRead);
+
+  // changes which aren't reported mean starting over.
+  PlainDigest untracked(cacheDir, cipher, false);
+  EXPECT_EQ(expected(), digestOf(&untracked, 3));
+  changeData(3 * PlainDigest::LeafSize, 'y', &untracked);
+  firstRead = -1;
+  EXPECT_EQ(expected(), digestOf(&untracked, 3));
+  EXPECT_EQ(0, firstRead);
+}
+
+TEST_F(PlainDigestTest, ResumesAfterAppend) {
+  PlainDigest digest(cacheDir, cipher, true);
+  setData(2 * PlainDigest::LeafSize + 100, 'a');
+  EXPECT_EQ(expected(), digestOf(&digest, 2));
+
+  struct stat st;
+  ASSERT_EQ(0, stat(fileName.c_str(), &st));
+  digest.changed(st.st_ino, data.size());
+  int fd = open(fileName.c_str(), O_WRONLY | O_APPEND);
+  ASSERT_LE(0, fd);
+  string more(PlainDigest::LeafSize, 'b');
+  ASSERT_EQ((ssize_t)more.length(), write(fd, more.data(), more.length()));
+  close(fd);
+  data.insert(data.end(), more.begin(), more.end());
+
+  firstRead = -1;
+  EXPECT_EQ(expected(), digestOf(&digest, 2));
+  EXPECT_EQ(2 * PlainDigest::LeafSize, firstRead);
+}
+
+}  // namespace
@@ -66,6 +66,8 @@ RawFileIO::~RawFileIO() {
   if (_oldfd != -1) close(_oldfd);
 
   if (_fd != -1) close(_fd);
+
+  name.assign(name.length(), '\0');
 }
 
 Interface RawFileIO::interface() const { return RawFileIO_iface; }
@@ -143,6 +145,10 @@ int RawFileIO::open(int flags) {
       canWrite = requestWrite;
       oldfd = fd;
       result = fd = newFd;
+
+      // refetch the size through the new descriptor when it is needed, in
+      // case the file changed while we didn't have it open.
+      knownSize = false;
     } else {
       result = -errno;
       LOG(INFO) << "::open error: " << strerror(errno);
@@ -154,13 +160,24 @@ int RawFileIO::open(int flags) {
   return result;
 }
 
+// Uses the descriptor if there is one, which saves a path lookup.
+int RawFileIO::statFile(struct stat *stbuf) const {
+  int res = (fd >= 0) ? fstat(fd, stbuf) : lstat(name.c_str(), stbuf);
+  return (res < 0) ? -errno : 0;
+}
+
 int RawFileIO::getAttr(struct stat *stbuf) const {
-  int res = lstat(name.c_str(), stbuf);
-  int eno = errno;
+  int res = statFile(stbuf);
+
+  LOG_IF(INFO, res < 0) << "getAttr error on " << name << ": "
+                        << strerror(-res);
 
-  LOG_IF(INFO, res < 0) << "getAttr error on " << name << ": " << strerror(eno);
+  if (res == 0 && S_ISREG(stbuf->st_mode)) {
+    fileSize = stbuf->st_size;
+    knownSize = true;
+  }
 
-  return (res < 0) ? -eno : 0;
+  return res;
 }
 
 void RawFileIO::setFileName(const char *fileName) { name = fileName; }
@@ -171,7 +188,7 @@ off_t RawFileIO::getSize() const {
   if (!knownSize) {
     struct stat stbuf;
     memset(&stbuf, 0, sizeof(struct stat));
-    int res = lstat(name.c_str(), &stbuf);
+    int res = statFile(&stbuf);
 
     if (res == 0) {
       fileSize = stbuf.st_size;
@@ -213,7 +230,9 @@ bool RawFileIO::write(const IORequest &req) {
     ssize_t writeSize = ::pwrite(fd, buf, bytes, offset);
 
     if (writeSize < 0) {
-      knownSize = false;
+      // pwrite doesn't write anything when it fails, so the size is still
+      // known.
+      if (knownSize && offset > fileSize) fileSize = offset;
       LOG(INFO) << "write failed at offset " << offset << " for " << bytes
                 << " bytes: " << strerror(errno);
       return false;
@@ -228,7 +247,7 @@ bool RawFileIO::write(const IORequest &req) {
   if (bytes != 0) {
     LOG(ERROR) << "Write error: wrote " << (req.dataLen - bytes) << " bytes of "
                << req.dataLen << ", max retries reached";
-    knownSize = false;
+    if (knownSize && offset > fileSize) fileSize = offset;
     return false;
   } else {
     if (knownSize) {
@@ -256,7 +275,6 @@ int RawFileIO::truncate(off_t size) {
     LOG(INFO) << "truncate failed for " << name << " (" << fd << ") size "
               << size << ", error " << strerror(eno);
     res = -eno;
-    knownSize = false;
   } else {
     res = 0;
     fileSize = size;
@@ -268,4 +286,18 @@ int RawFileIO::truncate(off_t size) {
 
 bool RawFileIO::isWritable() const { return canWrite; }
 
+/*
+    Flush can be called multiple times for an open file, so it doesn't close
+    the file.  However it is important to call close() for some underlying
+    filesystems (like NFS).
+*/
+int RawFileIO::flush() {
+  if (fd < 0) return 0;
+
+  int res = close(dup(fd));
+  return (res == -1) ? -errno : 0;
+}
+
+void RawFileIO::invalidateCache() { knownSize = false; }
+
 }  // namespace encfs
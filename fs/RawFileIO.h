@@ -50,9 +50,17 @@ class RawFileIO : public FileIO {
 
   virtual bool isWritable() const;
 
+  virtual int flush();
+  virtual void invalidateCache();
+
  protected:
+  int statFile(struct stat *stbuf) const;
+
   std::string name;
 
+  // Size of the file.  Kept up to date by our own writes and truncates, and
+  // refetched when a new descriptor is opened or the cache is invalidated.
+
   mutable bool knownSize;
   mutable off_t fileSize;
 
@@ -0,0 +1,102 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "fs/testing.h"
+#include "fs/FSConfig.h"
+#include "fs/MemFileIO.h"
+#include "fs/RawFileIO.h"
+
+using namespace encfs;
+using std::string;
+
+namespace {
+
+class RawFileIOTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = "/tmp/encfs-raw-XXXXXX";
+    int fd = mkstemp(tmpl);
+    ASSERT_LE(0, fd);
+    close(fd);
+    fileName = tmpl;
+  }
+
+  virtual void TearDown() { unlink(fileName.c_str()); }
+
+  string fileName;
+};
+
+TEST_F(RawFileIOTest, CompareWithMemory) {
+  FSConfigPtr cfg = makeConfig(CipherV1::New("Null"), 512);
+
+  shared_ptr<RawFileIO> test(new RawFileIO(fileName));
+  ASSERT_LE(0, test->open(O_RDWR));
+
+  shared_ptr<MemFileIO> dup(new MemFileIO(0));
+  comparisonTest(cfg, test.get(), dup.get());
+}
+
+TEST_F(RawFileIOTest, AttributesFromDescriptor) {
+  RawFileIO io(fileName);
+  ASSERT_LE(0, io.open(O_RDWR));
+
+  char data[1000];
+  memset(data, 'x', sizeof(data));
+  IORequest req;
+  req.offset = 0;
+  req.data = (unsigned char *)data;
+  req.dataLen = sizeof(data);
+  ASSERT_TRUE(io.write(req));
+
+  // once the name is gone, only the descriptor can reach the file.
+  ASSERT_EQ(0, unlink(fileName.c_str()));
+
+  struct stat stbuf;
+  ASSERT_EQ(0, io.getAttr(&stbuf));
+  EXPECT_EQ(1000, stbuf.st_size);
+
+  ASSERT_EQ(0, io.truncate(100));
+  EXPECT_EQ(100, io.getSize());
+
+  io.invalidateCache();
+  EXPECT_EQ(100, io.getSize());
+}
+
+TEST_F(RawFileIOTest, SizeRefreshedOnOpen) {
+  RawFileIO io(fileName);
+  ASSERT_LE(0, io.open(O_RDONLY));
+  EXPECT_EQ(0, io.getSize());
+
+  // changed by someone else, then reopened for writing.
+  ASSERT_EQ(0, ::truncate(fileName.c_str(), 4096));
+  ASSERT_LE(0, io.open(O_RDWR));
+  EXPECT_EQ(4096, io.getSize());
+}
+
+}  // namespace
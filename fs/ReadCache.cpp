@@ -0,0 +1,132 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fs/ReadCache.h"
+
+#include "base/Error.h"
+
+#include <cstring>
+
+namespace encfs {
+
+ReadCache::ReadCache(int blockSize_)
+    : blockSize(blockSize_), slots(NULL), rereads(0) {
+  rAssert(blockSize > 0);
+  for (int i = 0; i < Entries; ++i) seen[i] = -1;
+}
+
+ReadCache::~ReadCache() { delete[] slots.load(); }
+
+ssize_t ReadCache::read(off_t offset, byte *data, ssize_t len) const {
+  const Slot *table = slots.load(std::memory_order_acquire);
+  if (!table) return -1;
+
+  ssize_t done = 0;
+  while (done < len) {
+    off_t pos = offset + done;
+    int64_t block = pos / blockSize;
+    int skip = pos % blockSize;
+    const Slot &slot = table[block % Entries];
+
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1) return -1;  // being changed
+    if (slot.block.load(std::memory_order_relaxed) != block) return -1;
+
+    int blockLen = slot.len.load(std::memory_order_relaxed);
+    ssize_t copyLen = blockLen - skip;
+    if (copyLen > len - done) copyLen = len - done;
+    if (copyLen > 0) memcpy(data + done, slot.data + skip, copyLen);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) return -1;
+
+    if (copyLen <= 0) break;
+    done += copyLen;
+
+    // a short block is the end of the file.
+    if (blockLen < blockSize) break;
+  }
+
+  return done;
+}
+
+void ReadCache::store(int64_t block, const byte *data, int len) {
+  Slot *table = slots.load(std::memory_order_relaxed);
+  if (!table) {
+    int64_t &last = seen[block % Entries];
+    if (last == block) ++rereads;
+    last = block;
+    if (rereads < Rereads) return;
+
+    buffer.allocate(Entries * blockSize);
+    table = new Slot[Entries];
+    for (int i = 0; i < Entries; ++i) {
+      table[i].seq.store(0, std::memory_order_relaxed);
+      table[i].block.store(-1, std::memory_order_relaxed);
+      table[i].len.store(0, std::memory_order_relaxed);
+      table[i].data = buffer.data + i * blockSize;
+    }
+    slots.store(table, std::memory_order_release);
+  }
+
+  Slot &slot = table[block % Entries];
+  uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot.block.store(block, std::memory_order_relaxed);
+  slot.len.store(len, std::memory_order_relaxed);
+  if (len > 0) memcpy(slot.data, data, len);
+
+  slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+void ReadCache::insert(off_t offset, const byte *data, ssize_t len,
+                       ssize_t requested) {
+  if (len <= 0) return;
+
+  off_t end = offset + len;
+  int64_t block = (offset + blockSize - 1) / blockSize;
+  for (off_t pos = block * blockSize; pos < end; pos += blockSize, ++block) {
+    if (pos + blockSize <= end)
+      store(block, data + (pos - offset), blockSize);
+    else if (len < requested)
+      store(block, data + (pos - offset), end - pos);
+  }
+}
+
+void ReadCache::clear() {
+  Slot *table = slots.load(std::memory_order_relaxed);
+  if (!table) return;
+
+  for (int i = 0; i < Entries; ++i) {
+    Slot &slot = table[i];
+    if (slot.block.load(std::memory_order_relaxed) < 0) continue;
+
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.block.store(-1, std::memory_order_relaxed);
+    slot.len.store(0, std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+  }
+}
+
+}  // namespace encfs
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013, Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ReadCache_incl_
+#define _ReadCache_incl_
+
+#include "base/types.h"
+#include "cipher/MemoryPool.h"
+
+#include <atomic>
+#include <inttypes.h>
+#include <sys/types.h>
+
+namespace encfs {
+
+/*
+    Small cache of decoded blocks for one file, which can be read without
+    taking any locks.
+
+    Blocks are stored direct mapped, in Entries slots.  Each slot has a
+    sequence number which is odd while the slot is being changed (a
+    seqlock).  A reader copies the data out and then checks that the
+    sequence number didn't change, so a reader never blocks a writer and a
+    reader never sees a partially updated block.
+
+    insert() and clear() must be serialized by the caller.  Most files are
+    read once, front to back, so until blocks are read for a second time
+    only their numbers are remembered.  Slot buffers are allocated after
+    Rereads such repeated reads, and then live as long as the cache, so
+    readers don't need to worry about buffers being freed under them.
+*/
+class ReadCache {
+ public:
+  static const int Entries = 8;
+  static const int Rereads = 2;
+
+  explicit ReadCache(int blockSize);
+  ~ReadCache();
+
+  // Copies len bytes at offset if all of the blocks involved are cached.
+  // Returns the number of bytes copied, which is short at the end of the
+  // file, or -1 if the data isn't all cached.  Lock free.
+  ssize_t read(off_t offset, byte *data, ssize_t len) const;
+
+  // Stores data which was read from the file.  len bytes were returned for
+  // a request of requested bytes.  Only whole blocks are stored, or the
+  // last block of the file if len is short.
+  void insert(off_t offset, const byte *data, ssize_t len, ssize_t requested);
+
+  // Drops all cached blocks.
+  void clear();
+
+ private:
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    std::atomic<int64_t> block;
+    std::atomic<int> len;
+    byte *data;
+  };
+
+  void store(int64_t block, const byte *data, int len);
+
+  int blockSize;
+  std::atomic<Slot *> slots;
+  MemBlock buffer;
+
+  // blocks stored before the slots were allocated, and how many of them
+  // were stored again.
+  int64_t seen[Entries];
+  int rereads;
+
+  ReadCache(const ReadCache &);
+  ReadCache &operator=(const ReadCache &);
+};
+
+}  // namespace encfs
+
+#endif
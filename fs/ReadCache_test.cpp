@@ -0,0 +1,155 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <cstring>
+
+#include "fs/ReadCache.h"
+
+using namespace encfs;
+
+namespace {
+
+const int BlockSize = 64;
+
+// Makes the cache allocate its slots, by reading one block repeatedly.
+void activate(ReadCache *cache) {
+  byte data[BlockSize];
+  memset(data, 0, sizeof(data));
+  for (int i = 0; i <= ReadCache::Rereads; ++i)
+    cache->insert(0, data, BlockSize, BlockSize);
+  cache->clear();
+}
+
+TEST(ReadCacheTest, OnlyAfterRereads) {
+  ReadCache cache(BlockSize);
+
+  byte data[2 * BlockSize];
+  memset(data, 0x44, sizeof(data));
+  byte buf[BlockSize];
+
+  // reading through a file once doesn't cache anything.
+  cache.insert(0, data, 2 * BlockSize, 2 * BlockSize);
+  EXPECT_EQ(-1, cache.read(0, buf, BlockSize));
+
+  for (int i = 1; i < ReadCache::Rereads; ++i) {
+    cache.insert(0, data, BlockSize, BlockSize);
+    EXPECT_EQ(-1, cache.read(0, buf, BlockSize));
+  }
+
+  cache.insert(0, data, BlockSize, BlockSize);
+  ASSERT_EQ(BlockSize, cache.read(0, buf, BlockSize));
+  EXPECT_EQ(0, memcmp(data, buf, BlockSize));
+}
+
+TEST(ReadCacheTest, HitsAndMisses) {
+  ReadCache cache(BlockSize);
+  activate(&cache);
+
+  byte buf[4 * BlockSize];
+  EXPECT_EQ(-1, cache.read(0, buf, BlockSize));
+
+  byte data[3 * BlockSize];
+  for (int i = 0; i < (int)sizeof(data); ++i) data[i] = i & 0xff;
+
+  // an unaligned read only caches the whole blocks it covered.
+  cache.insert(10, data + 10, 2 * BlockSize, 2 * BlockSize);
+  EXPECT_EQ(-1, cache.read(0, buf, BlockSize));
+  ASSERT_EQ(BlockSize, cache.read(BlockSize, buf, BlockSize));
+  EXPECT_EQ(0, memcmp(data + BlockSize, buf, BlockSize));
+  EXPECT_EQ(-1, cache.read(2 * BlockSize, buf, 1));
+
+  cache.insert(0, data, 2 * BlockSize, 2 * BlockSize);
+  ASSERT_EQ(BlockSize + 20, cache.read(5, buf, BlockSize + 20));
+  EXPECT_EQ(0, memcmp(data + 5, buf, BlockSize + 20));
+
+  cache.clear();
+  EXPECT_EQ(-1, cache.read(BlockSize, buf, BlockSize));
+}
+
+TEST(ReadCacheTest, EndOfFile) {
+  ReadCache cache(BlockSize);
+  activate(&cache);
+
+  byte data[BlockSize + 10];
+  memset(data, 0x33, sizeof(data));
+
+  // short read, so the partial block is the end of the file.
+  cache.insert(0, data, sizeof(data), 4 * BlockSize);
+
+  byte buf[4 * BlockSize];
+  ASSERT_EQ((ssize_t)sizeof(data), cache.read(0, buf, sizeof(buf)));
+  EXPECT_EQ(0, memcmp(data, buf, sizeof(data)));
+  EXPECT_EQ(5, cache.read(BlockSize + 5, buf, 100));
+  EXPECT_EQ(0, cache.read(BlockSize + 10, buf, 100));
+}
+
+struct ReaderState {
+  ReadCache *cache;
+  volatile bool *stop;
+  bool torn;
+};
+
+void *readLoop(void *arg) {
+  ReaderState *state = static_cast<ReaderState *>(arg);
+  byte buf[BlockSize];
+  while (!*state->stop) {
+    if (state->cache->read(0, buf, BlockSize) != BlockSize) continue;
+    for (int i = 1; i < BlockSize; ++i)
+      if (buf[i] != buf[0]) state->torn = true;
+  }
+  return 0;
+}
+
+TEST(ReadCacheTest, NoTornReads) {
+  ReadCache cache(BlockSize);
+  activate(&cache);
+  volatile bool stop = false;
+
+  byte data[BlockSize];
+  memset(data, 0, sizeof(data));
+  cache.insert(0, data, BlockSize, BlockSize);
+
+  const int Readers = 4;
+  pthread_t threads[Readers];
+  ReaderState states[Readers];
+  for (int i = 0; i < Readers; ++i) {
+    states[i].cache = &cache;
+    states[i].stop = &stop;
+    states[i].torn = false;
+    pthread_create(&threads[i], 0, readLoop, &states[i]);
+  }
+
+  // each version of the block is a single repeated byte.
+  for (int version = 1; version < 20000; ++version) {
+    memset(data, version & 0xff, sizeof(data));
+    cache.insert(0, data, BlockSize, BlockSize);
+  }
+
+  stop = true;
+  for (int i = 0; i < Readers; ++i) {
+    pthread_join(threads[i], 0);
+    EXPECT_FALSE(states[i].torn);
+  }
+}
+
+}  // namespace
@@ -21,6 +21,7 @@
 #include "base/base64.h"
 #include "base/Error.h"
 #include "base/i18n.h"
+#include "cipher/CipherPool.h"
 #include "cipher/CipherV1.h"
 #include "fs/StreamNameIO.h"
 
@@ -75,7 +76,9 @@ Interface StreamNameIO::CurrentInterface() {
 
 StreamNameIO::StreamNameIO(const Interface &iface,
                            const shared_ptr<CipherV1> &cipher)
-    : _interface(iface.major()), _cipher(cipher) {}
+    : _interface(iface.major()),
+      _cipher(cipher),
+      _ciphers(new CipherPool(cipher)) {}
 
 StreamNameIO::~StreamNameIO() {}
 
@@ -93,11 +96,12 @@ int StreamNameIO::maxDecodedNameLen(int encodedStreamLen) const {
 
 string StreamNameIO::encodeName(const string &plaintextName,
                                 uint64_t *iv) const {
+  CipherV1 *cipher = _ciphers->local();
   uint64_t tmpIV = 0;
   int length = plaintextName.length();
   if (iv && _interface >= 2) tmpIV = *iv;
 
-  unsigned int mac = _cipher->reduceMac16(_cipher->MAC_64(
+  unsigned int mac = CipherV1::reduceMac16(cipher->MAC_64(
       reinterpret_cast<const byte *>(plaintextName.data()), length, iv));
   tmpIV ^= (uint64_t)mac;
 
@@ -111,7 +115,7 @@ string StreamNameIO::encodeName(const string &plaintextName,
 
   // stream encode the plaintext bytes
   memcpy(&encoded[2], plaintextName.data(), length);
-  _cipher->streamEncode(&encoded[2], length, tmpIV);
+  cipher->streamEncode(&encoded[2], length, tmpIV);
 
   // convert the entire thing to base 64 ascii..
   changeBase2Inline(encoded.data(), encodedStreamLen, 8, 6, true);
@@ -122,6 +126,7 @@ string StreamNameIO::encodeName(const string &plaintextName,
 
 string StreamNameIO::decodeName(const string &encodedName,
                                 uint64_t *iv) const {
+  CipherV1 *cipher = _ciphers->local();
   int length = encodedName.length();
   rAssert(length > 2);
   int decLen256 = B64ToB256Bytes(length);
@@ -145,11 +150,11 @@ string StreamNameIO::decodeName(const string &encodedName,
   if (iv && _interface >= 2) tmpIV = *iv;
 
   tmpIV ^= (uint64_t)mac;
-  _cipher->streamDecode(&tmpBuf.at(2), decodedStreamLen, tmpIV);
+  cipher->streamDecode(&tmpBuf.at(2), decodedStreamLen, tmpIV);
 
   // compute MAC to check with stored value
-  unsigned int mac2 = _cipher->reduceMac16(
-      _cipher->MAC_64(&tmpBuf.at(2), decodedStreamLen, iv));
+  unsigned int mac2 = CipherV1::reduceMac16(
+      cipher->MAC_64(&tmpBuf.at(2), decodedStreamLen, iv));
 
   if (mac2 != mac) {
     VLOG(1) << "checksum mismatch: expected " << mac << ", got " << mac2
@@ -26,6 +26,7 @@
 namespace encfs {
 
 class CipherV1;
+class CipherPool;
 
 class StreamNameIO : public NameIO {
  public:
@@ -51,6 +52,7 @@ class StreamNameIO : public NameIO {
  private:
   int _interface;
   shared_ptr<CipherV1> _cipher;
+  shared_ptr<CipherPool> _ciphers;  // per-thread copies of _cipher
 };
 
 }  // namespace encfs
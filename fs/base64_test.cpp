@@ -0,0 +1,253 @@
+/*****************************************************************************
+ * Author:   Valient Gough <vgough@pobox.com>
+ *
+ *****************************************************************************
+ * Copyright (c) 2013 Valient Gough
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "base/base64.h"
+
+using namespace encfs;
+
+namespace {
+
+// Reference versions of the name codecs, as they were before being replaced
+// by the iterative and table driven code.
+
+void refChangeBase2Inline(byte *src, int srcLen, int src2Pow, int dst2Pow,
+                          bool outputPartialLastByte, unsigned long work,
+                          int workBits, byte *outLoc) {
+  const int mask = (1 << dst2Pow) - 1;
+  if (!outLoc) outLoc = src;
+
+  while (srcLen && workBits < dst2Pow) {
+    work |= ((unsigned long)(*src++)) << workBits;
+    workBits += src2Pow;
+    --srcLen;
+  }
+
+  byte outVal = work & mask;
+  work >>= dst2Pow;
+  workBits -= dst2Pow;
+
+  if (srcLen) {
+    refChangeBase2Inline(src, srcLen, src2Pow, dst2Pow, outputPartialLastByte,
+                         work, workBits, outLoc + 1);
+    *outLoc = outVal;
+  } else {
+    *outLoc++ = outVal;
+
+    if (outputPartialLastByte) {
+      while (workBits > 0) {
+        *outLoc++ = work & mask;
+        work >>= dst2Pow;
+        workBits -= dst2Pow;
+      }
+    }
+  }
+}
+
+void refB64ToAscii(byte *in, int length) {
+  static const char table[] = ",-0123456789";
+  for (int offset = 0; offset < length; ++offset) {
+    int ch = in[offset];
+    if (ch > 11) {
+      if (ch > 37)
+        ch += 'a' - 38;
+      else
+        ch += 'A' - 12;
+    } else
+      ch = table[ch];
+
+    in[offset] = ch;
+  }
+}
+
+void refAsciiToB64(byte *buf, int length) {
+  static const byte table[] =
+      "                                            01  23456789:;       ";
+  while (length--) {
+    byte ch = *buf;
+    if (ch >= 'A') {
+      if (ch >= 'a')
+        ch += 38 - 'a';
+      else
+        ch += 12 - 'A';
+    } else
+      ch = table[ch] - '0';
+
+    *buf++ = ch;
+  }
+}
+
+void refB32ToAscii(byte *buf, int len) {
+  for (int offset = 0; offset < len; ++offset) {
+    int ch = buf[offset];
+    if (ch >= 0 && ch < 26)
+      ch += 'A';
+    else
+      ch += '2' - 26;
+
+    buf[offset] = ch;
+  }
+}
+
+void refAsciiToB32(byte *buf, int length) {
+  while (length--) {
+    byte ch = *buf;
+    int lch = toupper(ch);
+    if (lch >= 'A')
+      lch -= 'A';
+    else
+      lch += 26 - '2';
+
+    *buf++ = (byte)lch;
+  }
+}
+
+std::vector<byte> randomData(int len, int bits) {
+  std::vector<byte> data(len);
+  for (int i = 0; i < len; ++i) data[i] = rand() & ((1 << bits) - 1);
+  return data;
+}
+
+void checkChangeBase(int srcPow, int dstPow, bool partial) {
+  for (int len = 1; len < 300; ++len) {
+    std::vector<byte> data = randomData(len, srcPow);
+    // room for the output, with a marker to catch overruns.
+    data.resize(len * 2 + 8, 0xa5);
+    std::vector<byte> expected = data;
+
+    changeBase2Inline(&data[0], len, srcPow, dstPow, partial);
+    refChangeBase2Inline(&expected[0], len, srcPow, dstPow, partial, 0, 0, 0);
+    ASSERT_TRUE(data == expected) << "base " << srcPow << " -> " << dstPow
+                                  << ", partial " << partial << ", length "
+                                  << len;
+  }
+}
+
+// Compares the translation over every byte value, at different offsets so
+// that both vector and scalar code is used.
+void checkTranslate(void (*fn)(byte *, int), void (*ref)(byte *, int),
+                    const std::vector<byte> &input) {
+  for (int start = 0; start < 20; ++start) {
+    for (int len = 0; start + len <= (int)input.size(); len += 7) {
+      std::vector<byte> data(input.begin() + start,
+                             input.begin() + start + len);
+      std::vector<byte> expected = data;
+      if (len) {
+        fn(&data[0], len);
+        ref(&expected[0], len);
+      }
+      ASSERT_TRUE(data == expected) << "offset " << start << ", length "
+                                    << len;
+    }
+  }
+}
+
+std::vector<byte> alphabet(const char *chars, int repeat) {
+  std::vector<byte> data;
+  for (int i = 0; i < repeat; ++i)
+    for (const char *p = chars; *p; ++p) data.push_back(*p);
+  return data;
+}
+
+std::vector<byte> allBytes() {
+  std::vector<byte> data;
+  for (int i = 0; i < 256; ++i) data.push_back(i);
+  return data;
+}
+
+TEST(Base64Test, ChangeBase2Inline) {
+  checkChangeBase(8, 6, true);
+  checkChangeBase(8, 5, true);
+  checkChangeBase(6, 8, false);
+  checkChangeBase(5, 8, false);
+  checkChangeBase(6, 8, true);
+  checkChangeBase(8, 6, false);
+}
+
+TEST(Base64Test, ChangeBase2InlineOutOfRangeInput) {
+  // decoding invalid names passes values with high bits set.
+  for (int len = 1; len < 100; ++len) {
+    std::vector<byte> data = randomData(len, 8);
+    data.resize(len * 2 + 8, 0);
+    std::vector<byte> expected = data;
+
+    changeBase2Inline(&data[0], len, 6, 8, false);
+    refChangeBase2Inline(&expected[0], len, 6, 8, false, 0, 0, 0);
+    ASSERT_TRUE(data == expected) << "length " << len;
+  }
+}
+
+TEST(Base64Test, NameRoundTrip) {
+  for (int len = 1; len < 100; ++len) {
+    std::vector<byte> orig = randomData(len, 8);
+    for (int bits = 5; bits <= 6; ++bits) {
+      int encLen = (bits == 6) ? B256ToB64Bytes(len) : B256ToB32Bytes(len);
+      std::vector<byte> buf = orig;
+      buf.resize(encLen + 8);
+
+      changeBase2Inline(&buf[0], len, 8, bits, true);
+      if (bits == 6) {
+        B64ToAscii(&buf[0], encLen);
+        AsciiToB64(&buf[0], encLen);
+      } else {
+        B32ToAscii(&buf[0], encLen);
+        AsciiToB32(&buf[0], encLen);
+      }
+      changeBase2Inline(&buf[0], encLen, bits, 8, false);
+
+      ASSERT_EQ(0, memcmp(&orig[0], &buf[0], len)) << "length " << len;
+    }
+  }
+}
+
+TEST(Base64Test, B64Ascii) {
+  std::vector<byte> values;
+  for (int i = 0; i < 8; ++i)
+    for (int v = 0; v < 64; ++v) values.push_back(v);
+  checkTranslate(B64ToAscii, refB64ToAscii, values);
+  checkTranslate(B64ToAscii, refB64ToAscii, allBytes());
+
+  const char *chars =
+      ",-0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  checkTranslate(AsciiToB64, refAsciiToB64, alphabet(chars, 8));
+  checkTranslate(AsciiToB64, refAsciiToB64, allBytes());
+}
+
+TEST(Base64Test, B32Ascii) {
+  std::vector<byte> values;
+  for (int i = 0; i < 8; ++i)
+    for (int v = 0; v < 32; ++v) values.push_back(v);
+  checkTranslate(B32ToAscii, refB32ToAscii, values);
+  checkTranslate(B32ToAscii, refB32ToAscii, allBytes());
+
+  checkTranslate(AsciiToB32, refAsciiToB32,
+                 alphabet("ABCDEFGHIJKLMNOPQRSTUVWXYZ234567", 8));
+  checkTranslate(AsciiToB32, refAsciiToB32,
+                 alphabet("abcdefghijklmnopqrstuvwxyz234567", 8));
+  checkTranslate(AsciiToB32, refAsciiToB32, allBytes());
+}
+
+}  // namespace
@@ -232,6 +232,7 @@ bool runTests(const shared_ptr<CipherV1> &cipher, bool verbose) {
 
   FSConfigPtr fsCfg = FSConfigPtr(new FSConfig);
   fsCfg->cipher = cipher;
+  fsCfg->dataCipher = cipher;
   fsCfg->key = key;
   fsCfg->config.reset(new EncfsConfig);
   fsCfg->config->set_block_size(FSBlockSize);
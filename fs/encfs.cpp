@@ -38,6 +38,7 @@
 #endif
 
 
+#include <algorithm>
 #include <string>
 #include <map>
 
@@ -57,10 +58,15 @@ using std::tuple;
 #include "base/shared_ptr.h"
 #include "base/Mutex.h"
 #include "base/Error.h"
+#include "base/sha256.h"
+#include "base/WorkerPool.h"
 #include "cipher/MemoryPool.h"
+#include "fs/BlockIndex.h"
 #include "fs/DirNode.h"
+#include "fs/FileNode.h"
 #include "fs/FileUtils.h"
 #include "fs/Context.h"
+#include "fs/PlainDigest.h"
 
 #include <glog/logging.h>
 
@@ -76,6 +82,9 @@ namespace encfs {
 
 #define ESUCCESS 0
 
+// most entries from a single directory listing to stat ahead of getattr.
+static const size_t MaxStatAhead = 4096;
+
 #define GET_FN(ctx, finfo) ctx->getNode((void *)(uintptr_t)finfo->fh)
 
 static EncFS_Context *context() {
@@ -111,11 +120,24 @@ static int withCipherPath(const char *opName, const char *path,
 
     res = op(ctx, cyName, data);
 
+    // Packed files have no extended attributes, and are moved out of their
+    // pack before anything else changes them.
+    if ((res == -ENOENT || (res == -1 && errno == ENOENT)) &&
+        FSRoot->isPacked(path)) {
+      if (passReturnCode)
+        res = -ENOTSUP;
+      else if (FSRoot->unpack(path) > 0)
+        res = op(ctx, cyName, data);
+    }
+
     if (res == -1) {
       res = -errno;
       LOG(INFO) << opName << " error: " << strerror(-res);
     } else if (!passReturnCode)
       res = ESUCCESS;
+
+    // everything but the xattr lookups may have changed the attributes.
+    if (!passReturnCode) FSRoot->attrChanged(cyName);
   }
   catch (Error &err) {
     LOG(ERROR) << "error caught in " << opName << ":" << err.what();
@@ -154,34 +176,57 @@ static int withFileNode(const char *opName, const char *path,
   return res;
 }
 
+// determine plaintext link size..  Easiest to read and decrypt..
+static int linkSize(const shared_ptr<DirNode> &FSRoot, const char *cipherName,
+                    struct stat *stbuf) {
+  vector<char> buf(stbuf->st_size + 1, 0);
+
+  int res = ::readlink(cipherName, &buf[0], stbuf->st_size);
+  if (res < 0) return -errno;
+
+  // other functions expect c-strings to be null-terminated, which
+  // readlink doesn't provide
+  buf[res] = '\0';
+
+  stbuf->st_size = FSRoot->plainPath(&buf[0]).length();
+  return ESUCCESS;
+}
+
 int _do_getattr(FileNode *fnode, struct stat *stbuf) {
   int res = fnode->getAttr(stbuf);
   if (res == ESUCCESS && S_ISLNK(stbuf->st_mode)) {
     EncFS_Context *ctx = context();
     shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
-    if (FSRoot) {
-      // determine plaintext link size..  Easiest to read and decrypt..
-      vector<char> buf(stbuf->st_size + 1, 0);
-
-      res = ::readlink(fnode->cipherName(), &buf[0], stbuf->st_size);
-      if (res >= 0) {
-        // other functions expect c-strings to be null-terminated, which
-        // readlink doesn't provide
-        buf[res] = '\0';
-
-        stbuf->st_size = FSRoot->plainPath(&buf[0]).length();
-
-        res = ESUCCESS;
-      } else
-        res = -errno;
-    }
+    if (FSRoot) res = linkSize(FSRoot, fnode->cipherName(), stbuf);
   }
 
   return res;
 }
 
+// Doesn't go through withFileNode, since building a FileNode (and its IO
+// stack) just to stat a file which isn't open is expensive for large
+// directory listings.
 int encfs_getattr(const char *path, struct stat *stbuf) {
-  return withFileNode("getattr", path, NULL, _do_getattr, stbuf);
+  EncFS_Context *ctx = context();
+
+  int res = -EIO;
+  shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) return res;
+
+  try {
+    string cyName;
+    res = FSRoot->getAttr(path, stbuf, &cyName);
+    VLOG(1) << "getattr " << cyName;
+
+    if (res == ESUCCESS && S_ISLNK(stbuf->st_mode))
+      res = linkSize(FSRoot, cyName.c_str(), stbuf);
+
+    LOG_IF(INFO, res < 0) << "getattr error: " << strerror(-res);
+  }
+  catch (Error &err) {
+    LOG(ERROR) << "error caught in getattr:" << err.what();
+  }
+  return res;
 }
 
 int encfs_fgetattr(const char *path, struct stat *stbuf,
@@ -198,22 +243,24 @@ int encfs_getdir(const char *path, fuse_dirh_t h, fuse_dirfil_t filler) {
 
   try {
 
-    DirTraverse dt = FSRoot->openDir(path);
+    shared_ptr<const DirListing> listing = FSRoot->listDir(path);
 
     VLOG(1) << "getdir on " << FSRoot->cipherPath(path);
 
-    if (dt.valid()) {
-      int fileType = 0;
-      ino_t inode = 0;
+    if (listing) {
+      vector<string> statNames;
 
-      std::string name = dt.nextPlaintextName(&fileType, &inode);
-      while (!name.empty()) {
-        res = filler(h, name.c_str(), fileType, inode);
+      DirListing::const_iterator it;
+      for (it = listing->begin(); it != listing->end(); ++it) {
+        res = filler(h, it->plainName.c_str(), it->fileType, it->inode);
 
         if (res != ESUCCESS) break;
 
-        name = dt.nextPlaintextName(&fileType, &inode);
-      } 
+        if (statNames.size() < MaxStatAhead)
+          statNames.push_back(it->cipherName);
+      }
+
+      FSRoot->statAhead(path, statNames);
     } else {
       LOG(INFO) << "getdir request invalid, path: '" << path << "'";
     }
@@ -259,6 +306,8 @@ int encfs_mknod(const char *path, mode_t mode, dev_t rdev) {
       if (dnode->getAttr(&st) == 0)
         res = fnode->mknod(mode, rdev, uid, st.st_gid);
     }
+
+    FSRoot->nameChanged(fnode->cipherName());
   }
   catch (Error &err) {
     LOG(ERROR) << "error caught in mknod: " << err.what();
@@ -318,12 +367,21 @@ int encfs_unlink(const char *path) {
 }
 
 
-int _do_rmdir(EncFS_Context *, const string &cipherPath, int) {
-  return rmdir(cipherPath.c_str());
-}
-
 int encfs_rmdir(const char *path) {
-  return withCipherPath("rmdir", path, _do_rmdir, 0);
+  EncFS_Context *ctx = context();
+
+  int res = -EIO;
+  shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) return res;
+
+  try {
+    // sharded directories hold more then the entries.
+    res = FSRoot->rmdir(path);
+  }
+  catch (Error &err) {
+    LOG(ERROR) << "error caught in rmdir: " << err.what();
+  }
+  return res;
 }
 
 int _do_readlink(EncFS_Context *ctx, const string &cyName,
@@ -393,6 +451,7 @@ int encfs_symlink(const char *from, const char *to) {
       res = -errno;
     else
       res = ESUCCESS;
+    FSRoot->nameChanged(toCName);
   }
   catch (Error &err) {
     LOG(ERROR) << "error caught in symlink: " << err.what();
@@ -456,7 +515,17 @@ int encfs_chown(const char *path, uid_t uid, gid_t gid) {
 int _do_truncate(FileNode *fnode, off_t size) { return fnode->truncate(size); }
 
 int encfs_truncate(const char *path, off_t size) {
-  return withFileNode("truncate", path, NULL, _do_truncate, size);
+  int res = withFileNode("truncate", path, NULL, _do_truncate, size);
+
+  // a packed file is moved out of its pack before it is changed.
+  if (res == -ENOENT || res == -EROFS) {
+    int err = 0;
+    shared_ptr<DirNode> FSRoot = context()->getRoot(&err);
+    if (FSRoot && FSRoot->unpack(path) > 0)
+      res = withFileNode("truncate", path, NULL, _do_truncate, size);
+  }
+
+  return res;
 }
 
 int encfs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
@@ -506,6 +575,13 @@ int encfs_open(const char *path, struct fuse_file_info *file) {
       if (res >= 0) {
         file->fh = (uintptr_t)ctx->putNode(path, fnode);
         res = ESUCCESS;
+
+        // Without this the kernel drops the file's cached pages on every
+        // open, and they have to be decoded again.  Shared volumes can
+        // change elsewhere without the raw file looking any different yet.
+        struct stat st;
+        if (!ctx->opts->sharedVolume && fnode->getAttr(&st) == 0)
+          file->keep_cache = ctx->keepCache(st);
       }
     }
   }
@@ -516,20 +592,7 @@ int encfs_open(const char *path, struct fuse_file_info *file) {
   return res;
 }
 
-int _do_flush(FileNode *fnode, int) {
-  /* Flush can be called multiple times for an open file, so it doesn't
-     close the file.  However it is important to call close() for some
-     underlying filesystems (like NFS).
-   */
-  int res = fnode->open(O_RDONLY);
-  if (res >= 0) {
-    int fh = res;
-    res = close(dup(fh));
-    if (res == -1) res = -errno;
-  }
-
-  return res;
-}
+int _do_flush(FileNode *fnode, int) { return fnode->flush(); }
 
 int encfs_flush(const char *path, struct fuse_file_info *fi) {
   return withFileNode("flush", path, fi, _do_flush, 0);
@@ -544,6 +607,14 @@ int encfs_release(const char *path, struct fuse_file_info *finfo) {
   EncFS_Context *ctx = context();
 
   try {
+    // our own writes also went through the kernel's cache, so it is still
+    // valid for the file as we leave it.  Other changes made while the file
+    // was open are not, and noteClosed forgets the file then.
+    shared_ptr<FileNode> fnode = ctx->getNode((void *)(uintptr_t)finfo->fh);
+    struct stat st;
+    if (fnode && fnode->getAttr(&st) == 0)
+      ctx->noteClosed(st, fnode->written());
+
     ctx->eraseNode(path, (void *)(uintptr_t)finfo->fh);
     return ESUCCESS;
   }
@@ -638,6 +709,82 @@ int encfs_setxattr(const char *path, const char *name, const char *value,
 }
 #endif
 
+// Reverse mode block index, see BlockIndex.h.  Falls back to the real
+// attribute if no index is kept.
+int _do_getblockindex(EncFS_Context *ctx, const string &cyName,
+                      tuple<const char *, int, void *, size_t> data) {
+  int res = -EIO;
+  shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) return res;
+
+  shared_ptr<BlockIndex> index = FSRoot->config()->blockIndex;
+  if (!index) {
+#ifdef XATTR_ADD_OPT
+    return ::getxattr(cyName.c_str(), get<0>(data), get<2>(data), get<3>(data),
+                      0, 0);
+#else
+    return ::getxattr(cyName.c_str(), get<0>(data), get<2>(data), get<3>(data));
+#endif
+  }
+
+  return index->readChunk(cyName, get<1>(data), get<2>(data), get<3>(data));
+}
+
+// Plaintext digest, see PlainDigest.h.  Falls back to the real attribute in
+// reverse mode and for anything but regular files.
+int _do_getdigest(EncFS_Context *ctx, const string &cyName,
+                  tuple<const char *, const char *, void *, size_t> data) {
+  int res = -EIO;
+  shared_ptr<DirNode> FSRoot = ctx->getRoot(&res);
+  if (!FSRoot) return res;
+
+  const char *path = get<0>(data);
+  void *buf = get<2>(data);
+  size_t size = get<3>(data);
+
+  // packed files have no backing file, but are always regular files.
+  struct stat st;
+  shared_ptr<PlainDigest> digests = FSRoot->config()->digests;
+  if (!digests ||
+      (::lstat(cyName.c_str(), &st) == 0 && !S_ISREG(st.st_mode))) {
+#ifdef XATTR_ADD_OPT
+    return ::getxattr(cyName.c_str(), get<1>(data), buf, size, 0, 0);
+#else
+    return ::getxattr(cyName.c_str(), get<1>(data), buf, size);
+#endif
+  }
+
+  // answer size queries without reading the file.
+  if (size == 0) return PlainDigest::HexSize;
+  if (size < (size_t)PlainDigest::HexSize) return -ERANGE;
+
+  // Each lane reads through a node of its own, so that the lanes decode in
+  // parallel.  An open file only has the one node, and without worker
+  // threads there is still the calling thread.
+  int lanes = std::max(1, WorkerPool::Default()->threadCount());
+  vector<shared_ptr<FileNode> > nodes;
+  for (int i = 0; i < lanes && i < PlainDigest::MaxLanes; ++i) {
+    shared_ptr<FileNode> node =
+        FSRoot->openNode(path, "getxattr", O_RDONLY, &res);
+    if (!node) {
+      if (nodes.empty()) return res;
+      break;
+    }
+    if (!nodes.empty() && node == nodes[0]) break;
+    nodes.push_back(node);
+  }
+
+  unsigned char digest[SHA256::DigestSize];
+  res = digests->digest(
+      cyName, nodes.size(),
+      [&nodes](int lane, off_t offset, unsigned char *out, ssize_t len) {
+        return nodes[lane]->read(offset, out, len);
+      },
+      digest);
+  if (res < 0) return res;
+
+  return PlainDigest::FormatAttr(digest, (char *)buf, size);
+}
 
 #ifdef XATTR_ADD_OPT
 int _do_getxattr(EncFS_Context *, const string &cyName,
@@ -648,6 +795,15 @@ int _do_getxattr(EncFS_Context *, const string &cyName,
 }
 int encfs_getxattr(const char *path, const char *name, char *value, size_t size,
                    uint32_t position) {
+  int chunk;
+  if (BlockIndex::ParseAttrName(name, &chunk))
+    return withCipherPath("getxattr", path, _do_getblockindex,
+                          make_tuple(name, chunk, (void *)value, size), true);
+
+  if (strcmp(name, PlainDigest::AttrName) == 0)
+    return withCipherPath("getxattr", path, _do_getdigest,
+                          make_tuple(path, name, (void *)value, size), true);
+
   return withCipherPath("getxattr", path, _do_getxattr,
                         make_tuple(name, (void *)value, size, position), true);
 }
@@ -658,6 +814,15 @@ int _do_getxattr(EncFS_Context *, const string &cyName,
 }
 int encfs_getxattr(const char *path, const char *name, char *value,
                    size_t size) {
+  int chunk;
+  if (BlockIndex::ParseAttrName(name, &chunk))
+    return withCipherPath("getxattr", path, _do_getblockindex,
+                          make_tuple(name, chunk, (void *)value, size), true);
+
+  if (strcmp(name, PlainDigest::AttrName) == 0)
+    return withCipherPath("getxattr", path, _do_getdigest,
+                          make_tuple(path, name, (void *)value, size), true);
+
   return withCipherPath("getxattr", path, _do_getxattr,
                         make_tuple(name, (void *)value, size), true);
 }
@@ -27,6 +27,7 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include "cipher/CipherPool.h"
 #include "cipher/CipherV1.h"
 #include "cipher/MemoryPool.h"
 
@@ -46,6 +47,8 @@ FSConfigPtr makeConfig(const shared_ptr<CipherV1>& cipher, int blockSize) {
   cfg->cipher = cipher;
   cfg->key = cipher->newRandomKey();
   cfg->cipher->setKey(cfg->key);
+  cfg->dataCipher = cipher;
+  cfg->cipherPool.reset(new CipherPool(cfg->cipher));
   cfg->config.reset(new EncfsConfig);
   cfg->config->set_block_size(blockSize);
   cfg->opts.reset(new EncFS_Opts);
@@ -31,17 +31,22 @@
 #include "fs/Context.h"
 #include "fs/FileNode.h"
 #include "fs/DirNode.h"
+#include "fs/NullNameIO.h"
+#include "fs/PackStore.h"
 
 #include <glog/logging.h>
 
 #include <iostream>
 #include <string>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <list>
 
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <fcntl.h>
 
 using namespace encfs;
@@ -65,6 +70,7 @@ static int cmd_showcruft(int argc, char **argv);
 static int cmd_cat(int argc, char **argv);
 static int cmd_export(int argc, char **argv);
 static int cmd_showKey(int argc, char **argv);
+static int cmd_pack(int argc, char **argv);
 
 struct CommandOpts {
   const char *name;
@@ -106,6 +112,10 @@ struct CommandOpts {
       {"export", 2, 2, cmd_export, "(root dir) path",
        // xgroup(usage)
        gettext_noop("  -- decrypts a volume and writes results to path")},
+      {"pack", 1, 2, cmd_pack, "(root dir) [max size]",
+       // xgroup(usage)
+       gettext_noop("  -- stores small files of an unmounted volume in "
+                    "per-directory packs")},
       {"ciphers", 0, 0, showCiphers, "",
        // xgroup(usage)
        gettext_noop("  -- show available ciphers")},
@@ -637,6 +647,85 @@ static int cmd_showcruft(int argc, char **argv) {
   return EXIT_SUCCESS;
 }
 
+// Files up to this size (in bytes) are packed, unless told otherwise.
+static const off_t DefaultPackSize = 4096;
+
+static int packTree(const string &dir, off_t maxSize, int *packed) {
+  int count = 0;
+  int res = PackStore::PackDirectory(dir, maxSize, &count);
+  if (res != 0) {
+    cerr << autosprintf(_("Unable to pack %s: %s\n"), dir.c_str(),
+                        strerror(-res));
+    return res;
+  }
+  *packed += count;
+
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL) return -errno;
+
+  // includes the shard directories of sharded volumes.
+  vector<string> subdirs;
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    string name = de->d_name;
+    if (name == "." || name == "..") continue;
+
+    struct stat st;
+    string path = dir + '/' + name;
+    if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      subdirs.push_back(path);
+  }
+  closedir(d);
+
+  for (size_t i = 0; i < subdirs.size() && res == 0; ++i)
+    res = packTree(subdirs[i], maxSize, packed);
+
+  return res;
+}
+
+static int cmd_pack(int argc, char **argv) {
+  string rootDir = argv[1];
+  if (!checkDir(rootDir)) return EXIT_FAILURE;
+
+  off_t maxSize = DefaultPackSize;
+  if (argc > 2) {
+    char *end = NULL;
+    maxSize = strtol(argv[2], &end, 10);
+    if (*end != '\0' || maxSize <= 0) {
+      cerr << autosprintf(_("Invalid size: %s\n"), argv[2]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  EncfsConfig config;
+  if (readConfig(rootDir, config) == Config_None) {
+    cout << _("Unable to load or parse config file\n");
+    return EXIT_FAILURE;
+  }
+
+  // pack files would collide with plaintext names.
+  if (config.naming().name() == NullNameIO::CurrentInterface().name()) {
+    cout << _("Packing is not supported with null filename encoding\n");
+    return EXIT_FAILURE;
+  }
+
+  // older versions wouldn't see packed files, so mark the volume first.
+  if (!config.packed_files()) {
+    config.set_packed_files(true);
+    if (!saveConfig(rootDir, config)) {
+      cout << _("Error saving modified config file.\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  int packed = 0;
+  int res = packTree(rootDir.substr(0, rootDir.length() - 1), maxSize,
+                     &packed);
+  cout << autosprintf(_("Packed %i files.\n"), packed);
+
+  return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static int do_chpasswd(bool useStdin, bool annotate, int argc, char **argv) {
   (void)argc;
   string rootDir = argv[1];